@@ -0,0 +1,495 @@
+/*--------------------------------------------------------------------*/
+/* bench-micro.c: microbenchmarks for packet encode/decode, ARP and
+   forwarding lookups on synthetic routing tables.
+
+   usage : bench_micro [<max routes>]
+
+   It must be run in the directory holding the configuration files
+   since the ARP and DNS tables are loaded from them. Socket I/O goes
+   through a UNIX-domain socketpair, so no hub is needed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "dist-vec.h"
+#include "topo-db.h"
+/*--------------------------------------------------------------------*/
+
+#define BENCH_MIN_TIME_NS  200000000L //run each benchmark for at least 0.2 sec
+#define BENCH_MIN_ITERS    10 //run each benchmark at least this many times
+#define BENCH_MAX_ROUTES   1000000 //default upper bound of synthetic routing table
+#define BENCH_FORWARD_PAYLOAD 64 //payload of a forwarded chat packet
+#define BENCH_TOPO_FILE ".bench.topology.db" //topology image compiled for the startup benchmark
+
+/* station measured: host mercury for the IP stack, with synthetic DV tables */
+dv_router g_bench;
+
+/* allocation counters fed by the -Wl,--wrap wrappers below */
+static long g_alloc_cnt;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+  g_alloc_cnt++;
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size)
+{
+  g_alloc_cnt++;
+  return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+  g_alloc_cnt++;
+  return __real_realloc(ptr, size);
+}
+
+/* socketpair used in place of the hub connection */
+int g_sv[2];
+
+/*--------------------------------------------------------------------*/
+/* get monotonic time in nanoseconds */
+long bench_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000L + ts.tv_nsec;
+}
+
+/* run fn(arg) repeatedly and report ns/op and allocs/op */
+void bench_run(char* name, int size, void (*fn)(void*), void* arg)
+{
+  long start, elapsed;
+  long iters = 0;
+  long allocs;
+
+  fn(arg); //warm up caches and lazily built state
+
+  allocs = g_alloc_cnt;
+  start = bench_now();
+  do {
+    fn(arg);
+    iters++;
+    elapsed = bench_now() - start;
+  } while((elapsed < BENCH_MIN_TIME_NS) || (iters < BENCH_MIN_ITERS));
+  allocs = g_alloc_cnt - allocs;
+
+  printf("%-32s %8d %14.1f ns/op %8.2f allocs/op %10ld iters\n", name, size,
+	 (double) elapsed / iters, (double) allocs / iters, iters);
+  fflush(NULL);
+}
+
+/* read exactly n bytes of a frame back from the peer end of the socketpair */
+void bench_drain(int n)
+{
+  char buf[BUF_SIZE];
+  int cnt;
+
+  while(n > 0)
+  {
+    cnt = read(g_sv[1], buf, n < BUF_SIZE ? n : BUF_SIZE);
+    if(cnt <= 0)
+    {
+      perror("read");
+      exit(1);
+    }
+    n -= cnt;
+  }
+}
+/*--------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------*/
+/* build synthetic tables with routes /24 networks reachable through 3 ports.
+   The ports are attached to lan1, lan2 and lan3 of ip-addr.conf, and the next
+   hops are routers on them, so ARP resolves them as it does in a real router. */
+void bench_setup_tables(int routes)
+{
+  static const in_addr_t next_hops[3] = {0x80010001, 0x80020002, 0x80030002}; //router1, router2 and router3
+  int i;
+
+  free(g_bench.rt_table);
+  free(g_bench.fw_table);
+  free(g_bench.net_table);
+  free(g_bench.port_table);
+
+  g_bench.rt_table = (rt_table_entry*) calloc(routes + PORT_TABLE_SIZE, sizeof(rt_table_entry));
+  g_bench.fw_table = (fw_table_entry*) calloc(routes + PORT_TABLE_SIZE, sizeof(fw_table_entry));
+  g_bench.net_table = (net_table_entry*) calloc(NET_TABLE_SIZE, sizeof(net_table_entry));
+  g_bench.port_table = (port_table_entry*) calloc(PORT_TABLE_SIZE, sizeof(port_table_entry));
+  g_bench.rt_table_max = routes + PORT_TABLE_SIZE;
+  g_bench.fw_table_max = routes + PORT_TABLE_SIZE;
+  if(!g_bench.rt_table || !g_bench.fw_table || !g_bench.net_table || !g_bench.port_table)
+  {
+    fprintf(stderr, "error : unable to calloc\n");
+    exit(1);
+  }
+
+  g_bench.net_table_size = 0;
+  g_bench.port_table_size = 0;
+  for(i = 0; i < 3; i++)
+  {
+    g_bench.net_table[i].net = htonl(0x80000000 | ((i + 1) << 16)); //128.(i+1).0.0/16
+    g_bench.net_table[i].mask = htonl(0xFFFF0000);
+    g_bench.net_table_size++;
+
+    g_bench.port_table[i].itf = g_sv[0];
+    sprintf(g_bench.port_table[i].itf_name, "eth%d", i);
+    g_bench.port_table[i].cost = 1;
+    g_bench.port_table_size++;
+  }
+
+  g_bench.rt_table_size = 0;
+  g_bench.fw_table_size = 0;
+  for(i = 0; i < routes; i++)
+  {
+    rt_table_entry* rte = &g_bench.rt_table[i];
+    fw_table_entry* fwe = &g_bench.fw_table[i];
+
+    rte->dest = htonl(0x0A000000 + (i << 8)); //10.x.y.0/24
+    rte->mask = htonl(0xFFFFFF00);
+    rte->next = htonl(next_hops[i % 3]);
+    rte->hop = 2 + (i % 5);
+    rte->itf = g_sv[0];
+    sprintf(rte->itf_name, "eth%d", i % 3);
+    rte->status = RTE_UP;
+    rte->time = getcurtime();
+    g_bench.rt_table_size++;
+
+    fwe->dest = rte->dest;
+    fwe->mask = rte->mask;
+    fwe->next = rte->next;
+    fwe->itf = rte->itf;
+    strcpy(fwe->itf_name, rte->itf_name);
+    fwe->flag = 1;
+    g_bench.fw_table_size++;
+  }
+
+  dv_index_tables(&g_bench);
+  dv_invalidate_flow_cache(&g_bench);
+}
+/*--------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------*/
+typedef struct _bench_pkt_arg
+{
+  IPPkt* ippkt; //packet to send
+  int frame_len; //length of the linearized Ethernet frame
+  char* frame; //linearized Ethernet frame for receiving
+} bench_pkt_arg;
+
+void bench_sendippkt(void* arg)
+{
+  bench_pkt_arg* a = (bench_pkt_arg*) arg;
+
+  sendippkt(&g_bench, g_sv[0], a->ippkt);
+  bench_drain(a->frame_len);
+}
+
+void bench_recvippkt(void* arg)
+{
+  bench_pkt_arg* a = (bench_pkt_arg*) arg;
+  IPPkt* ippkt;
+
+  if(write(g_sv[1], a->frame, a->frame_len) != a->frame_len)
+  {
+    perror("write");
+    exit(1);
+  }
+
+  ippkt = recvippkt(&g_bench, g_sv[0]);
+  if(ippkt == NULL)
+  {
+    fprintf(stderr, "error : recvippkt() failed\n");
+    exit(1);
+  }
+  freeippkt(ippkt);
+}
+
+void bench_packets(in_addr_t src, in_addr_t dst, int payload)
+{
+  bench_pkt_arg a;
+  IPPkt ippkt;
+  char name[NAME_SIZE];
+  char* dat;
+
+  dat = (char*) calloc(payload, 1);
+  ippkt.dst = dst;
+  ippkt.src = src;
+  ippkt.type = DATA_CHAT;
+  ippkt.ttl = IP_DEFAULT_TTL;
+  ippkt.dat = dat;
+
+  a.ippkt = &ippkt;
+  ippkt.len = payload;
+  ippkt.cksum = ip_header_cksum(&ippkt);
+  a.frame_len = 2*sizeof(HwAddr) + sizeof(ushort) + IP_HDR_SIZE + payload;
+
+  sprintf(name, "sendippkt(%dB)", payload);
+  bench_run(name, payload, bench_sendippkt, &a);
+
+  /* capture one frame from the peer as it appears on the wire to replay it for recvippkt() */
+  a.frame = (char*) malloc(a.frame_len);
+  ippkt.dst = src;
+  ippkt.src = dst;
+  ippkt.cksum = ip_header_cksum(&ippkt);
+  sendippkt(&g_bench, g_sv[0], &ippkt);
+  if(read(g_sv[1], a.frame, a.frame_len) != a.frame_len)
+  {
+    perror("read");
+    exit(1);
+  }
+
+  sprintf(name, "recvippkt(%dB)", payload);
+  bench_run(name, payload, bench_recvippkt, &a);
+
+  free(a.frame);
+  free(dat);
+}
+/*--------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------*/
+typedef struct _bench_arp_arg
+{
+  in_addr_t addr; //address to resolve
+} bench_arp_arg;
+
+void bench_arp(void* arg)
+{
+  bench_arp_arg* a = (bench_arp_arg*) arg;
+  HwAddr hwaddr;
+
+  arp_ipaddr_to_hwaddr(a->addr, hwaddr);
+}
+
+typedef struct _bench_dns_arg
+{
+  char* name; //name to resolve
+} bench_dns_arg;
+
+void bench_dns(void* arg)
+{
+  bench_dns_arg* a = (bench_dns_arg*) arg;
+  in_addr_t ipaddr[ADDR_NUM];
+  int ipaddr_num;
+
+  dns_name_to_ipaddr(a->name, ipaddr, &ipaddr_num);
+}
+
+void bench_topo_text(void* arg)
+{
+  if (!init_mac_table(MAC_FILE) || !init_ip_table(IP_FILE) || !init_gw_table(GW_FILE))
+    exit(1);
+}
+
+void bench_topo_image(void* arg)
+{
+  g_topo_image_tried = 0; //map the image again
+  if (!topo_load_image())
+    exit(1);
+}
+
+typedef struct _bench_route_arg
+{
+  in_addr_t dst; //destination to look up
+  in_addr_t neighbor; //advertising neighbor
+  dv_entry* dv; //DV entries to apply
+  int dv_entry_num; //number of DV entries
+  char* msg; //encoded DV message
+  int len; //length of msg
+  IPPkt* ippkt; //packet to forward
+  ushort cksum; //header checksum of ippkt before it is forwarded
+} bench_route_arg;
+
+void bench_lookup(void* arg)
+{
+  bench_route_arg* a = (bench_route_arg*) arg;
+
+  dv_get_sock_for_destination(&g_bench, -1, 0, a->dst);
+}
+
+void bench_forward(void* arg)
+{
+  bench_route_arg* a = (bench_route_arg*) arg;
+
+  /* dv_forward() decrements the TTL and updates the checksum */
+  a->ippkt->ttl = IP_DEFAULT_TTL;
+  a->ippkt->cksum = a->cksum;
+  dv_forward(&g_bench, a->ippkt);
+  bench_drain(2*sizeof(HwAddr) + sizeof(ushort) + IP_HDR_SIZE + BENCH_FORWARD_PAYLOAD);
+}
+
+void bench_update(void* arg)
+{
+  bench_route_arg* a = (bench_route_arg*) arg;
+
+  dv_update_rt_table(&g_bench, g_sv[0], a->neighbor, a->dv, a->dv_entry_num, 1);
+}
+
+void bench_encode(void* arg)
+{
+  char* msg;
+  int len;
+
+  int start = 0;
+
+  msg = dv_encode_dv_message(&g_bench, DV_ADVERTISE, -1, &start, &len);
+  free(msg);
+}
+
+void bench_decode(void* arg)
+{
+  bench_route_arg* a = (bench_route_arg*) arg;
+  dv_entry* dv;
+  int dv_entry_num;
+  ushort cmd;
+  int cost;
+
+  if(!dv_decode_dv_message(a->msg, a->len, &dv, &dv_entry_num, &cmd, &cost))
+  {
+    fprintf(stderr, "error : DV message cannot be decoded\n");
+    exit(1);
+  }
+  free(dv);
+}
+
+void bench_routes(int routes)
+{
+  bench_route_arg a;
+  dv_entry dv;
+  IPPkt ippkt;
+  char dat[BENCH_FORWARD_PAYLOAD];
+  int start;
+  int i;
+
+  bench_setup_tables(routes);
+
+  /* the last entry is the worst case of the linear lookups */
+  a.dst = g_bench.rt_table[routes-1].dest | htonl(1);
+  bench_run("dv_get_sock_for_destination", routes, bench_lookup, &a);
+
+  /* a long-lived flow toward the last entry hits the flow cache after its first packet */
+  memset(dat, 0, sizeof(dat));
+  ippkt.dst = a.dst;
+  ippkt.src = g_bench.net_table[0].net | htonl(1);
+  ippkt.len = BENCH_FORWARD_PAYLOAD;
+  ippkt.type = DATA_CHAT;
+  ippkt.ttl = IP_DEFAULT_TTL;
+  ippkt.dat = dat;
+  a.ippkt = &ippkt;
+  a.cksum = ip_header_cksum(&ippkt);
+  bench_run("dv_forward(flow cache hit)", routes, bench_forward, &a);
+
+  /* a neighbor refreshes the last route */
+  dv.dest = g_bench.rt_table[routes-1].dest;
+  dv.mask = g_bench.rt_table[routes-1].mask;
+  dv.hop = g_bench.rt_table[routes-1].hop - 1;
+  a.neighbor = g_bench.rt_table[routes-1].next;
+  a.dv = &dv;
+  a.dv_entry_num = 1;
+  bench_run("dv_update_rt_table(1 entry)", routes, bench_update, &a);
+
+  start = 0;
+  a.msg = dv_encode_dv_message(&g_bench, DV_ADVERTISE, -1, &start, &a.len);
+  bench_run("dv_encode_dv_message", routes, bench_encode, &a);
+  bench_run("dv_decode_dv_message", routes, bench_decode, &a);
+
+  /* a neighbor re-advertises the whole table, which takes several messages on the wire */
+  a.dv = (dv_entry*) malloc(routes*sizeof(dv_entry));
+  if(a.dv == NULL)
+  {
+    fprintf(stderr, "error : unable to malloc\n");
+    exit(1);
+  }
+  for(i = 0; i < routes; i++)
+  {
+    a.dv[i].dest = g_bench.rt_table[i].dest;
+    a.dv[i].mask = g_bench.rt_table[i].mask;
+    a.dv[i].hop = g_bench.rt_table[i].hop - 1;
+  }
+  a.dv_entry_num = routes;
+  bench_run("dv_update_rt_table(full advert)", routes, bench_update, &a);
+  free(a.dv);
+
+  free(a.msg);
+}
+/*--------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+  HwAddr myhwaddr;
+  in_addr_t myipaddr, peeraddr, lastaddr;
+  int mynetmask;
+  bench_arp_arg arp;
+  bench_dns_arg dns;
+  int max_routes = BENCH_MAX_ROUTES;
+  int routes;
+
+  if(argc > 2) {
+    fprintf(stderr, "usage : %s [<max routes>]\n", argv[0]);
+    exit(1);
+  }
+
+  if(argc == 2)
+    max_routes = atoi(argv[1]);
+
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, g_sv) == -1) {
+    perror("socketpair");
+    exit(1);
+  }
+
+  /* compare parsing the conf files with mapping the compiled image at startup */
+  g_topo_image_file = NULL;
+  bench_topo_text(NULL);
+  printf("%-32s %8s\n", "benchmark", "size");
+  bench_run("init_*_table(conf files)", g_topo->ip_num, bench_topo_text, NULL);
+  if (!topo_write(BENCH_TOPO_FILE))
+    exit(1);
+  g_topo_image_file = BENCH_TOPO_FILE;
+  bench_run("topo_load_image", g_topo->ip_num, bench_topo_image, NULL);
+  unlink(BENCH_TOPO_FILE);
+
+  /* act as host mercury talking to deci on the same LAN */
+  set_station_kind(STATION_HOST);
+  if(!nametohwaddr("mercury", myhwaddr) || !nametoipaddr("mercury", &myipaddr) ||
+     !nametonetmask("mercury", &mynetmask) || !nametoipaddr("deci", &peeraddr) ||
+     !nametoipaddr("venus", &lastaddr)) {
+    fprintf(stderr, "error : the configuration files have no mercury, deci or venus\n");
+    exit(1);
+  }
+  set_host_addrinfo(&g_bench, myhwaddr, myipaddr, mynetmask, 0);
+
+  bench_packets(myipaddr, peeraddr, 64);
+  bench_packets(myipaddr, peeraddr, MAXSTRING);
+
+  arp.addr = myipaddr;
+  bench_run("arp_ipaddr_to_hwaddr(first)", g_topo->ip_num, bench_arp, &arp);
+  arp.addr = lastaddr;
+  bench_run("arp_ipaddr_to_hwaddr(last)", g_topo->ip_num, bench_arp, &arp);
+  dns.name = "mercury";
+  bench_run("dns_name_to_ipaddr(first)", g_topo->ip_num, bench_dns, &dns);
+  dns.name = "venus";
+  bench_run("dns_name_to_ipaddr(last)", g_topo->ip_num, bench_dns, &dns);
+
+  for(routes = 10; routes <= max_routes; routes *= 10)
+    bench_routes(routes);
+
+  close(g_sv[0]);
+  close(g_sv[1]);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
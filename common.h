@@ -16,6 +16,55 @@
 #define ADDR_NUM    10
 #define MAX_CONFIG_INTERVAL 30
 
+#define IP_DEFAULT_TTL 255
+//routers an IP packet may cross before it is dropped; the largest TTL, since DV keeps routes of
+//metric up to DV_METRIC_INFINITY-1 (255 hops when every link costs 1), and a transient loop costs at most this many hops
+
+#define IP_ALLROUTERS htonl(0xE0000002)
+//all-routers multicast group (224.0.0.2) that DV messages are sent to
+
+#define MCAST_MAX_GROUPS 4
+//multicast groups a station may join
+
+#define IP_VERSION 1
+//version of the IP header written by this build; packets of other versions are dropped
+
+#define IP_HDR_SIZE 16
+//bytes of the IP header on the wire (see IPPkt)
+
+#define ETH_MAX_PAYLOAD 65100
+//largest ethernet payload a station accepts: a full DV message with its IP header
+
+#define BULK_SEG_SIZE 1400
+//data bytes of a bulk segment; with its headers it stays well under BUF_SIZE
+
+#define BULK_WINDOW 64
+//segments a receiver accepts past the first missing one of a transfer
+
+#define BULK_MAX_SIZE (64*1024*1024)
+//largest bulk transfer in bytes
+
+#define BULK_RX_SLOTS 8
+//bulk transfers reassembled at the same time
+
+#define BULK_TX_SLOTS 8
+//bulk transfers sent at the same time
+
+#define BULK_RTO_INIT 1000000
+//retransmission timeout before the first RTT sample in microseconds
+
+#define BULK_RTO_MIN 200000
+//lower bound of the retransmission timeout in microseconds
+
+#define BULK_RTO_MAX 8000000
+//upper bound of the retransmission timeout in microseconds
+
+#define BULK_MAX_RETRIES 6
+//timeouts in a row without progress before a bulk transfer is given up
+
+#define BULK_DUP_THRESH 3
+//segments acknowledged past a missing one before it is retransmitted
+
 #define MAC_FILE  "mac-addr.conf"
 #define IP_FILE "ip-addr.conf"
 #define GW_FILE "gateway.conf"
@@ -24,8 +73,20 @@
 /* data type of IP packet's payload */
 enum DATA_TYPE
 {
-  DATA_DV = 0,  //distance-vector packet
-  DATA_CHAT = 1 //chatting packet
+  DATA_DV = 0,   //distance-vector packet
+  DATA_CHAT = 1, //chatting packet
+  DATA_BULK = 2, //segment of a bulk transfer
+  DATA_ACK = 3,  //acknowledgement of bulk segments
+  DATA_JOIN = 4  //membership report of a multicast group, taken by the hubs
+};
+
+/* state of a bulk transfer slot */
+enum BULK_STATE
+{
+  BULK_IDLE = 0,  //slot not used yet
+  BULK_BUSY = 1,  //transfer in progress
+  BULK_DONE = 2,  //transfer completed
+  BULK_FAILED = 3 //transfer given up by the sender
 };
 
 /* hub's status */
@@ -50,7 +111,7 @@ typedef unsigned char HwAddr[6];
 
 /* bcast and mcast addresses */
 extern HwAddr BCASTADDR; //MAC broadcast address
-extern HwAddr MCASTADDR; //MAC multicast address
+extern HwAddr MCASTADDR; //base of the MAC multicast addresses; a group's address adds the low 23 bits of its IP address
 
 extern in_addr_t IP_BCASTADDR; //IP broadcast address
 /*--------------------------------------------------------------------*/
@@ -73,7 +134,17 @@ typedef struct __ethpkt
 
 } EthPkt;
 
-/* structure of an IP pkt */
+/* structure of an IP pkt; on the wire its header is, in network byte-order:
+
+     offset  size  field
+          0     4  destination address
+          4     4  source address
+          8     2  length of payload
+         10     1  type
+         11     1  TTL
+         12     1  version (IP_VERSION)
+         13     1  reserved (0)
+         14     2  checksum: ones' complement of the ones' complement sum of the header's 16-bit words */
 typedef struct __ippkt
 {
   /* destination address */
@@ -88,6 +159,12 @@ typedef struct __ippkt
   /* type of packet */
   u_char type;
 
+  /* time to live: routers the packet may still cross */
+  u_char ttl;
+
+  /* header checksum in host byte-order; a router updates it with the TTL */
+  ushort cksum;
+
   /* actual payload */
   char * dat;
 } IPPkt;
@@ -114,6 +191,68 @@ typedef struct __dventry
   int hop; //hop count from the router to the destination network
 } DVEnt;
 
+/* header of a bulk segment, sent in network byte-order in front of its data */
+typedef struct __bulkhdr
+{
+  unsigned int id; //transfer id chosen by the sender
+  unsigned int seq; //segment number, from 0
+  unsigned int total; //length of the whole transfer in bytes
+} BulkHdr;
+
+/* acknowledgement of a bulk transfer, sent in network byte-order for every segment received */
+typedef struct __bulkack
+{
+  unsigned int id; //transfer id
+  unsigned int next; //cumulative: every segment before next is received
+  unsigned int sack[BULK_WINDOW/32]; //selective: bit i is set when segment next+i is received
+  unsigned int seq; //segment whose arrival triggered this acknowledgement
+} BulkAck;
+
+/* reassembly of a bulk transfer at the receiver */
+typedef struct __bulkrx
+{
+  in_addr_t src; //sender's IP address
+  unsigned int id; //transfer id
+  unsigned int total; //length of the transfer
+  unsigned int segs; //number of segments of the transfer
+  unsigned int next; //first missing segment; the window starts here
+  char ack[BULK_WINDOW]; //received segments of the window, indexed by seq % BULK_WINDOW
+  char* buf; //reassembly buffer; it is kept for the next transfer of the slot
+  unsigned int buf_size; //size of buf
+  int state; //BULK_IDLE, BULK_BUSY or BULK_DONE; a completed transfer is still acknowledged
+  long long start; //monotonic time of the first segment in microseconds
+  long long last; //monotonic time of the last segment in microseconds
+} BulkRx;
+
+/* bulk transfer at the sender, with a sliding window under AIMD congestion control */
+typedef struct __bulktx
+{
+  int state; //BULK_IDLE, BULK_BUSY, BULK_DONE or BULK_FAILED
+  int sd; //socket the segments are sent on
+  in_addr_t dst; //receiver's IP address
+  unsigned int id; //transfer id
+  unsigned int total; //length of the transfer
+  unsigned int segs; //number of segments of the transfer
+  unsigned int base; //first segment not acknowledged cumulatively; the window starts here
+  unsigned int next; //first segment never sent
+  char sacked[BULK_WINDOW]; //segments of the window acknowledged selectively, indexed by seq % BULK_WINDOW
+  char retx[BULK_WINDOW]; //segments of the window retransmitted; they give no RTT sample
+  long long sent[BULK_WINDOW]; //monotonic time each segment of the window was last sent
+  double cwnd; //congestion window in segments
+  double ssthresh; //slow start threshold in segments
+  unsigned int recover; //next when the window was last cut; one cut per window of losses
+  long long srtt; //smoothed RTT in microseconds, 0 before the first sample
+  long long rttvar; //RTT variation in microseconds
+  long long rto; //retransmission timeout in microseconds
+  long long deadline; //monotonic time the retransmission timer expires
+  int retries; //timeouts in a row without progress
+  unsigned long retransmits; //segments sent again
+  char* buf; //copy of the payload; it is kept for the next transfer of the slot
+  unsigned int buf_size; //size of buf
+  long long start; //monotonic time the transfer started
+  long long end; //monotonic time the transfer completed or was given up
+} BulkTx;
+
 /*--------------------------------------------------------------------*/
 /* recv an ether packet */
 extern EthPkt *recvethpkt(int sd);
@@ -129,19 +268,52 @@ extern void freeethpkt(EthPkt *ethpkt);
 /*--------------------------------------------------------------------*/
 
 /*--------------------------------------------------------------------*/
+/* addresses and DV tables of a station, defined in dist-vec.h */
+struct _dv_router;
+
 /* recv an IP packet */
-extern IPPkt *recvippkt(int sd);
+extern IPPkt *recvippkt(struct _dv_router* router, int sd);
 
 /* send an IP packet */
-extern int sendippkt(int sd, IPPkt *ippkt);
+extern int sendippkt(struct _dv_router* router, int sd, IPPkt *ippkt);
+
+/* send an IP packet to the station with the already resolved MAC address hwdst */
+extern int sendippkt_with_hwaddr(struct _dv_router* router, int sd, IPPkt *ippkt, HwAddr hwdst);
 
 /* output IP packet contents */
 extern void dumpippkt(IPPkt *ippkt);
 
 /* free up space allocated for ippkt */
 extern void freeippkt(IPPkt *ippkt);
+
+/* compute the header checksum of ippkt to be sent */
+extern ushort ip_header_cksum(IPPkt *ippkt);
+
+/* convert the IP multicast group into its MAC address */
+extern void ip_mcast_to_hwaddr(in_addr_t group, HwAddr hwaddr);
+
+/* join the IP multicast group; return 0 if the station has joined too many */
+extern int ip_join_group(struct _dv_router* router, in_addr_t group);
+
+/* return 1 if the station has joined the IP multicast group */
+extern int ip_is_member(struct _dv_router* router, in_addr_t group);
+
+/* return 1 if the station takes the frames to hwaddr: its own, broadcast or a group it has joined */
+extern int hwaddr_is_mine(struct _dv_router* router, HwAddr hwaddr);
+
+/* send a membership report of every group joined on sd, so that its hub passes the frames to the groups */
+extern int send_group_reports(struct _dv_router* router, int sd);
+
+/* update the checksum cksum after a 16-bit word of the header changes from "from" to "to" (RFC 1624) */
+extern ushort ip_cksum_update(ushort cksum, ushort from, ushort to);
+
+/* return 1 if ethpkt is a DV message or a membership report with a valid IP header sent to the all-routers group or broadcast */
+extern int ethpkt_is_control(EthPkt *ethpkt);
 /*----------------------------------------------------------------*/
 
+/* return the interned copy of name shared by the configuration tables */
+extern char* intern_name(char *name);
+
 /* convert name to hardware addr */
 extern int nametohwaddr(char *name, HwAddr addr);
 
@@ -161,4 +333,79 @@ extern int hwaddrcmp(HwAddr adr1, HwAddr adr2);
 extern int hwaddrcpy(HwAddr adr1, HwAddr adr2);
 /*----------------------------------------------------------------*/
 
+/*----------------------------------------------------------------*/
+/* set station kind */
+extern void set_station_kind(int kind);
+
+/* set hub's status to HUB_UP */
+extern void set_hub_up();
+
+/* set hub's status to HUB_DOWN */
+extern void set_hub_down();
+
+/* return hub's status */
+extern int hub_status();
+
+/* manipulate the list of LAN names corresponding to the sockets of hubs */
+extern int add_lanname_entry(int hubsock, char* lanname);
+extern int delete_lanname_entry(int hubsock);
+extern char* get_lanname(int hubsock);
+
+/* register station's address information */
+extern void set_host_addrinfo(struct _dv_router* host, HwAddr myhwaddr, in_addr_t myipaddr, int mynetmask, in_addr_t mygwaddr);
+extern void set_router_addrinfo(struct _dv_router* router, HwAddr myhwaddr, in_addr_t* myipaddrs, int myipaddrs_num, int* mynetmasks);
+
+/* init configuration tables */
+extern int init_mac_table(char *macfile);
+extern int init_ip_table(char *ipfile);
+extern int init_gw_table(char *gwfile);
+
+/* reload configuration tables after the topology files have changed */
+extern int reload_tables();
+
+/* DNS and ARP functions */
+extern int nametoipaddr(char *name, in_addr_t* addr);
+extern int nametonetmask(char *name, int* mask);
+extern int dns_name_to_ipaddr(char* dnsname, in_addr_t* ipaddr, int* ipaddr_num);
+extern int get_netmasks_for_addrs(in_addr_t* ipaddrs, int ipaddrs_num, int* netmasks);
+extern int nametogwaddr(char *name, in_addr_t host_addr, int host_mask, in_addr_t* addr);
+extern int ipaddrtoname(in_addr_t addr, char *name);
+extern int arp_ipaddr_to_hwaddr(in_addr_t ipaddr, HwAddr hwaddr);
+
+/* forward an ether packet in hub */
+extern int forwardethpkt(int sd, EthPkt *ethpkt);
+
+/* send and receive application messages through IP stack */
+extern int sendmessage(struct _dv_router* router, int sd, in_addr_t myaddr, in_addr_t dst, ushort len, u_char type, char* dat);
+extern int send_app_message(struct _dv_router* router, int sd, char* dst_name, ushort len, u_char type, char* dat);
+extern int send_app_message_to(struct _dv_router* router, int sd, in_addr_t dst, ushort len, u_char type, char* dat);
+extern char* recvmessage(struct _dv_router* router, int sd, in_addr_t* src, ushort* len, u_char* type);
+
+/* send a payload of any length reliably as a bulk transfer, and reassemble one; see utils.c */
+extern unsigned int send_bulk_message(struct _dv_router* router, int sd, char* dst_name, unsigned int len, char* dat);
+extern BulkRx* recv_bulk_segment(struct _dv_router* router, int sd, in_addr_t src, ushort len, char* dat);
+extern BulkTx* recv_bulk_ack(struct _dv_router* router, in_addr_t src, ushort len, char* dat);
+extern BulkTx* check_bulk_timers(struct _dv_router* router);
+extern long long bulk_timer_wait();
+extern unsigned int bulk_checksum(char* dat, unsigned int len);
+
+/* hub and station connection setup */
+extern int initlan(char *lan);
+extern int hooktolan(char *lan);
+
+/* time functions */
+extern long getcurtime();
+extern long long getmonotime();
+extern char *timetostring(long secs);
+extern char* getcurtimeinfo();
+
+/* hooks for the socket I/O and the clocks; they are read(), write() and NULL
+   (system clocks) except in the simulator, which runs the stations on its
+   virtual network and clock */
+extern ssize_t (*g_net_read)(int sd, void *buf, size_t n);
+extern ssize_t (*g_net_write)(int sd, const void *buf, size_t n);
+extern long (*g_clock_hook)();
+extern long long (*g_monoclock_hook)();
+/*----------------------------------------------------------------*/
+
 #endif
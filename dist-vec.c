@@ -4,115 +4,615 @@
     Maker: Jaehoon Jeong, pauljeong@skku.edu
 */
 
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/sockios.h> //SIOCOUTQ
+#include <netinet/tcp.h> //TCP_INFO
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "dist-vec.h"
+#include "stats.h"
+#include "trace.h"
+
+static void dv_grow_rt_table(dv_router* router)
+{ //make room for one more routing entry
+  if(router->rt_table_size < router->rt_table_max)
+    return;
+
+  router->rt_table_max *= 2;
+  router->rt_table = (rt_table_entry*) realloc(router->rt_table, router->rt_table_max*sizeof(rt_table_entry));
+  if(router->rt_table == NULL)
+  {
+    perror("rt_table cannot be allocated memory");
+    exit(1);
+  }
+  memset(router->rt_table + router->rt_table_size, 0, (router->rt_table_max - router->rt_table_size)*sizeof(rt_table_entry));
+  g_stats->allocs++;
+}
+
+static void dv_grow_fw_table(dv_router* router)
+{ //make room for one more forwarding entry
+  if(router->fw_table_size < router->fw_table_max)
+    return;
+
+  router->fw_table_max *= 2;
+  router->fw_table = (fw_table_entry*) realloc(router->fw_table, router->fw_table_max*sizeof(fw_table_entry));
+  if(router->fw_table == NULL)
+  {
+    perror("fw_table cannot be allocated memory");
+    exit(1);
+  }
+  memset(router->fw_table + router->fw_table_size, 0, (router->fw_table_max - router->fw_table_size)*sizeof(fw_table_entry));
+  g_stats->allocs++;
+}
+
+static char* dv_event_names[] = { "add", "change", "withdraw", "expire", "advert-sent", "advert-rcvd", "breakage-sent", "breakage-rcvd" };
+
+static void dv_log_event(dv_router* router, int kind, in_addr_t dest, in_addr_t next, int hop)
+{ //add an event to the event log of router
+  dv_event* ev;
+  long long now = getmonotime();
+
+  if(kind <= DV_EVENT_EXPIRE)
+  {
+    router->route_events++;
+    router->last_change = now;
+  }
+
+  if(router->events == NULL) //the tables are not initialized
+    return;
+
+  ev = &router->events[router->events_head++ & (DV_EVENT_LOG_SIZE-1)];
+  ev->time = now;
+  ev->kind = kind;
+  ev->dest = dest;
+  ev->next = next;
+  ev->hop = hop;
+}
+
+static void dv_log_route(dv_router* router, int kind, rt_table_entry* rte)
+{ //add an event of the routing entry rte to the event log of router
+  dv_log_event(router, kind, rte->dest, rte->next, rte->hop);
+}
+
+static int dv_prefix_len(int mask)
+{ //number of bits of the network part of mask
+  return __builtin_popcount((unsigned int) mask);
+}
+
+static unsigned int dv_index_hash(in_addr_t dest, int mask)
+{ //spread the network part of dest and the prefix length over the low bits
+  unsigned int h = (dest ^ (mask * 31U)) * 2654435761U;
+  return h ^ (h >> 16);
+}
+
+static int dv_index_find(dv_index* index, in_addr_t dest, int mask)
+{ //return the table entry with dest/mask, or -1 if there is none
+  unsigned int i;
+
+  if(index->size == 0)
+    return -1;
+
+  for(i = dv_index_hash(dest, mask) & (index->size-1); index->slots[i].entry != 0; i = (i+1) & (index->size-1))
+  {
+    if((index->slots[i].dest == dest) && (index->slots[i].mask == mask))
+      return index->slots[i].entry - 1;
+  }
+  return -1;
+}
+
+static void dv_index_add(dv_index* index, in_addr_t dest, int mask, int entry)
+{ //index the table entry with dest/mask; the index doubles when it is half full
+  dv_index_slot* old = index->slots;
+  int old_size = index->size;
+  unsigned int i;
+  int j;
+
+  if(2*(index->num+1) > index->size)
+  {
+    index->size = (old_size > 0) ? old_size*2 : DV_INDEX_SIZE;
+    index->slots = (dv_index_slot*) calloc(index->size, sizeof(dv_index_slot));
+    if(index->slots == NULL)
+    {
+      perror("dv index cannot be allocated memory");
+      exit(1);
+    }
+    index->num = 0;
+    for(j = 0; j < old_size; j++)
+    {
+      if(old[j].entry != 0)
+        dv_index_add(index, old[j].dest, old[j].mask, old[j].entry - 1);
+    }
+    free(old);
+    g_stats->allocs++;
+  }
+
+  for(i = dv_index_hash(dest, mask) & (index->size-1); index->slots[i].entry != 0; i = (i+1) & (index->size-1))
+    ;
+  index->slots[i].dest = dest;
+  index->slots[i].mask = mask;
+  index->slots[i].entry = entry + 1;
+  index->num++;
+}
+
+static void dv_index_clear(dv_index* index)
+{ //remove every entry from the index
+  if(index->size > 0)
+    memset(index->slots, 0, index->size*sizeof(dv_index_slot));
+  index->num = 0;
+}
+
+static int dv_is_attached_net(dv_router* router, in_addr_t net)
+{ //whether net (already masked) is the network of one of the router's interfaces
+  int i = 0;
+
+#ifdef __SSE2__
+  /* compare net with 4 attached networks at once */
+  __m128i key = _mm_set1_epi32(net);
+  for(; i + 4 <= router->net_table_size; i += 4)
+  {
+    if(_mm_movemask_epi8(_mm_cmpeq_epi32(key, _mm_loadu_si128((__m128i*) &router->net_keys[i]))) != 0)
+      return 1;
+  }
+#endif
+
+  for(; i < router->net_table_size; i++)
+  {
+    if(router->net_keys[i] == net)
+      return 1;
+  }
+  return 0;
+}
+
+static void dv_pack_fw_table(dv_router* router)
+{ //pack the hot fields of fw_table into router->fw_packed, the longest prefixes first
+  fw_packed* fp = &router->fw_packed;
+  int first[34]; //first packed entry of each prefix length, from 32 down to 0, and the end
+  int len;
+  int i, k;
+
+  if(fp->max < router->fw_table_max)
+  {
+    fp->max = router->fw_table_max;
+    fp->dest = (in_addr_t*) realloc(fp->dest, fp->max*sizeof(in_addr_t));
+    fp->mask = (int*) realloc(fp->mask, fp->max*sizeof(int));
+    fp->itf = (int*) realloc(fp->itf, fp->max*sizeof(int));
+    fp->next = (in_addr_t*) realloc(fp->next, fp->max*sizeof(in_addr_t));
+    fp->valid = (unsigned int*) realloc(fp->valid, (fp->max/32 + 1)*sizeof(unsigned int));
+    fp->entry = (int*) realloc(fp->entry, fp->max*sizeof(int));
+    if(fp->dest == NULL || fp->mask == NULL || fp->itf == NULL || fp->next == NULL || fp->valid == NULL || fp->entry == NULL)
+    {
+      perror("fw_packed cannot be allocated memory");
+      exit(1);
+    }
+    g_stats->allocs += 6;
+  }
+
+  /* counting sort by prefix length, so that the first match of a lookup is the longest one */
+  memset(first, 0, sizeof(first));
+  for(i = 0; i < router->fw_table_size; i++)
+    first[32 - dv_prefix_len(router->fw_table[i].mask) + 1]++;
+  for(len = 1; len < 34; len++)
+    first[len] += first[len-1];
+
+  memset(fp->valid, 0, (fp->max/32 + 1)*sizeof(unsigned int));
+  for(i = 0; i < router->fw_table_size; i++)
+  {
+    k = first[32 - dv_prefix_len(router->fw_table[i].mask)]++;
+    fp->dest[k] = router->fw_table[i].dest;
+    fp->mask[k] = router->fw_table[i].mask;
+    fp->itf[k] = router->fw_table[i].itf;
+    fp->next[k] = router->fw_table[i].next;
+    fp->entry[k] = i;
+    if(router->fw_table[i].flag == 1)
+      fp->valid[k/32] |= 1U << (k%32);
+  }
+  fp->num = router->fw_table_size;
+  fp->gen = router->fw_table_gen;
+}
+
+static int dv_lookup(dv_router* router, in_addr_t dst)
+{ //return the packed index of the valid forwarding entry with the longest prefix matching dst, or -1
+  fw_packed* fp = &router->fw_packed;
+  int i = 0;
+
+  if(fp->gen != router->fw_table_gen)
+    dv_pack_fw_table(router);
+
+#ifdef __SSE2__
+  /* match dst against 4 entries at once; i stays a multiple of 4, so their valid bits are in one word */
+  __m128i key = _mm_set1_epi32(dst);
+  __m128i hit;
+  int bits;
+  for(; i + 4 <= fp->num; i += 4)
+  {
+    hit = _mm_cmpeq_epi32(_mm_and_si128(key, _mm_loadu_si128((__m128i*) &fp->mask[i])),
+                          _mm_loadu_si128((__m128i*) &fp->dest[i]));
+    bits = _mm_movemask_ps(_mm_castsi128_ps(hit)) & (fp->valid[i/32] >> (i%32));
+    if(bits != 0)
+      return i + __builtin_ctz(bits);
+  }
+#endif
+
+  for(; i < fp->num; i++)
+  {
+    if(((dst & fp->mask[i]) == fp->dest[i]) && (fp->valid[i/32] & (1U << (i%32))))
+      return i;
+  }
+  return -1;
+}
+
+static unsigned int dv_flow_hash(in_addr_t src, in_addr_t dst)
+{ //hash of the flow from src to dst
+  unsigned int h = src ^ (dst * 2654435761U);
+
+  return h ^ (h >> 16);
+}
+
+static int dv_select_path(dv_router* router, in_addr_t src, in_addr_t dst, in_addr_t* next)
+{ //return the egress socket of the flow from src to dst and set *next to its next hop; -1 if there is no route
+  fw_table_entry* fwe;
+  unsigned int p; //path of the flow; 0 for the primary next hop
+  int i = dv_lookup(router, dst);
+
+  if(i == -1)
+  {
+    *next = 0;
+    return -1;
+  }
+
+  fwe = &router->fw_table[router->fw_packed.entry[i]];
+  if(fwe->ecmp_num == 0)
+  {
+    *next = router->fw_packed.next[i];
+    return router->fw_packed.itf[i];
+  }
+
+  /* every packet of a flow takes the same path; the router's address is mixed in
+     so that routers in series do not split the flows in the same way */
+  p = (((dv_flow_hash(src, dst) ^ router->ipaddrs[0]) * 2654435761U) >> 16) % (fwe->ecmp_num + 1);
+  if(p == 0)
+  {
+    *next = router->fw_packed.next[i];
+    return router->fw_packed.itf[i];
+  }
+  *next = fwe->ecmp[p-1].next;
+  return fwe->ecmp[p-1].itf;
+}
+
+static int dv_find_path(rt_table_entry* rte, in_addr_t next)
+{ //return the equal-cost next hop of rte via next, or -1 if there is none
+  int j;
+
+  for(j = 0; j < rte->ecmp_num; j++)
+  {
+    if(rte->ecmp[j].next == next)
+      return j;
+  }
+  return -1;
+}
+
+static void dv_remove_path(rt_table_entry* rte, int j)
+{ //remove the equal-cost next hop j of rte, keeping the order of the others
+  memmove(&rte->ecmp[j], &rte->ecmp[j+1], (rte->ecmp_num - j - 1)*sizeof(dv_path));
+  rte->ecmp_num--;
+}
+
+static void dv_promote_path(dv_router* router, rt_table_entry* rte)
+{ //replace the lost primary next hop of rte with its first equal-cost next hop
+  rte->next = rte->ecmp[0].next;
+  rte->itf = rte->ecmp[0].itf;
+  strncpy(rte->itf_name, dv_get_itf_name(router, rte->itf), ITF_NAME_SIZE);
+  dv_remove_path(rte, 0);
+  rte->flaps++;
+  g_stats->route_changes++;
+  dv_log_route(router, DV_EVENT_CHANGE, rte);
+}
+
+static int dv_find_covering_route(dv_router* router, in_addr_t neighbor, in_addr_t dest, int mask)
+{ //return the longest route via neighbor which covers dest/mask with a shorter prefix, or -1 if there is none
+  int best = -1;
+  int i;
+
+  for(i = 0; i < router->rt_table_size; i++)
+  {
+    rt_table_entry* rte = &router->rt_table[i];
+
+    if((rte->status == RTE_DOWN) || ((dest & rte->mask) != rte->dest) || (dv_prefix_len(rte->mask) >= dv_prefix_len(mask)))
+      continue;
+    if((rte->next != neighbor) && (dv_find_path(rte, neighbor) == -1))
+      continue;
+    if((best == -1) || (dv_prefix_len(rte->mask) > dv_prefix_len(router->rt_table[best].mask)))
+      best = i;
+  }
+  return best;
+}
 
-net_table_entry* g_net_table; //Network address table in which a router has subnet addresses
-int g_net_table_size; //size of g_net_table
+static int dv_compare_summary(const void* a, const void* b)
+{ //order summary entries by prefix length, longest first, and then by address
+  const dv_summary* x = (const dv_summary*) a;
+  const dv_summary* y = (const dv_summary*) b;
+  unsigned int xd = ntohl(x->dest);
+  unsigned int yd = ntohl(y->dest);
 
-fw_table_entry* g_fw_table; //Forwarding table which is used for forwarding packets
-int g_fw_table_size; //size of g_fw_table
+  if(x->len != y->len)
+    return y->len - x->len;
+  return (xd > yd) - (xd < yd);
+}
+
+static int dv_summarize(dv_router* router, int sock, dv_entry** dv)
+{ //set *dv to the routes to advertise on sock with every pair of sibling prefixes of the same next hop and interface
+  //merged into their covering prefix, as long as there is such a pair; return the number of entries. the caller frees *dv
+  dv_summary* sum;
+  unsigned int bit; //lowest bit of the network part of a prefix
+  int mask;
+  int num = 0;
+  int merged;
+  int i, j;
+
+  sum = (dv_summary*) malloc(sizeof(dv_summary)*(router->rt_table_size > 0 ? router->rt_table_size : 1));
+  *dv = (dv_entry*) malloc(sizeof(dv_entry)*(router->rt_table_size > 0 ? router->rt_table_size : 1));
+  if((sum == NULL) || (*dv == NULL))
+  {
+    fprintf(stderr, "error : unable to malloc\n");
+    exit(1);
+  }
+  g_stats->allocs += 2;
+
+  for(i = 0; i < router->rt_table_size; i++)
+  {
+    if(router->rt_table[i].status != RTE_UP) //a stale route is not spread until it is confirmed
+      continue;
+    if((router->rt_table[i].itf == sock) && (router->rt_table[i].next != 0)) //split horizon: the neighbors on sock know better
+      continue;
+    sum[num].dest = router->rt_table[i].dest;
+    sum[num].len = dv_prefix_len(router->rt_table[i].mask);
+    sum[num].hop = router->rt_table[i].hop;
+    sum[num].next = router->rt_table[i].next;
+    sum[num].itf = router->rt_table[i].itf;
+    sum[num].merged = 0;
+    num++;
+  }
+
+  /* in the sorted order, the sibling of a prefix with its lowest bit 0 is right after it */
+  do {
+    qsort(sum, num, sizeof(dv_summary), dv_compare_summary);
+    merged = 0;
+    for(i = 0, j = 0; i < num; i++)
+    {
+      sum[j] = sum[i];
+      if((i+1 < num) && (sum[i].len > 0) && (sum[i+1].len == sum[i].len))
+      {
+        bit = 1U << (32 - sum[i].len);
+        if(sum[i+1].dest == sum[i].dest) //a summary made in an earlier pass and a learned route of the same prefix; the summary wins
+        {
+          if((sum[i+1].merged > sum[j].merged) || ((sum[i+1].merged == sum[j].merged) && (sum[i+1].hop < sum[j].hop)))
+            sum[j] = sum[i+1];
+          i++;
+        }
+        else if(((ntohl(sum[i].dest) & bit) == 0) && (ntohl(sum[i+1].dest) == (ntohl(sum[i].dest) | bit)) &&
+                (sum[i+1].next == sum[i].next) && (sum[i+1].itf == sum[i].itf))
+        {
+          sum[j].len--;
+          if(sum[i+1].hop > sum[j].hop) //the covering prefix is as far as its farther half
+            sum[j].hop = sum[i+1].hop;
+          sum[j].merged = 1;
+          mask = (sum[j].len > 0) ? (int) htonl(0xFFFFFFFFU << (32 - sum[j].len)) : 0;
+          if(dv_index_find(&router->sum_index, sum[j].dest, mask) == -1)
+            dv_index_add(&router->sum_index, sum[j].dest, mask, 0);
+          merged = 1;
+          i++;
+        }
+      }
+      j++;
+    }
+    num = j;
+  } while(merged);
+
+  for(i = 0; i < num; i++)
+  {
+    (*dv)[i].dest = sum[i].dest;
+    (*dv)[i].mask = (sum[i].len > 0) ? (int) htonl(0xFFFFFFFFU << (32 - sum[i].len)) : 0;
+    (*dv)[i].hop = sum[i].hop;
+  }
+
+  free(sum);
+  return num;
+}
+
+static char* dv_encode_dv_entries(dv_entry* dv, int dv_entry_num, int* start, int* len)
+{ //construct a DV advertisement message of the dv entries from *start on, and set *start to the first entry left out
+  struct in_addr net;
+  char* msg;
+  char* ptr;
+  int size; //size of the records
+  int i;
 
-rt_table_entry* g_rt_table; //Routing table
-int g_rt_table_size; //size of g_rt_table
+  size = (dv_entry_num - *start)*DV_ENTRY_STR_SIZE;
+  if(size > DV_MSG_MAX_SIZE)
+    size = DV_MSG_MAX_SIZE;
 
-port_table_entry* g_port_table; //Port table
-int g_port_table_size; //size of g_port_table
+  msg = (char*) malloc(size + DV_TRAILER_SIZE);
+  if(msg == NULL)
+  {
+    fprintf(stderr, "error : unable to malloc\n");
+    return NULL;
+  }
 
+  ptr = msg;
+  for(i = *start; (i < dv_entry_num) && (ptr - msg + DV_ENTRY_STR_SIZE <= size); i++)
+  {
+    net.s_addr = dv[i].dest;
+    ptr += sprintf(ptr, "%s/%d/%d\n", inet_ntoa(net), dv[i].mask, dv[i].hop);
+  }
+  ptr += sprintf(ptr, "x%d", DV_ADVERTISE);
+
+  *start = i;
+  *len = ptr - msg; //the terminating '\0' is not sent
+  g_stats->allocs++;
+  return msg;
+}
 
-int dv_init_tables(in_addr_t* addr, int* mask, int addr_num, int* sock)
-{ //initialize g_rt_table, g_net_table, and g_fw_table with the router's network information
+static int dv_link_cost(dv_router* router, int sock)
+{ //return the cost of the link of socket sock
+  int j;
+  int cost;
+
+  for(j = 0; j < router->port_table_size; j++)
+  {
+    if(router->port_table[j].itf == sock)
+    {
+      cost = router->port_table[j].cost + router->port_table[j].measured;
+      return (cost < DV_COST_MAX) ? cost : DV_COST_MAX;
+    }
+  }
+  return 1;
+}
+
+void dv_index_tables(dv_router* router)
+{ //rebuild the indexes of the tables of router after they are filled in directly
+  int i;
+
+  dv_index_clear(&router->rt_index);
+  for(i = 0; i < router->rt_table_size; i++)
+    dv_index_add(&router->rt_index, router->rt_table[i].dest, router->rt_table[i].mask, i);
+
+  dv_index_clear(&router->fw_index);
+  for(i = 0; i < router->fw_table_size; i++)
+    dv_index_add(&router->fw_index, router->fw_table[i].dest, router->fw_table[i].mask, i);
+
+  for(i = 0; i < router->net_table_size; i++)
+    router->net_keys[i] = router->net_table[i].net & router->net_table[i].mask;
+}
+
+int dv_init_tables(dv_router* router, in_addr_t* addr, int* mask, int addr_num, int* sock)
+{ //initialize router->rt_table, router->net_table, and router->fw_table with the router's network information
   char itf_prefix[4] = "eth"; //prefix of interface name
   in_addr_t net_addr; //network address
   char buf[10]; //buffer for interface serial number
   int i;
 
-  /* allocate memory for the routing table, g_rt_table */
-  g_rt_table = (rt_table_entry*) calloc(RT_TABLE_SIZE, sizeof(rt_table_entry));
-  if(g_rt_table == NULL)
+  /* allocate memory for the routing table, router->rt_table */
+  router->rt_table = (rt_table_entry*) calloc(RT_TABLE_SIZE, sizeof(rt_table_entry));
+  if(router->rt_table == NULL)
   {
-    perror("g_rt_table cannot be allocated memory");
+    perror("rt_table cannot be allocated memory");
     exit(1);
   }
 
-  /* allocate memory for the network address table, g_net_table */
-  g_net_table = (net_table_entry*) calloc(NET_TABLE_SIZE, sizeof(net_table_entry));
-  if(g_net_table == NULL)
+  /* allocate memory for the network address table, router->net_table */
+  router->net_table = (net_table_entry*) calloc(NET_TABLE_SIZE, sizeof(net_table_entry));
+  if(router->net_table == NULL)
   {
-    perror("g_net_table cannot be allocated memory");
+    perror("net_table cannot be allocated memory");
     exit(1);
   }
 
-  /* allocate memory for the forwarding table, g_fw_table */
-  g_fw_table = (fw_table_entry*) calloc(FW_TABLE_SIZE, sizeof(fw_table_entry));
-  if(g_fw_table == NULL)
+  /* allocate memory for the forwarding table, router->fw_table */
+  router->fw_table = (fw_table_entry*) calloc(FW_TABLE_SIZE, sizeof(fw_table_entry));
+  if(router->fw_table == NULL)
   {
-    perror("g_fw_table cannot be allocated memory");
+    perror("fw_table cannot be allocated memory");
     exit(1);
   }
   
-  /* allocate memory for the port table, g_port_table */
-  g_port_table = (port_table_entry*) calloc(PORT_TABLE_SIZE, sizeof(port_table_entry));
-  if(g_port_table == NULL)
+  /* allocate memory for the port table, router->port_table */
+  router->port_table = (port_table_entry*) calloc(PORT_TABLE_SIZE, sizeof(port_table_entry));
+  if(router->port_table == NULL)
   {
-    perror("g_port_table cannot be allocated memory");
+    perror("port_table cannot be allocated memory");
     exit(1);
   }
 
-  g_rt_table_size = 0;
-  g_net_table_size = 0;
-  g_fw_table_size = 0;
-  g_port_table_size = 0;
+  router->rt_table_size = 0;
+  router->rt_table_max = RT_TABLE_SIZE;
+  router->net_table_size = 0;
+  router->fw_table_size = 0;
+  router->fw_table_max = FW_TABLE_SIZE;
+  router->port_table_size = 0;
+
+  memset(router->flow_cache, 0, sizeof(router->flow_cache));
+  router->fw_table_gen = 1;
+  memset(&router->rt_index, 0, sizeof(dv_index));
+  memset(&router->fw_index, 0, sizeof(dv_index));
+  memset(&router->fw_packed, 0, sizeof(fw_packed));
+
+  /* allocate memory for the event log, router->events */
+  router->events = (dv_event*) calloc(DV_EVENT_LOG_SIZE, sizeof(dv_event));
+  if(router->events == NULL)
+  {
+    perror("events cannot be allocated memory");
+    exit(1);
+  }
+  router->events_head = 0;
+  router->route_events = 0;
+  router->start_time = getmonotime();
+  router->last_change = 0;
+
+  /* DV messages are sent to the all-routers group */
+  ip_join_group(router, IP_ALLROUTERS);
 
   for(i = 0; i < addr_num; i++)
   {
     net_addr = addr[i] & mask[i]; //get network address through netmasking
 
-    /* add a new dv table entry to g_rt_table */
-    g_rt_table[i].dest = net_addr;
-    g_rt_table[i].mask = mask[i];
-    g_rt_table[i].next = 0;
-    g_rt_table[i].hop = 1;
-    g_rt_table[i].itf = sock[i];
-    strcpy(g_rt_table[i].itf_name, itf_prefix);
+    /* add a new dv table entry to router->rt_table */
+    router->rt_table[i].dest = net_addr;
+    router->rt_table[i].mask = mask[i];
+    router->rt_table[i].next = 0;
+    router->rt_table[i].hop = 1;
+    router->rt_table[i].itf = sock[i];
+    strcpy(router->rt_table[i].itf_name, itf_prefix);
     sprintf(buf, "%d", i);
-    strcat(g_rt_table[i].itf_name, buf);
-    g_rt_table[i].status = RTE_UP;
-    g_rt_table[i].time = 0; //there is no timeout for the address of the local subnet attached to the router's interface
-    g_rt_table_size++;
-
-    /* add a new subnet address to g_net_table */
-    g_net_table[i].net = net_addr;
-    g_net_table[i].mask = mask[i];
-    g_net_table_size++;
-
-    /* add a new forwarding information to g_fw_table */
-    g_fw_table[i].dest = net_addr;
-    g_fw_table[i].mask = mask[i];
-    g_fw_table[i].next = 0;
-    g_fw_table[i].itf = sock[i];
-    strcpy(g_fw_table[i].itf_name, g_rt_table[i].itf_name);
-    g_fw_table[i].flag = 1;
-    g_fw_table_size++;
-
-    /* add a new interface port to g_port_table */
-    g_port_table[i].itf = sock[i];
-    strcpy(g_port_table[i].itf_name, g_rt_table[i].itf_name);
-    g_port_table_size++;
+    strcat(router->rt_table[i].itf_name, buf);
+    router->rt_table[i].status = RTE_UP;
+    router->rt_table[i].time = 0; //there is no timeout for the address of the local subnet attached to the router's interface
+    router->rt_table_size++;
+
+    /* add a new subnet address to router->net_table */
+    router->net_table[i].net = net_addr;
+    router->net_table[i].mask = mask[i];
+    router->net_table_size++;
+
+    /* add a new forwarding information to router->fw_table */
+    router->fw_table[i].dest = net_addr;
+    router->fw_table[i].mask = mask[i];
+    router->fw_table[i].next = 0;
+    router->fw_table[i].itf = sock[i];
+    strcpy(router->fw_table[i].itf_name, router->rt_table[i].itf_name);
+    router->fw_table[i].flag = 1;
+    router->fw_table_size++;
+
+    /* add a new interface port to router->port_table */
+    router->port_table[i].itf = sock[i];
+    strcpy(router->port_table[i].itf_name, router->rt_table[i].itf_name);
+    router->port_table[i].cost = 1;
+    router->port_table[i].measured = 0;
+    router->port_table_size++;
   }
 
+  dv_index_tables(router);
   return 0;
 }
 
-char* dv_get_itf_name(int sock)
+char* dv_get_itf_name(dv_router* router, int sock)
 { //return the interface name corresponding to incoming socket (sock)
   char* ptr = NULL;
   int i;
 
-  for(i = 0; i < g_port_table_size; i++)
+  for(i = 0; i < router->port_table_size; i++)
   {
-    if(sock == g_port_table[i].itf)
+    if(sock == router->port_table[i].itf)
     {
-      ptr = g_port_table[i].itf_name;
+      ptr = router->port_table[i].itf_name;
       break;
     }
   }
@@ -120,7 +620,192 @@ char* dv_get_itf_name(int sock)
   return ptr;
 }
 
-int dv_broadcast_dv_message(in_addr_t* myipaddrs)
+char* dv_encode_dv_message(dv_router* router, ushort cmd, int sock, int* start, int* len)
+{ //construct a DV exchange message for cmd with the routing entries from *start on; a DV_BREAKAGE message contains only the network attached to sock
+  char* msg; //DV exchange message of "addr/mask/hop\n" records followed by "x" and cmd
+  char* ptr;
+  struct in_addr net;
+  int size; //size of the records
+  int i;
+
+  size = (router->rt_table_size - *start)*DV_ENTRY_STR_SIZE;
+  if(size > DV_MSG_MAX_SIZE)
+    size = DV_MSG_MAX_SIZE;
+
+  msg = (char*) malloc(size + DV_TRAILER_SIZE);
+  if(msg == NULL)
+  {
+    fprintf(stderr, "error : unable to malloc\n");
+    return NULL;
+  }
+
+  ptr = msg;
+  for(i = *start; i < router->rt_table_size; i++)
+  {
+    if(ptr - msg + DV_ENTRY_STR_SIZE > size) //the rest goes into the next message
+      break;
+
+    if((cmd == DV_ADVERTISE) && (router->rt_table[i].status != RTE_UP)) //a stale route is not spread until it is confirmed
+      continue;
+
+    if((cmd == DV_BREAKAGE) && (router->rt_table[i].itf != sock))
+      continue;
+
+    net.s_addr = router->rt_table[i].dest;
+    ptr += sprintf(ptr, "%s/%d/%d\n", inet_ntoa(net), router->rt_table[i].mask, router->rt_table[i].hop);
+
+    if(cmd == DV_BREAKAGE) //only the first network attached to the broken link is reported
+    {
+      i = router->rt_table_size;
+      break;
+    }
+  }
+  ptr += sprintf(ptr, "x%d", cmd);
+
+  *start = i;
+
+  *len = ptr - msg; //the terminating '\0' is not sent
+  g_stats->allocs++;
+  return msg;
+}
+
+static char* dv_decode_field(char* ptr, char* limit, char sep, char* field, int size)
+{ //copy the field at ptr up to sep into field as a string; return the position after sep, or NULL if the field is too long or the data runs out before sep
+  int j;
+
+  for(j = 0; (ptr < limit) && (*ptr != sep); j++)
+  {
+    if(j == size-1)
+      return NULL;
+    field[j] = *ptr++;
+  }
+
+  if(ptr == limit)
+    return NULL;
+
+  field[j] = '\0';
+  return ptr+1;
+}
+
+static int dv_decode_number(char* field, int* val)
+{ //convert the decimal field into val; return 0 if it is empty or has anything else
+  char* end;
+
+  *val = strtol(field, &end, 10);
+  return (end != field) && (*end == '\0');
+}
+
+int dv_decode_dv_message(char* dat, int dat_len, dv_entry** dv, int* dv_entry_num, ushort* cmd, int* cost)
+{ //convert a DV exchange message into a dv_entry array, its command and the sender's cost of the link; the caller frees *dv
+  char addr[DV_ADDR_STR_SIZE]; //dotted-decimal network address
+  char field[DV_ENTRY_STR_SIZE]; //mask or hop count
+  struct in_addr net;
+  char* ptr;
+  char* limit; //the records end at the command; dat is not terminated
+  int num; //number of records in the message
+  int i, j;
+
+  /* count the records to allocate dv at once */
+  num = 0;
+  for(i = 0; (i < dat_len) && (dat[i] != 'x'); i++)
+  {
+    if(dat[i] == '\n')
+      num++;
+  }
+
+  if(i+1 >= dat_len) //there is no command after 'x'
+    return 0;
+
+  *cmd = dat[i+1] - '0';
+  limit = dat + i;
+
+  /* the sender's cost of the link follows the command as "/<cost>", if any */
+  *cost = 0;
+  if((i+2 < dat_len) && (dat[i+2] == '/'))
+  {
+    for(j = i+3; (j < dat_len) && (dat[j] >= '0') && (dat[j] <= '9') && (*cost <= DV_COST_MAX); j++)
+      *cost = *cost*10 + (dat[j] - '0');
+  }
+
+  *dv = (dv_entry*) malloc(sizeof(dv_entry)*(num > 0 ? num : 1));
+  if(*dv == NULL)
+  {
+    fprintf(stderr, "error : unable to malloc\n");
+    return 0;
+  }
+
+  /* each record is "addr/mask/hop\n"; every field is bounded by the command at limit */
+  ptr = dat;
+  for(i = 0; i < num; i++)
+  {
+    ptr = dv_decode_field(ptr, limit, '/', addr, sizeof(addr));
+    if((ptr == NULL) || (inet_aton(addr, &net) == 0))
+    {
+      free(*dv);
+      return 0;
+    }
+    (*dv)[i].dest = net.s_addr;
+
+    ptr = dv_decode_field(ptr, limit, '/', field, sizeof(field));
+    if((ptr == NULL) || !dv_decode_number(field, &(*dv)[i].mask))
+    {
+      free(*dv);
+      return 0;
+    }
+
+    ptr = dv_decode_field(ptr, limit, '\n', field, sizeof(field));
+    if((ptr == NULL) || !dv_decode_number(field, &(*dv)[i].hop))
+    {
+      free(*dv);
+      return 0;
+    }
+  }
+
+  *dv_entry_num = num;
+  g_stats->allocs++;
+  return 1;
+}
+
+static int dv_broadcast_summaries(dv_router* router)
+{ //advertise the summarized routes through every interface port, each without the routes learned through it
+  char* msg; //DV exchange message
+  int len; //length of msg
+  int start; //first summarized route of the next message
+  int num; //number of summarized routes
+  int most = 0; //number of routes in the largest advertisement
+  dv_entry* dv; //summarized routes
+  in_addr_t dst = IP_ALLROUTERS;
+  int j, n;
+
+  dv_index_clear(&router->sum_index);
+  for(j = 0; j < router->port_table_size; j++)
+  {
+    num = dv_summarize(router, router->port_table[j].itf, &dv);
+    start = 0;
+    do {
+      msg = dv_encode_dv_entries(dv, num, &start, &len);
+      if(msg == NULL)
+      {
+        free(dv);
+        return 0;
+      }
+
+      n = len + sprintf(msg + len, "/%d", dv_link_cost(router, router->port_table[j].itf));
+      if(sendmessage(router, router->port_table[j].itf, router->ipaddrs[0], dst, n, DATA_DV, msg) == 1)
+        g_stats->dv_adverts_sent++;
+      free(msg);
+    } while(start < num);
+
+    free(dv);
+    if(num > most)
+      most = num;
+  }
+
+  dv_log_event(router, DV_EVENT_ADVERT_SENT, 0, 0, most);
+  return 1;
+}
+
+int dv_broadcast_dv_message(dv_router* router)
 { //broadcast the routing information with DV exchange message
 
   /** FILL IN YOUR CODE */
@@ -134,49 +819,38 @@ int dv_broadcast_dv_message(in_addr_t* myipaddrs)
 #endif
 
 
-  ushort len;
-  char net_addr[200]="";
-  for(int i=0;i<g_rt_table_size;i++){
-    if(g_rt_table[i].status==RTE_DOWN)
-      continue;
-    struct in_addr net;
-    net.s_addr = g_rt_table[i].dest;
-    strcat(net_addr, inet_ntoa(net));
-    char mask[6];
-    sprintf(mask,"%d",g_rt_table[i].mask);
-    char hop[3];
-    sprintf(hop,"%d",g_rt_table[i].hop);
-    strcat(net_addr, "/");
-    strcat(net_addr, mask);
-    strcat(net_addr, "/");
-    strcat(net_addr, hop);
-    strcat(net_addr, "\n");
-  }
-  strcat(net_addr,"x");
-  strcat(net_addr,"0");
-  strcat(net_addr,"\0");
-  len=strlen(net_addr);
-  in_addr_t dst = IP_BCASTADDR;
-
-  // for(int j=0;j<g_port_table_size;j++){
-  //   printf("here^^\n");
-  //   sendmessage(g_port_table[j].itf, myipaddrs[0], dst, len, DATA_DV, net_addr);//dvmsg send
-  // }
-
-  for(int j=0;j<g_fw_table_size;j++){
-    if(g_fw_table[j].flag==(-1))
-      continue;
+  char* msg; //DV exchange message
+  int len; //length of msg
+  int start = 0; //first routing entry of the next message
+  in_addr_t dst = IP_ALLROUTERS;
 
-    // printf("id is %d, here^^\n",j);
-    sendmessage(g_fw_table[j].itf, myipaddrs[0], dst, len, DATA_DV, net_addr);//dvmsg send
-  }
+  if(router->summarize)
+    return dv_broadcast_summaries(router);
+
+  /* a routing table too large for one message is advertised in several messages */
+  do {
+    msg = dv_encode_dv_message(router, DV_ADVERTISE, -1, &start, &len);
+    if(msg == NULL)
+      return 0;
+
+    /* every interface port gets one copy of the message, which ends with the cost of its link */
+    for(int j=0;j<router->port_table_size;j++){
+      int n=len+sprintf(msg+len, "/%d", dv_link_cost(router, router->port_table[j].itf));
+      if(sendmessage(router, router->port_table[j].itf, router->ipaddrs[0], dst, n, DATA_DV, msg) == 1)//dvmsg send
+        g_stats->dv_adverts_sent++;
+    }
+
+    free(msg);
+  } while(start < router->rt_table_size);
+
+  dv_log_event(router, DV_EVENT_ADVERT_SENT, 0, 0, router->rt_table_size);
 
   // printf("BROADCASTED NORMAL DV_MSG\n");
 
   return 1;   
 }
 
-int dv_broadcast_dv_message_for_link_breakage(int sock, in_addr_t* myipaddrs) //broadcast the routing information with DV exchange message containing the network address related to the link which is broken due to a hub crash.
+int dv_broadcast_dv_message_for_link_breakage(dv_router* router, int sock) //broadcast the routing information with DV exchange message containing the network address related to the link which is broken due to a hub crash.
 {
   /** FILL IN YOUR CODE */
   /* 1. change the state of the network entry related to sock (or hub) from RTE_UP to RTE_DOWN and set the corresponding forwarding entry's flag to 0
@@ -186,140 +860,177 @@ int dv_broadcast_dv_message_for_link_breakage(int sock, in_addr_t* myipaddrs) //
      3. broadcast the DV message to every active network interface
   *****************************************************************/
   int down_sock=sock;
-  ushort len;
-  char net_addr[200]="";
-  for(int i=0;i<g_rt_table_size;i++){
-    if(g_rt_table[i].itf==down_sock){
-      struct in_addr net;
-      net.s_addr = g_rt_table[i].dest;
-      strcat(net_addr, inet_ntoa(net));
-      char mask[6];
-      sprintf(mask,"%d",g_rt_table[i].mask);
-      char hop[3];
-      sprintf(hop,"%d",g_rt_table[i].hop);
-      strcat(net_addr, "/");
-      strcat(net_addr, mask);
-      strcat(net_addr, "/");
-      strcat(net_addr, hop);
-      strcat(net_addr, "\n");
-      break;
+  char* msg; //DV exchange message
+  int len; //length of msg
+  int start = 0; //first routing entry of the message
+  in_addr_t dst = IP_ALLROUTERS;
+
+  msg = dv_encode_dv_message(router, DV_BREAKAGE, down_sock, &start, &len);
+  if(msg == NULL)
+    return 0;
+
+  for(int i=0;i<router->rt_table_size;i++){
+    /* the equal-cost next hops behind the broken port are lost */
+    for(int j=router->rt_table[i].ecmp_num-1;j>=0;j--){
+      if(router->rt_table[i].ecmp[j].itf==sock)
+        dv_remove_path(&router->rt_table[i], j);
     }
-  }
-  strcat(net_addr,"x");
-  strcat(net_addr,"1");
-  strcat(net_addr,"\0");
-  len=strlen(net_addr);
-  in_addr_t dst = IP_BCASTADDR;
-  // in_addr_t dst;
-  // g_port_table_size
-
-  for(int i=0;i<g_rt_table_size;i++){
-    if(g_rt_table[i].itf==sock){
-      // printf("BEFORE : g_rt_table[%d].status = %d\n",i, g_rt_table[i].status);
-      g_rt_table[i].status=RTE_DOWN;
-      // printf("AFTER : g_rt_table[%d].status = %d\n",i, g_rt_table[i].status);
+
+    if(router->rt_table[i].itf==sock && router->rt_table[i].status==RTE_UP && router->rt_table[i].ecmp_num>0){
+      dv_promote_path(router, &router->rt_table[i]); //the route stays up through another next hop
+    }
+    else if(router->rt_table[i].itf==sock){
+      // printf("BEFORE : router->rt_table[%d].status = %d\n",i, router->rt_table[i].status);
+      if(router->rt_table[i].status==RTE_UP)
+        g_stats->route_changes++;
+      if(router->rt_table[i].status!=RTE_DOWN){
+        router->rt_table[i].flaps++;
+        dv_log_route(router, DV_EVENT_WITHDRAW, &router->rt_table[i]);
+      }
+      router->rt_table[i].status=RTE_DOWN;
+      // printf("AFTER : router->rt_table[%d].status = %d\n",i, router->rt_table[i].status);
     }
   }
   // printf("update rt for link breakage\n");
 
-  for(int i=0;i<g_fw_table_size;i++){
-    if(g_fw_table[i].itf==sock){
-      // printf("BEFORE : g_fw_table[%d].flag = %d\n",i, g_fw_table[i].flag);
-      g_fw_table[i].flag=-1;
-      // printf("AFTER : g_fw_table[%d].flag = %d\n",i, g_fw_table[i].flag);
-    }
-  }
+  dv_update_fw_table(router); //the routes behind sock are disabled or moved to their other next hops
   // printf("update fw for link breakage\n");
 
-  for(int j=0;j<g_port_table_size;j++){
-    if(g_port_table[j].itf!=down_sock){
-      // printf("down sock is %d and g_port_table[%d].itf is %d\n",down_sock, j, g_port_table[j].itf);
-      // printf("RIGHT BEFORE SENDMESSAGE : down sock is %d and g_port_table[%d].itf is %d\n",down_sock, j, g_port_table[j].itf);
-      sendmessage(g_port_table[j].itf, myipaddrs[0], dst, len, DATA_DV, net_addr);//dvmsg send
+  for(int j=0;j<router->port_table_size;j++){
+    if(router->port_table[j].itf!=down_sock){
+      // printf("down sock is %d and router->port_table[%d].itf is %d\n",down_sock, j, router->port_table[j].itf);
+      // printf("RIGHT BEFORE SENDMESSAGE : down sock is %d and router->port_table[%d].itf is %d\n",down_sock, j, router->port_table[j].itf);
+      if(sendmessage(router, router->port_table[j].itf, router->ipaddrs[0], dst, len, DATA_DV, msg) == 1)//dvmsg send
+        g_stats->dv_breakages_sent++;
     }
   }
 
-  // printf("before return\n");
+  free(msg);
+  dv_log_event(router, DV_EVENT_BREAKAGE_SENT, 0, 0, 1);
+
+  /* the port is gone, so no more advertisements are sent through it */
+  for(int j=0;j<router->port_table_size;j++){
+    if(router->port_table[j].itf==down_sock){
+      router->port_table[j]=router->port_table[router->port_table_size-1];
+      router->port_table_size--;
+      break;
+    }
+  }
 
   return 1;
 }
 
-int dv_update_rt_table(int sock, in_addr_t neighbor, dv_entry* dv, int dv_entry_num)
-{ //update g_rt_table with dv entries sent by neighbor which are reachable network via the neighbor
-  in_addr_t net_addr1, net_addr2; //network addresses
-  int flag1 = 0; //flag to see if neighbor's network address is the same network
-                 //as the network address of the incoming interface of the router
-
-  int flag2 = 0; //flag to see if the new dv_entry exists in g_dv_table
+int dv_update_rt_table(dv_router* router, int sock, in_addr_t neighbor, dv_entry* dv, int dv_entry_num, int cost)
+{ //update router->rt_table with dv entries sent by neighbor which are reachable network via the neighbor over a link of cost
   int i, j, k; //loop index
+  int metric; //metric of the destination via neighbor
 
   for(i = 0; i < dv_entry_num; i++) //for-1
   {
-      for(j = 0; j < g_net_table_size; j++) //for-2
-      {
-        net_addr1 = dv[i].dest & dv[i].mask;
-        net_addr2 = g_net_table[j].net & g_net_table[j].mask;
-       
-        if(net_addr1 == net_addr2) //since dv[i].dest is the address of the network directly attached to the router, the router ignores it.
-	{
-          flag1 = 1;
-	  break;
-	}
-      } //end of for-2
-
-      if(flag1 == 1)
-      {
-	flag1 = 0;
-	continue;
-      }
+      if(dv_is_attached_net(router, dv[i].dest & dv[i].mask)) //since dv[i].dest is the address of the network directly attached to the router, the router ignores it.
+        continue;
+
+      if(router->summarize && (dv_index_find(&router->sum_index, dv[i].dest, dv[i].mask) != -1)) //a neighbor echoes a summary of ours, which stands for our own routes
+        continue;
+
+      metric = dv[i].hop + cost;
 
-      for(k = 0; k < g_rt_table_size; k++) //for-3
+      k = dv_index_find(&router->rt_index, dv[i].dest, dv[i].mask); //the entry of the destination in routing table, if any
+      if(k != -1)
       {
-	if(dv[i].dest == g_rt_table[k].dest)
-	{
-          flag2 = 1; /* 2005-12-5: flag2=1 indicates that the destination entry is in routing table and should be updated without adding the destination entry to the routing table again. */
+          /* 2005-12-5: the destination entry is in routing table and should be updated without adding the destination entry to the routing table again. */
 
           /* 2005-12-6: update the time of the corresponding routing entry since the neighbor towards the destination is alive.
-             The condition that neighbor == g_rt_table[k].next says that the advertising neighbor is the same neighbor as the existing next hop of the routing entry */
-          if((g_rt_table[k].status == RTE_UP) && (neighbor == g_rt_table[k].next))
+             The condition that neighbor == router->rt_table[k].next says that the advertising neighbor is the same neighbor as the existing next hop of the routing entry */
+          if((router->rt_table[k].status == RTE_UP) && (neighbor == router->rt_table[k].next))
 	  {
-            g_rt_table[k].time = getcurtime(); //get the current time and update the time field to prevent the expiration of the entry
+            router->rt_table[k].time = getcurtime(); //get the current time and update the time field to prevent the expiration of the entry
+
+            /* the metric via the next hop follows the link costs on the way, which may grow as well as shrink */
+            if((metric > router->rt_table[k].hop) && (router->rt_table[k].ecmp_num > 0))
+              dv_promote_path(router, &router->rt_table[k]); //the other equal-cost next hops are shorter now
+            else if(metric >= DV_METRIC_INFINITY)
+            {
+              router->rt_table[k].status = RTE_DOWN;
+              router->rt_table[k].flaps++;
+              g_stats->route_changes++;
+              dv_log_route(router, DV_EVENT_WITHDRAW, &router->rt_table[k]);
+            }
+            else if(metric != router->rt_table[k].hop)
+            {
+              router->rt_table[k].hop = metric;
+              router->rt_table[k].ecmp_num = 0; //the equal-cost next hops of the old metric are longer now
+              g_stats->route_changes++;
+              dv_log_route(router, DV_EVENT_CHANGE, &router->rt_table[k]);
+            }
           }
-          /* 2005-12-5: If the status of the destination entry is RTE_DOWN, the new dv entry should be substituted for the destination entry regardless of the distance */
-          else if((g_rt_table[k].status == RTE_DOWN) || ((dv[i].hop + 1) < g_rt_table[k].hop)) //update the hop count and next hop to the destination network
+          /* the destination is unreachable via neighbor */
+          else if(metric >= DV_METRIC_INFINITY)
 	  {
-            g_rt_table[k].next = neighbor;
-            g_rt_table[k].hop = dv[i].hop + 1;
-            g_rt_table[k].status = RTE_UP;
-            g_rt_table[k].time = getcurtime(); //get the current time and update the time fieldg_rt_table[k].time = getcurtime(); //get the current time and update the time field
-	    break;
+            if((j = dv_find_path(&router->rt_table[k], neighbor)) != -1)
+              dv_remove_path(&router->rt_table[k], j);
 	  }
-	}    
-      } //end of for-3
-
-      if(flag2 == 0) //there is not the new dv_entry dv[i] in g_rt_table
+          /* 2005-12-5: If the status of the destination entry is RTE_DOWN, the new dv entry should be substituted for the destination entry regardless of the distance.
+             So is a stale entry restored from a checkpoint, which the advertisement confirms or replaces. */
+          else if((router->rt_table[k].status == RTE_DOWN) || (router->rt_table[k].status == RTE_STALE) || (metric < router->rt_table[k].hop)) //update the metric and next hop to the destination network
+	  {
+            if((router->rt_table[k].status == RTE_UP) && (router->rt_table[k].next != neighbor)) //the route moves to another next hop
+              router->rt_table[k].flaps++;
+            router->rt_table[k].ecmp_num = 0; //the equal-cost next hops of the old metric are no longer the shortest
+            router->rt_table[k].next = neighbor;
+            router->rt_table[k].hop = metric;
+            router->rt_table[k].itf = sock; //the new next hop may be behind another interface
+            strcpy(router->rt_table[k].itf_name, dv_get_itf_name(router, sock));
+            router->rt_table[k].status = RTE_UP;
+            g_stats->route_changes++;
+            router->rt_table[k].time = getcurtime(); //get the current time and update the time fieldg_rt_table[k].time = getcurtime(); //get the current time and update the time field
+            dv_log_route(router, DV_EVENT_CHANGE, &router->rt_table[k]);
+	  }
+          /* another neighbor at the same distance gives an equal-cost next hop */
+          else if(metric == router->rt_table[k].hop)
+	  {
+            if((dv_find_path(&router->rt_table[k], neighbor) == -1) && (router->rt_table[k].ecmp_num < DV_ECMP_MAX_PATHS-1))
+            {
+              router->rt_table[k].ecmp[router->rt_table[k].ecmp_num].next = neighbor;
+              router->rt_table[k].ecmp[router->rt_table[k].ecmp_num].itf = sock;
+              router->rt_table[k].ecmp_num++;
+              g_stats->route_changes++;
+              dv_log_event(router, DV_EVENT_CHANGE, dv[i].dest, neighbor, router->rt_table[k].hop);
+            }
+	  }
+          /* an equal-cost next hop whose distance grew is dropped */
+          else if((j = dv_find_path(&router->rt_table[k], neighbor)) != -1)
+	  {
+            dv_remove_path(&router->rt_table[k], j);
+            g_stats->route_changes++;
+            dv_log_route(router, DV_EVENT_CHANGE, &router->rt_table[k]);
+	  }
+      }
+      else if(metric < DV_METRIC_INFINITY) //there is not the new dv_entry dv[i] in router->rt_table
       {
-        g_rt_table[g_rt_table_size].dest = dv[i].dest;
-        g_rt_table[g_rt_table_size].mask = dv[i].mask;
-        g_rt_table[g_rt_table_size].next = neighbor;
-        g_rt_table[g_rt_table_size].hop = dv[i].hop + 1;
-        g_rt_table[g_rt_table_size].itf = sock;
-        strcpy(g_rt_table[g_rt_table_size].itf_name, dv_get_itf_name(sock)); //copy the corresponding interface name into itf_name
-        g_rt_table[g_rt_table_size].status = RTE_UP;
-        g_rt_table[g_rt_table_size].time = getcurtime(); //get the current time and update the time field
-
-        g_rt_table_size++;
+        dv_grow_rt_table(router);
+        dv_index_add(&router->rt_index, dv[i].dest, dv[i].mask, router->rt_table_size);
+        router->rt_table[router->rt_table_size].dest = dv[i].dest;
+        router->rt_table[router->rt_table_size].mask = dv[i].mask;
+        router->rt_table[router->rt_table_size].next = neighbor;
+        router->rt_table[router->rt_table_size].hop = metric;
+        router->rt_table[router->rt_table_size].itf = sock;
+        strcpy(router->rt_table[router->rt_table_size].itf_name, dv_get_itf_name(router, sock)); //copy the corresponding interface name into itf_name
+        router->rt_table[router->rt_table_size].status = RTE_UP;
+        router->rt_table[router->rt_table_size].time = getcurtime(); //get the current time and update the time field
+        router->rt_table[router->rt_table_size].ecmp_num = 0;
+
+        dv_log_route(router, DV_EVENT_ADD, &router->rt_table[router->rt_table_size]);
+        router->rt_table_size++;
+        g_stats->route_changes++;
       }
-      else
-        flag2 = 0; //reset flag2 to 0
-      
   } //end of for-1 
 
   return 1;
 }
 
-int dv_update_rt_table_for_link_breakage(int sock, in_addr_t neighbor, dv_entry* dv, int dv_entry_num)
-{ //update g_rt_table with dv entry sent by neighbor which becomes unreachable network due the link breakage (e.g., hub is down)
+int dv_update_rt_table_for_link_breakage(dv_router* router, int sock, in_addr_t neighbor, dv_entry* dv, int dv_entry_num)
+{ //update router->rt_table with dv entry sent by neighbor which becomes unreachable network due the link breakage (e.g., hub is down)
   /** FILL IN YOUR CODE */
   /** 1. set the "status" of the routing entry corresponding to the network related to the broken link
          to "RTE_DOWN".
@@ -329,58 +1040,160 @@ int dv_update_rt_table_for_link_breakage(int sock, in_addr_t neighbor, dv_entry*
    *************************************************************/
   // printf("dv_entry_num %d\n",dv_entry_num);
   for(int i=0;i<dv_entry_num;i++){
-    for(int j=0;j<g_rt_table_size;j++){
-      if(g_rt_table[j].dest==dv[i].dest){
-        g_rt_table[j].status=RTE_DOWN;
-      }
+    int j=dv_index_find(&router->rt_index, dv[i].dest, dv[i].mask);
+    if(j==-1){ //the neighbor may have advertised the network within a summary
+      j=dv_find_covering_route(router, neighbor, dv[i].dest, dv[i].mask);
+      if(j==-1)
+        continue;
+    }
 
-      if(g_fw_table[j].dest==dv[i].dest){
-        g_fw_table[j].flag=-1;
-      }
+    int k=dv_find_path(&router->rt_table[j], neighbor);
+    if(k!=-1){ //only the equal-cost next hop via neighbor is lost
+      dv_remove_path(&router->rt_table[j], k);
+      g_stats->route_changes++;
+      dv_log_route(router, DV_EVENT_CHANGE, &router->rt_table[j]);
+      continue;
+    }
+    if(router->rt_table[j].status==RTE_UP && router->rt_table[j].next==neighbor && router->rt_table[j].ecmp_num>0){
+      dv_promote_path(router, &router->rt_table[j]); //the route stays up through another next hop
+      continue;
+    }
+
+    if(router->rt_table[j].status==RTE_UP)
+      g_stats->route_changes++;
+    if(router->rt_table[j].status!=RTE_DOWN){
+      router->rt_table[j].flaps++;
+      dv_log_route(router, DV_EVENT_WITHDRAW, &router->rt_table[j]);
+    }
+    router->rt_table[j].status=RTE_DOWN;
+    router->rt_table[j].ecmp_num=0;
+
+    j=dv_index_find(&router->fw_index, router->rt_table[j].dest, router->rt_table[j].mask);
+    if(j!=-1){
+      router->fw_table[j].flag=-1;
     }
   }
+  dv_invalidate_flow_cache(router);
   return 1;
 }
 
-int dv_update_fw_table()
-{ //update forwarding table (g_fw_table) with the routing table (g_rt_table)
+int dv_update_fw_table(dv_router* router)
+{ //update forwarding table (router->fw_table) with the routing table (router->rt_table)
 
   /** FILL IN YOUR CODe */
-  /** 1. update g_fw_table with g_rt_table
+  /** 1. update router->fw_table with router->rt_table
          - if an entry corresponding to a network address exists, update the "flag" of the forwarding entry
-         - otherwise, add a new forwarding entry to g_fw_table.
+         - otherwise, add a new forwarding entry to router->fw_table.
  
   *************************************** */
-  int i,j,check;
-  for(i=0;i<g_rt_table_size;i++){
-    check=0;
-
-    for(j=0;j<g_fw_table_size;j++){
-      if(g_rt_table[i].dest==g_fw_table[j].dest){
-        check=1;
-        break;//next rt_table entry
+  int i,j;
+  int flag; //flag of the forwarding entry corresponding to the routing entry
+  int changed=0; //whether any forwarding entry is added or changed
+
+  for(i=0;i<router->rt_table_size;i++){
+    flag=(router->rt_table[i].status!=RTE_DOWN) ? 1 : -1; //a stale route keeps forwarding until it expires
+
+    j=dv_index_find(&router->fw_index, router->rt_table[i].dest, router->rt_table[i].mask);
+    if(j!=-1){
+      /* keep the existing entry in sync with the routing entry */
+      if(router->fw_table[j].mask!=router->rt_table[i].mask || router->fw_table[j].next!=router->rt_table[i].next ||
+         router->fw_table[j].itf!=router->rt_table[i].itf || router->fw_table[j].flag!=flag ||
+         router->fw_table[j].ecmp_num!=router->rt_table[i].ecmp_num ||
+         memcmp(router->fw_table[j].ecmp, router->rt_table[i].ecmp, router->rt_table[i].ecmp_num*sizeof(dv_path))!=0){
+        router->fw_table[j].mask=router->rt_table[i].mask;
+        router->fw_table[j].next=router->rt_table[i].next;
+        router->fw_table[j].itf=router->rt_table[i].itf;
+        strncpy(router->fw_table[j].itf_name, router->rt_table[i].itf_name,ITF_NAME_SIZE);
+        router->fw_table[j].flag=flag;
+        memcpy(router->fw_table[j].ecmp, router->rt_table[i].ecmp, sizeof(router->fw_table[j].ecmp));
+        router->fw_table[j].ecmp_num=router->rt_table[i].ecmp_num;
+        changed=1;
       }
     }
-
-    if(check==0){
-      g_fw_table[g_fw_table_size].dest=g_rt_table[i].dest;
-      g_fw_table[g_fw_table_size].mask=g_rt_table[i].mask;
-      g_fw_table[g_fw_table_size].next=g_rt_table[i].next;
-      g_fw_table[g_fw_table_size].itf=g_rt_table[i].itf;
-      strncpy(g_fw_table[g_fw_table_size].itf_name, g_rt_table[i].itf_name,ITF_NAME_SIZE);
-      g_fw_table[g_fw_table_size].flag=1;
-      g_fw_table_size++;
+    else{
+      dv_grow_fw_table(router);
+      dv_index_add(&router->fw_index, router->rt_table[i].dest, router->rt_table[i].mask, router->fw_table_size);
+      router->fw_table[router->fw_table_size].dest=router->rt_table[i].dest;
+      router->fw_table[router->fw_table_size].mask=router->rt_table[i].mask;
+      router->fw_table[router->fw_table_size].next=router->rt_table[i].next;
+      router->fw_table[router->fw_table_size].itf=router->rt_table[i].itf;
+      strncpy(router->fw_table[router->fw_table_size].itf_name, router->rt_table[i].itf_name,ITF_NAME_SIZE);
+      router->fw_table[router->fw_table_size].flag=flag;
+      memcpy(router->fw_table[router->fw_table_size].ecmp, router->rt_table[i].ecmp, sizeof(router->fw_table[router->fw_table_size].ecmp));
+      router->fw_table[router->fw_table_size].ecmp_num=router->rt_table[i].ecmp_num;
+      router->fw_table_size++;
+      changed=1;
     }
   }
+
+  if(changed)
+    dv_invalidate_flow_cache(router);
   return 1;
 }
 
-int dv_update_routing_info(int sock, char* dat, int dat_len, in_addr_t src)
+void dv_invalidate_flow_cache(dv_router* router)
+{ //invalidate every flow cache entry after the forwarding table changes
+  router->fw_table_gen++;
+}
+
+int dv_set_link_cost(dv_router* router, int sock, int cost)
+{ //configure the cost of the link of socket sock; the routes through it follow at the next advertisements
+  int j;
+
+  if((cost < 1) || (cost > DV_COST_MAX))
+  {
+    printf("dv_set_link_cost(): the cost (%d) is not in [1, %d]\n", cost, DV_COST_MAX);
+    return 0;
+  }
+
+  for(j = 0; j < router->port_table_size; j++)
+  {
+    if(router->port_table[j].itf == sock)
+    {
+      router->port_table[j].cost = cost;
+      return 1;
+    }
+  }
+
+  printf("dv_set_link_cost(): there is no interface port for socket %d\n", sock);
+  return 0;
+}
+
+void dv_measure_link_costs(dv_router* router)
+{ //measure the cost of every link from the bytes waiting in its socket to the hub and the RTT to the hub; 0 unless router->measure_costs is set
+#ifdef __linux__
+  struct tcp_info info;
+  socklen_t info_len;
+  int queued; //bytes not yet taken by the hub
+  int j;
+
+  for(j = 0; j < router->port_table_size; j++)
+  {
+    router->port_table[j].measured = 0;
+    if(!router->measure_costs)
+      continue;
+
+    if(ioctl(router->port_table[j].itf, SIOCOUTQ, &queued) == 0)
+      router->port_table[j].measured += queued / DV_COST_QUEUE_UNIT;
+
+    info_len = sizeof(info);
+    if(getsockopt(router->port_table[j].itf, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0)
+      router->port_table[j].measured += info.tcpi_rtt / DV_COST_RTT_UNIT;
+
+    if(router->port_table[j].measured > DV_COST_MAX)
+      router->port_table[j].measured = DV_COST_MAX;
+  }
+#endif
+}
+
+int dv_update_routing_info(dv_router* router, int sock, char* dat, int dat_len, in_addr_t src)
 { //update routing table and forwarding table
   int ret_val;
   dv_entry* dv;
   int dv_entry_num;
   ushort cmd; //DV message command = {DV_ADVERTISE, DV_BREAKAGE}
+  int cost; //cost of the link to the sender
+  int sender_cost; //the sender's cost of the link
 
   /** FILL IN YOUR CODE */
   /** 1. convert the DV exchange message into dv_entry arrary
@@ -389,69 +1202,21 @@ int dv_update_routing_info(int sock, char* dat, int dat_len, in_addr_t src)
 
       2. set cmd to the command described in DV exchange message
   ************************************************************/  
-  int i=0;
-  dv_entry_num=0;
-  while(dat[i]!='x'){
-    if(dat[i]=='\n')
-      dv_entry_num++;
-    i++;
-  }
-  dv=(dv_entry*)malloc(sizeof(dv_entry)*dv_entry_num);
-  char temp[20];
-  i=0;
-  int entry_id=0;
-
-  while(dat[i]!='x'){
-    char tmp_addr[20]="\0";
-    char tmp_mask[6]="\0";
-    char tmp_hop[5]="\0";
-    int tmp_hop_len=0;
-    while(dat[i]!='/n' && dat[i]!='x'){
-      int j=0; 
-      while(dat[i]!='/'){
-        //addr
-        tmp_addr[j++]=dat[i++];
-      }
-      j=0;
-      i++;
-      while(dat[i]!='/'){
-        tmp_mask[j++]=dat[i++];
-      }
-      j=0;
-      i++;
-      tmp_hop_len=0;
-      while(dat[i]!='\n'){
-        tmp_hop[j++]=dat[i++];
-      }
-      i++;
-      
-      struct in_addr dvNet;
-      inet_aton(tmp_addr,&dvNet);
-      dv[entry_id].dest=dvNet.s_addr;
-      dv[entry_id].mask=atoi(tmp_mask);
-      dv[entry_id].hop=atoi(tmp_hop);
-      entry_id++;
-      //ONE ENTRY DONE
-    }
-  }
-
-  dv_entry_num=entry_id;
-
-  //ADVERTISE? OR BREAKAGE?
-  i++;
-  char tmp[2]="";
-  tmp[0]=dat[i];
-
-  if(!strncmp(tmp,"0",1))
-    cmd=DV_ADVERTISE;
-  else if(!strncmp(tmp,"1",1)){
-    cmd=DV_BREAKAGE;
+  if(!dv_decode_dv_message(dat, dat_len, &dv, &dv_entry_num, &cmd, &sender_cost))
+  {
+    printf("dv_update_routing_info(): the DV exchange message is malformed\n");
+    return 0;
   }
 
-  // printf("cmd %hd\n",cmd);
   if(cmd == DV_ADVERTISE)
   {
-    ret_val = dv_update_rt_table(sock, src, dv, dv_entry_num);
+    g_stats->dv_adverts_rcvd++;
+    dv_log_event(router, DV_EVENT_ADVERT_RCVD, 0, src, dv_entry_num);
+    /* a link costs what the costlier end says, so that the load seen by either router counts */
+    cost = dv_link_cost(router, sock);
+    if(sender_cost > cost)
+      cost = (sender_cost < DV_COST_MAX) ? sender_cost : DV_COST_MAX;
+    ret_val = dv_update_rt_table(router, sock, src, dv, dv_entry_num, cost);
     if(ret_val != 1)
     {
       printf("dv_update_routing_info(): the DV exchange message has not been processed well\n");
@@ -463,7 +1228,9 @@ int dv_update_routing_info(int sock, char* dat, int dat_len, in_addr_t src)
   {
     /** FILL IN YOUR CODE in dv_update_rt_table_for_link_breakage() function */
     printf("LINK BREAKAGE\n");
-    ret_val = dv_update_rt_table_for_link_breakage(sock, src, dv, dv_entry_num);
+    g_stats->dv_breakages_rcvd++;
+    dv_log_event(router, DV_EVENT_BREAKAGE_RCVD, 0, src, dv_entry_num);
+    ret_val = dv_update_rt_table_for_link_breakage(router, sock, src, dv, dv_entry_num);
     if(ret_val != 1)
     {
       printf("dv_update_routing_info(): the DV exchange message has not been processed well\n");
@@ -479,7 +1246,7 @@ int dv_update_routing_info(int sock, char* dat, int dat_len, in_addr_t src)
   }
 
   /** FILL IN YOUR CODE in dv_update_fw_table() */
-  ret_val = dv_update_fw_table();
+  ret_val = dv_update_fw_table(router);
   if(ret_val != 1)
   {
     printf("dv_update_routing_info(): the forwarding table has not been updated well\n");
@@ -491,7 +1258,7 @@ int dv_update_routing_info(int sock, char* dat, int dat_len, in_addr_t src)
   return 1;
 } 
 
-void dv_update_tables_for_timeout(long curtime, int myconfigint)
+void dv_update_tables_for_timeout(dv_router* router, long curtime, int myconfigint)
 { //update the routing table and forwarding table for timeout
 
   /** FILL IN YOUR CODE */
@@ -501,10 +1268,186 @@ void dv_update_tables_for_timeout(long curtime, int myconfigint)
 
       2. disable the corresponding forwarding table entry
   ***********************************************************/
+  int i;
+  int expired = 0; //number of stale routes disabled
+
+  /* a route restored from a checkpoint is dropped unless a neighbor has confirmed it in time */
+  for(i = 0; i < router->rt_table_size; i++)
+  {
+    if((router->rt_table[i].status == RTE_STALE) && (curtime - router->rt_table[i].time > DV_STALE_ROUTE_LIFETIME * myconfigint))
+    {
+      router->rt_table[i].status = RTE_DOWN;
+      router->rt_table[i].flaps++;
+      g_stats->route_changes++;
+      dv_log_route(router, DV_EVENT_EXPIRE, &router->rt_table[i]);
+      expired++;
+    }
+  }
 
+  if(expired > 0)
+    dv_update_fw_table(router);
 }
 
-int dv_forward(IPPkt* ippkt)
+int dv_save_checkpoint(dv_router* router, char* file)
+{ //write the learned routes that are up into the checkpoint file; readers see either the old or the new file
+  char tmpfile[MAXSTRING];
+  char* buf;
+  dv_checkpoint_header* hdr;
+  dv_checkpoint_entry* ent;
+  int size;
+  int fd;
+  int i;
+
+  size = sizeof(dv_checkpoint_header) + router->rt_table_size*sizeof(dv_checkpoint_entry);
+  buf = (char*) calloc(1, size);
+  if(buf == NULL)
+  {
+    fprintf(stderr, "error : unable to calloc\n");
+    return 0;
+  }
+
+  hdr = (dv_checkpoint_header*) buf;
+  hdr->magic = DV_CHECKPOINT_MAGIC;
+  hdr->version = DV_CHECKPOINT_VERSION;
+  hdr->time = getcurtime();
+
+  ent = (dv_checkpoint_entry*) (hdr + 1);
+  for(i = 0; i < router->rt_table_size; i++)
+  {
+    /* attached networks are known at start, and a stale route no neighbor has confirmed is not passed on to the next run */
+    if((router->rt_table[i].next == 0) || (router->rt_table[i].status != RTE_UP))
+      continue;
+
+    ent->dest = router->rt_table[i].dest;
+    ent->mask = router->rt_table[i].mask;
+    ent->next = router->rt_table[i].next;
+    ent->hop = router->rt_table[i].hop;
+    strncpy(ent->itf_name, router->rt_table[i].itf_name, ITF_NAME_SIZE-1);
+    ent++;
+    hdr->entry_num++;
+  }
+  size = (char*) ent - buf;
+
+  snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", file);
+  fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd == -1)
+  {
+    perror("dv_save_checkpoint(): open");
+    free(buf);
+    return 0;
+  }
+
+  if(write(fd, buf, size) != size)
+  {
+    perror("dv_save_checkpoint(): write");
+    close(fd);
+    unlink(tmpfile);
+    free(buf);
+    return 0;
+  }
+  close(fd);
+  free(buf);
+
+  if(rename(tmpfile, file) == -1)
+  {
+    perror("dv_save_checkpoint(): rename");
+    unlink(tmpfile);
+    return 0;
+  }
+
+  return 1;
+}
+
+int dv_load_checkpoint(dv_router* router, char* file, int myconfigint)
+{ //add the routes of a recent checkpoint file to the routing table as RTE_STALE; return the number of routes
+  struct stat st;
+  long curtime;
+  dv_checkpoint_header* hdr;
+  dv_checkpoint_entry* ent;
+  int fd;
+  int sock;
+  int num = 0; //number of restored routes
+  int i, j;
+
+  fd = open(file, O_RDONLY);
+  if(fd == -1) //no checkpoint: cold start
+    return 0;
+
+  if(fstat(fd, &st) == -1 || st.st_size < sizeof(dv_checkpoint_header))
+  {
+    close(fd);
+    return 0;
+  }
+
+  hdr = (dv_checkpoint_header*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(hdr == MAP_FAILED)
+  {
+    perror("dv_load_checkpoint(): mmap");
+    return 0;
+  }
+
+  if((hdr->magic != DV_CHECKPOINT_MAGIC) || (hdr->version != DV_CHECKPOINT_VERSION) ||
+     (st.st_size != sizeof(dv_checkpoint_header) + hdr->entry_num*sizeof(dv_checkpoint_entry)))
+  {
+    printf("dv_load_checkpoint(): %s is not a valid checkpoint\n", file);
+    munmap(hdr, st.st_size);
+    return 0;
+  }
+
+  /* its routes would expire unconfirmed before any neighbor could advertise them, so an old checkpoint is not trusted */
+  curtime = getcurtime();
+  if((hdr->time > curtime) || (curtime - hdr->time > DV_STALE_ROUTE_LIFETIME * myconfigint))
+  {
+    printf("dv_load_checkpoint(): %s is %ld sec old, so the routes start cold\n", file, curtime - hdr->time);
+    munmap(hdr, st.st_size);
+    return 0;
+  }
+
+  ent = (dv_checkpoint_entry*) (hdr + 1);
+  for(i = 0; i < hdr->entry_num; i++, ent++)
+  {
+    /* the interface must still exist */
+    sock = -1;
+    for(j = 0; j < router->port_table_size; j++)
+    {
+      if(strncmp(router->port_table[j].itf_name, ent->itf_name, ITF_NAME_SIZE) == 0)
+      {
+        sock = router->port_table[j].itf;
+        break;
+      }
+    }
+
+    if(dv_index_find(&router->rt_index, ent->dest, ent->mask) != -1) //attached networks or a duplicate win
+      sock = -1;
+
+    if(sock == -1)
+      continue;
+
+    dv_grow_rt_table(router);
+    dv_index_add(&router->rt_index, ent->dest, ent->mask, router->rt_table_size);
+    router->rt_table[router->rt_table_size].dest = ent->dest;
+    router->rt_table[router->rt_table_size].mask = ent->mask;
+    router->rt_table[router->rt_table_size].next = ent->next;
+    router->rt_table[router->rt_table_size].hop = ent->hop;
+    router->rt_table[router->rt_table_size].itf = sock;
+    strncpy(router->rt_table[router->rt_table_size].itf_name, dv_get_itf_name(router, sock), ITF_NAME_SIZE);
+    router->rt_table[router->rt_table_size].status = RTE_STALE;
+    router->rt_table[router->rt_table_size].ecmp_num = 0;
+    router->rt_table[router->rt_table_size].time = hdr->time; //the lifetime of a stale route runs from when it was last up
+    router->rt_table_size++;
+    num++;
+  }
+
+  munmap(hdr, st.st_size);
+
+  if(num > 0)
+    dv_update_fw_table(router);
+
+  return num;
+}
+
+int dv_forward(dv_router* router, IPPkt* ippkt)
 { //forward the packet to the appropriate next hop router or host
 
 #ifdef _DEBUG  
@@ -528,28 +1471,74 @@ int dv_forward(IPPkt* ippkt)
 
       3. send the Ethernet frame to the appropriate hub
   **************************************************************************************************/
-  int sock=-1;
-  sock=dv_get_sock_for_destination(sock, ippkt->src, ippkt->dst);
-  sendippkt(sock, ippkt);
+  flow_cache_entry* fc;
+  ushort word; //type and TTL as the 16-bit word of the header they share
+
+  /* a packet that has crossed IP_DEFAULT_TTL routers is caught in a loop (e.g., while the routes count to infinity) */
+  if(ippkt->ttl <= 1)
+  {
+    g_stats->drops[DROP_TTL_EXPIRED]++;
+    trace_ippkt(TRACE_DROP, DROP_TTL_EXPIRED, -1, ippkt);
+    return 0;
+  }
+
+  /* only the TTL changes, so the checksum is updated instead of computed over the header again */
+  word = (ippkt->type << 8) | ippkt->ttl;
+  ippkt->ttl--;
+  ippkt->cksum = ip_cksum_update(ippkt->cksum, word, word - 1);
+
+  /* one probe into the flow cache gives the decision made for the previous packet of the flow */
+  fc = &router->flow_cache[dv_flow_hash(ippkt->src, ippkt->dst) & (FLOW_CACHE_SIZE-1)];
+  if((fc->gen != router->fw_table_gen) || (fc->src != ippkt->src) || (fc->dst != ippkt->dst))
+  { //miss: make the decision with the forwarding table and keep it
+    fc->src = ippkt->src;
+    fc->dst = ippkt->dst;
+    fc->gen = router->fw_table_gen;
+    fc->itf = dv_get_sock_for_destination(router, -1, ippkt->src, ippkt->dst);
+    g_stats->flow_cache_misses++;
+    if(fc->itf != -1 && !dv_ipaddr_to_hwaddr(router, ippkt->src, ippkt->dst, fc->hwdst))
+    { //the next hop has no MAC address, so nothing is kept and the next packet asks again
+      fc->gen = 0;
+      g_stats->drops[DROP_NO_ROUTE]++;
+      trace_ippkt(TRACE_DROP, DROP_NO_ROUTE, fc->itf, ippkt);
+      return 0;
+    }
+  }
+  else
+    g_stats->flow_cache_hits++;
+
+  if(fc->itf == -1) //there is no route toward the destination, so the packet is dropped
+  {
+    g_stats->drops[DROP_NO_ROUTE]++;
+    trace_ippkt(TRACE_DROP, DROP_NO_ROUTE, fc->itf, ippkt);
+    return 0;
+  }
+
+  trace_ippkt(TRACE_FWD, 0, fc->itf, ippkt);
+  sendippkt_with_hwaddr(router, fc->itf, ippkt, fc->hwdst);
   return 1;
 }
 
-void dv_show_routing_table()
+void dv_show_routing_table(dv_router* router)
 { //show routing table
   /** FILL IN YOUR CODE for show the routing table */
-  if(g_rt_table_size>0){
+  if(router->rt_table_size>0){
     printf("THIS IS THE ROUTING TABLE\n");
     printf("         NetAddr     | Mask | Hop | Next_HOP | Interface | STATUS\n");
-    for(int i=0;i<g_rt_table_size;i++){
+    for(int i=0;i<router->rt_table_size;i++){
       struct in_addr dst, next;
       char dst_addr[16];
       char next_addr[16];
-      dst.s_addr = g_rt_table[i].dest;
-      next.s_addr = g_rt_table[i].next;
+      dst.s_addr = router->rt_table[i].dest;
+      next.s_addr = router->rt_table[i].next;
       strncpy(dst_addr, inet_ntoa(dst), sizeof(dst_addr));
       strncpy(next_addr, inet_ntoa(next), sizeof(next_addr)); 
       
-      printf("Entry %d : %s | %d | %d | %s | %d | %d\n",i+1,dst_addr,g_rt_table[i].mask,g_rt_table[i].hop,next_addr,g_rt_table[i].itf,g_rt_table[i].status);
+      printf("Entry %d : %s | %d | %d | %s | %d | %d\n",i+1,dst_addr,router->rt_table[i].mask,router->rt_table[i].hop,next_addr,router->rt_table[i].itf,router->rt_table[i].status);
+      for(int j=0;j<router->rt_table[i].ecmp_num;j++){
+        next.s_addr = router->rt_table[i].ecmp[j].next;
+        printf("        + equal-cost next hop : %s | %d\n",inet_ntoa(next),router->rt_table[i].ecmp[j].itf);
+      }
     }
 
   }
@@ -558,24 +1547,28 @@ void dv_show_routing_table()
   }
 }
 
-void dv_show_forwarding_table()
+void dv_show_forwarding_table(dv_router* router)
 { //show forwarding table
   /** FILL IN YOUR CODE for show the forwarding table */
-  if(g_fw_table_size>0){
+  if(router->fw_table_size>0){
     printf("THIS IS THE FORWARDING TABLE\n");
     printf("         NetAddr | Mask | NextHop | Interface | Flag\n");
 
-    for(int i=0;i<g_fw_table_size;i++){
+    for(int i=0;i<router->fw_table_size;i++){
 
       struct in_addr dst, next;
       char dst_addr[16];
       char next_addr[16];
-      dst.s_addr = g_fw_table[i].dest;
-      next.s_addr = g_fw_table[i].next;
+      dst.s_addr = router->fw_table[i].dest;
+      next.s_addr = router->fw_table[i].next;
       strncpy(dst_addr, inet_ntoa(dst), sizeof(dst_addr));
       strncpy(next_addr, inet_ntoa(next), sizeof(next_addr)); 
 
-      printf("Entry %d : %s | %d | %s | %d | %d\n",i+1,dst_addr,g_fw_table[i].mask,next_addr,g_fw_table[i].itf, g_fw_table[i].flag);
+      printf("Entry %d : %s | %d | %s | %d | %d\n",i+1,dst_addr,router->fw_table[i].mask,next_addr,router->fw_table[i].itf, router->fw_table[i].flag);
+      for(int j=0;j<router->fw_table[i].ecmp_num;j++){
+        next.s_addr = router->fw_table[i].ecmp[j].next;
+        printf("        + equal-cost next hop : %s | %d\n",inet_ntoa(next),router->fw_table[i].ecmp[j].itf);
+      }
     }
   }
   else{
@@ -583,7 +1576,98 @@ void dv_show_forwarding_table()
   }
 }
 
-int dv_get_sock_for_destination(int sock, in_addr_t src, in_addr_t dst)
+void dv_show_link_costs(dv_router* router)
+{ //show the configured and measured cost of every link
+  int j;
+
+  printf("THIS IS THE COST OF THE LINKS%s\n", router->measure_costs ? "" : " (NOT MEASURED)");
+  printf("         Interface | Name | Cost | Measured | Total\n");
+  for(j = 0; j < router->port_table_size; j++)
+  {
+    printf("Port %d : %d | %s | %d | %d | %d\n", j+1, router->port_table[j].itf, router->port_table[j].itf_name,
+           router->port_table[j].cost, router->port_table[j].measured, dv_link_cost(router, router->port_table[j].itf));
+  }
+}
+
+void dv_show_convergence(dv_router* router)
+{ //show the time since the last route change, the churn rate and the flapping routes
+  long long now = getmonotime();
+  long long window = DV_CHURN_WINDOW*1000000LL; //churn window in microseconds
+  unsigned long kept; //number of events kept in the log
+  unsigned long i;
+  int recent = 0; //route events in the churn window
+  int partial = 0; //whether the log lost events of the churn window
+  int flapping = 0; //number of routes that have flapped
+  struct in_addr dst;
+
+  printf("THIS IS THE CONVERGENCE OF THE ROUTING TABLE\n");
+  if(router->last_change == 0)
+    printf("last route change : none in %.3f sec since start\n", (now - router->start_time)/1000000.0);
+  else
+    printf("last route change : %.3f sec ago (%.3f sec after start)\n",
+           (now - router->last_change)/1000000.0, (router->last_change - router->start_time)/1000000.0);
+
+  /* count the route events of the churn window from the newest one back */
+  kept = (router->events_head < DV_EVENT_LOG_SIZE) ? router->events_head : DV_EVENT_LOG_SIZE;
+  for(i = 1; i <= kept; i++)
+  {
+    dv_event* ev = &router->events[(router->events_head - i) & (DV_EVENT_LOG_SIZE-1)];
+    if(now - ev->time > window)
+      break;
+    if(ev->kind <= DV_EVENT_EXPIRE)
+      recent++;
+  }
+  partial = (i > kept) && (router->events_head > DV_EVENT_LOG_SIZE);
+
+  if(now - router->start_time < window) //the router has not run for a whole window yet
+    window = (now - router->start_time > 0) ? now - router->start_time : 1;
+  printf("route events      : %lu in total, %s%d in the last %.0f sec (%.2f per sec)\n",
+         router->route_events, partial ? "at least " : "", recent, window/1000000.0, recent/(window/1000000.0));
+
+  for(i = 0; i < router->rt_table_size; i++)
+  {
+    if(router->rt_table[i].flaps == 0)
+      continue;
+
+    if(flapping++ == 0)
+      printf("         NetAddr     | Mask | Flaps | STATUS\n");
+    dst.s_addr = router->rt_table[i].dest;
+    printf("Entry %lu : %s | %d | %d | %d\n", i+1, inet_ntoa(dst), router->rt_table[i].mask, router->rt_table[i].flaps, router->rt_table[i].status);
+  }
+  if(flapping == 0)
+    printf("NO ROUTE HAS FLAPPED\n");
+}
+
+void dv_show_events(dv_router* router)
+{ //show the event log, the oldest event first
+  unsigned long i;
+  dv_event* ev;
+  struct in_addr dest, next;
+  char dest_addr[16];
+  char next_addr[16];
+
+  if(router->events_head == 0)
+  {
+    printf("NO EVENTS IN EVENT LOG YET\n");
+    return;
+  }
+
+  printf("THIS IS THE EVENT LOG\n");
+  printf("     Time (sec) | Event | NetAddr | Next_HOP or Neighbor | Hop or Entries\n");
+  i = (router->events_head > DV_EVENT_LOG_SIZE) ? router->events_head - DV_EVENT_LOG_SIZE : 0;
+  for(; i < router->events_head; i++)
+  {
+    ev = &router->events[i & (DV_EVENT_LOG_SIZE-1)];
+    dest.s_addr = ev->dest;
+    next.s_addr = ev->next;
+    strncpy(dest_addr, inet_ntoa(dest), sizeof(dest_addr));
+    strncpy(next_addr, inet_ntoa(next), sizeof(next_addr));
+    printf("%15.6f | %s | %s | %s | %d\n", (ev->time - router->start_time)/1000000.0,
+           dv_event_names[ev->kind], dest_addr, next_addr, ev->hop);
+  }
+}
+
+int dv_get_sock_for_destination(dv_router* router, int sock, in_addr_t src, in_addr_t dst)
 { //return an appropriate socket for destination address dst with the forwarding table
   //if dst address is BROADCAST, 
 
@@ -596,20 +1680,14 @@ int dv_get_sock_for_destination(int sock, in_addr_t src, in_addr_t dst)
       2. return the socket
     
   **********************************************/
-  sock=-1;
-  int i=0;
-  
-  for(i=0;i<g_fw_table_size;i++){
-    if(((dst & g_fw_table[i].mask)==g_fw_table[i].dest)&&g_fw_table[i].flag==1){
-      sock=g_fw_table[i].itf;
-      return sock;
-    }
-  }
+  in_addr_t next_hop;
+
+  sock=dv_select_path(router, src, dst, &next_hop);
   return sock;
 }
 
-int dv_ipaddr_to_hwaddr(in_addr_t ippkt_dst, HwAddr ethpkt_dst)
-{ //convert the dst IP address into next hop's MAC address
+int dv_ipaddr_to_hwaddr(dv_router* router, in_addr_t ippkt_src, in_addr_t ippkt_dst, HwAddr ethpkt_dst)
+{ //convert the dst IP address into the MAC address of the next hop of the flow from ippkt_src
 
 #ifdef _DEBUG
   printf("\nthe router should determine which MAC address is used for sending the Ethernet frame to the appropriate next hop with the forwarding table\n");
@@ -623,24 +1701,18 @@ int dv_ipaddr_to_hwaddr(in_addr_t ippkt_dst, HwAddr ethpkt_dst)
 
   HwAddr middle;
   in_addr_t next_hop;
-  int i;
-  for(i=0;i<g_fw_table_size;i++){
-    if((g_fw_table[i].mask&ippkt_dst)==g_fw_table[i].dest){
-      next_hop=g_fw_table[i].next;
-      break;
-    }
-    else{
-      // printf("index is %d, and no matching entry in forwarding table\n",i);
-    }
-  }
+  int found;
 
-  if(g_fw_table[i].next==0){
+  dv_select_path(router, ippkt_src, ippkt_dst, &next_hop); //the same next hop as dv_get_sock_for_destination() chooses
+  if(next_hop==0){
     // printf("BEFORE arp_ipaddr_to_hwadrr : LAST LAN\n");
-    arp_ipaddr_to_hwaddr(ippkt_dst, middle);
+    found = arp_ipaddr_to_hwaddr(ippkt_dst, middle);
   }else{
     // printf("BEFORE arp_ipaddr_to_hwadrr : STILL MORE TO HOP\n");
-    arp_ipaddr_to_hwaddr(next_hop, middle);
+    found = arp_ipaddr_to_hwaddr(next_hop, middle);
   }
+  if(!found) //ethpkt_dst is left as it was
+    return 0;
   memcpy(ethpkt_dst, middle, sizeof(HwAddr));
   return 1;
 }
@@ -13,13 +13,13 @@
 #include "common.h"
 
 #define RT_TABLE_SIZE 50
-//size of routing table
+//initial size of routing table; it doubles whenever it is full
 
 #define NET_TABLE_SIZE 30
 //size of network address table
 
 #define FW_TABLE_SIZE 30
-//size of forwarding table
+//initial size of forwarding table; it doubles whenever it is full
 
 #define PORT_TABLE_SIZE 10
 //size of port table
@@ -27,11 +27,74 @@
 #define ITF_NAME_SIZE 20
 //size of interface name
 
+#define DV_ADDR_STR_SIZE 16
+//size of dotted-decimal network address string in DV message
+
+#define DV_ENTRY_STR_SIZE 40
+//maximum size of "addr/mask/hop\n" record in DV message
+
+#define DV_TRAILER_SIZE 8
+//size of "x<cmd>[/<cost>]" trailer in DV message including '\0'
+
+#define DV_MSG_MAX_SIZE 65000
+//maximum size of the records in one DV message; a larger routing table is advertised in several messages
+//so that the IP packet and its Ethernet frame fit in their 16-bit length fields
+
+#define DV_INDEX_SIZE 64
+//initial number of slots of a hash index of the routing or forwarding table; it doubles whenever it is half full
+
+#define DV_EVENT_LOG_SIZE 512
+//number of events kept in the event log of a router; it should be a power of 2
+
+#define DV_CHURN_WINDOW 60
+//period in seconds over which "show convergence" reports the churn rate
+
+#define DV_COST_MAX 16
+//maximum cost of a link; a link costs 1 unless it is configured or measured otherwise
+
+#define DV_METRIC_INFINITY 256
+//metric (sum of the link costs) at which a destination is unreachable
+
+#define DV_COST_QUEUE_UNIT 8192
+//bytes waiting in the socket to a hub that add 1 to the measured cost of the link
+
+#define DV_COST_RTT_UNIT 50000
+//round-trip time in microseconds to a hub that adds 1 to the measured cost of the link
+
+#define DV_ECMP_MAX_PATHS 4
+//maximum number of equal-cost next hops kept for a destination, including the primary one
+
+#define FLOW_CACHE_SIZE 256
+//number of slots of the flow cache for forwarded packets; it should be a power of 2
+
+#define DV_CHECKPOINT_MAGIC 0x54504B43
+//magic number at the head of a routing table checkpoint ("CKPT")
+
+#define DV_CHECKPOINT_VERSION 1
+//layout version of a routing table checkpoint
+
+#define DV_STALE_ROUTE_LIFETIME 3
+//number of DV advertisement periods a route restored from a checkpoint is used without being revalidated
+
 /* status of routing table entry */
 enum RTE_STATUS
 {
   RTE_DOWN = 0,
-  RTE_UP = 1
+  RTE_UP = 1,
+  RTE_STALE = 2 //restored from a checkpoint; used for forwarding but not advertised until a neighbor confirms it
+};
+
+/* kind of DV event logged by a router */
+enum DV_EVENT
+{
+  DV_EVENT_ADD = 0,           //a route to a new destination is learned
+  DV_EVENT_CHANGE = 1,        //a route gets a new next hop or hop count, or comes back up
+  DV_EVENT_WITHDRAW = 2,      //a route goes down due to a link breakage
+  DV_EVENT_EXPIRE = 3,        //a route restored from a checkpoint expires unconfirmed
+  DV_EVENT_ADVERT_SENT = 4,   //the routing table is advertised
+  DV_EVENT_ADVERT_RCVD = 5,   //an advertisement is received
+  DV_EVENT_BREAKAGE_SENT = 6, //a link breakage is reported
+  DV_EVENT_BREAKAGE_RCVD = 7  //a link breakage report is received
 };
 
 /* DV Command for DV Exchange Message */
@@ -41,16 +104,26 @@ enum DV_COMMAND
   DV_BREAKAGE = 1   //DV Link Breakage Message
 };
 
+/* additional next hop of a route, at the same metric as its primary next hop */
+typedef struct _dv_path
+{
+  in_addr_t next; //IP address of the next-hop router
+  int itf; //network interface (port) attached toward the next-hop router
+} dv_path;
+
 typedef struct _rt_table_entry
 {
   in_addr_t dest; //destination IP network address
   int mask; //subnet mask of destination IP network address
   in_addr_t next; //IP address of next-hop router toward destination network
-  int hop; //hop count from the router to the destination network
+  int hop; //metric from the router to the destination network: the sum of the link costs, i.e. the hop count when every link costs 1
   int itf; //network interface (port) attached toward network
   char itf_name[ITF_NAME_SIZE]; //interface name
   int status; //the status of the entry = {RTE_DOWN, RTE_UP}
   long time; //the last refreshed time for this entry
+  int flaps; //number of times the route went down or moved to another next hop
+  dv_path ecmp[DV_ECMP_MAX_PATHS-1]; //equal-cost next hops besides next
+  int ecmp_num; //number of entries in ecmp
 } rt_table_entry;
 
 typedef struct _net_table_entry
@@ -69,8 +142,42 @@ typedef struct _fw_table_entry
   char itf_name[ITF_NAME_SIZE]; //interface name
   int flag; //indicate whether this fw entry is valid or not; if flag = 1, the entry is valid,
             //and so the entry can be used for forwarding IP packet; otherwise, entry is invalid.
+  dv_path ecmp[DV_ECMP_MAX_PATHS-1]; //equal-cost next hops besides next; a flow takes one of them by its (src, dst) hash
+  int ecmp_num; //number of entries in ecmp
 } fw_table_entry;
 
+/* flow cache entry holding the forwarding decision for a (src, dst) pair.
+   An entry is valid only while its gen equals fw_table_gen of its router, so every change
+   of the forwarding table invalidates the whole cache by bumping the generation. */
+typedef struct _flow_cache_entry
+{
+  in_addr_t src; //source IP address
+  in_addr_t dst; //destination IP address
+  unsigned long gen; //forwarding table generation when the decision was made; 0 for an empty slot
+  int itf; //egress socket; -1 if there is no route toward dst
+  HwAddr hwdst; //MAC address of the next hop (or of dst on the attached network)
+} flow_cache_entry;
+
+/* header of a routing table checkpoint ".<router name>.rt"; dv_checkpoint_entry[entry_num] follows it */
+typedef struct _dv_checkpoint_header
+{
+  unsigned int magic; //DV_CHECKPOINT_MAGIC
+  unsigned int version; //DV_CHECKPOINT_VERSION
+  unsigned int entry_num; //number of routes
+  unsigned int pad;
+  long time; //time when the checkpoint was written
+} dv_checkpoint_header;
+
+/* route learned from a neighbor; the interface is kept by name since sockets change across restarts */
+typedef struct _dv_checkpoint_entry
+{
+  in_addr_t dest; //destination IP network address
+  int mask; //subnet mask of destination IP network address
+  in_addr_t next; //IP address of next-hop router toward destination network
+  int hop; //hop count from the router to the destination network
+  char itf_name[ITF_NAME_SIZE]; //interface name
+} dv_checkpoint_entry;
+
 typedef struct _dv_entry
 {
   in_addr_t dest; //destination IP network address
@@ -83,35 +190,161 @@ typedef struct _port_table_entry
 {
   int itf; //socket for the interface port
   char itf_name[ITF_NAME_SIZE]; //interface name
+  int cost; //configured cost of the link
+  int measured; //cost added to cost from the queue depth and RTT of the link; 0 unless measured
 } port_table_entry;
 
-char* dv_get_itf_name(int sock); //return the interface name corresponding to incoming socket (sock)
+/* route being summarized for an advertisement */
+typedef struct _dv_summary
+{
+  in_addr_t dest; //destination IP network address
+  int len; //prefix length
+  int hop; //metric of the destination
+  in_addr_t next; //next hop; only routes of the same next hop and interface are merged
+  int itf; //network interface (port) attached toward network
+  int merged; //whether the entry is a summary of several routes
+} dv_summary;
+
+/* entry of the event log of a router */
+typedef struct _dv_event
+{
+  long long time; //monotonic time in microseconds
+  int kind; //DV_EVENT_*
+  in_addr_t dest; //destination network of a route event
+  in_addr_t next; //next hop of a route event, or the neighbor sending a message
+  int hop; //hop count of a route event, or the number of entries in a message
+} dv_event;
+
+/* slot of a hash index by destination network address and mask */
+typedef struct _dv_index_slot
+{
+  in_addr_t dest; //destination IP network address
+  int mask; //subnet mask of destination IP network address
+  int entry; //index of the table entry plus 1; 0 for an empty slot
+} dv_index_slot;
+
+/* open-addressed hash index of the routing or forwarding table; the entries are never
+   removed from the tables (a lost route only goes RTE_DOWN), so neither are the slots */
+typedef struct _dv_index
+{
+  dv_index_slot* slots; //slots; a power of 2 of them
+  int size; //number of slots
+  int num; //number of indexed entries
+} dv_index;
+
+/* hot fields of the forwarding table packed for lookups. It is rebuilt from
+   fw_table whenever fw_table_gen changes, and fw_table keeps the interface
+   names and the other fields used only by dv_show_forwarding_table.
+   The entries are ordered by prefix length, so the first match is the longest one */
+typedef struct _fw_packed
+{
+  in_addr_t* dest; //destination IP network addresses
+  int* mask; //subnet masks
+  int* itf; //egress sockets
+  in_addr_t* next; //next hops
+  unsigned int* valid; //bitmap of the entries with flag 1
+  int* entry; //index of each packed entry in fw_table
+  int num; //number of packed entries, the longest prefixes first
+  int max; //number of entries allocated
+  unsigned long gen; //fw_table_gen when the entries were packed; 0 if never
+} fw_packed;
+
+/* state of a station for the IP stack and, for a router, its DV tables.
+   Every dv_* function and the IP helpers of utils.c work on the dv_router
+   given to them, so one process can run many routers (see sim.c).
+   A host uses only the addresses. */
+typedef struct _dv_router
+{
+  int kind; //STATION_HOST or STATION_ROUTER
+  HwAddr hwaddr; //MAC address
+  in_addr_t ipaddrs[ADDR_NUM]; //IP addresses in network byte-order
+  int netmasks[ADDR_NUM]; //subnet masks in network byte-order
+  int ipaddrs_num; //number of IP addresses
+  in_addr_t gwaddr; //default gateway of a host
+  in_addr_t groups[MCAST_MAX_GROUPS]; //IP multicast groups joined, in network byte-order
+  int groups_num; //number of groups joined
+
+  rt_table_entry* rt_table; //routing table
+  int rt_table_size; //size of rt_table
+  int rt_table_max; //number of entries allocated for rt_table
+
+  net_table_entry* net_table; //network address table in which a router has subnet addresses
+  int net_table_size; //size of net_table
+  in_addr_t net_keys[NET_TABLE_SIZE]; //net & mask of each net_table entry, packed for vector compares
+
+  fw_table_entry* fw_table; //forwarding table which is used for forwarding packets
+  int fw_table_size; //size of fw_table
+  int fw_table_max; //number of entries allocated for fw_table
+  fw_packed fw_packed; //fw_table packed for lookups
 
-int dv_init_tables(in_addr_t* addr, int* mask, int addr_num, int* sock); //initialize g_rt_table, g_net_table, and g_fw_table with the router's network information
+  port_table_entry* port_table; //port table
+  int port_table_size; //size of port_table
+  int measure_costs; //whether the measured costs of the links are added to their configured costs
+  int summarize; //whether sibling prefixes of the same next hop and interface are advertised as their covering prefix, with split horizon
 
-int dv_update_rt_table(int sock, in_addr_t neighbor, dv_entry* dv, int dv_entry_num); //update g_rt_table with dv entries sent by neighbor which are reachable network via the neighbor
+  dv_index rt_index; //rt_table entries by dest and mask
+  dv_index fw_index; //fw_table entries by dest and mask
+  dv_index sum_index; //prefixes merged in the last summarized advertisements; a neighbor advertising one of them is ignored
 
-int dv_update_rt_table_for_link_breakage(int sock, in_addr_t neighbor, dv_entry* dv, int dv_entry_num); //update g_rt_table with dv entry sent by neighbor which becomes unreachable network due the link breakage (e.g., hub is down)
+  dv_event* events; //event log ring
+  unsigned long events_head; //number of events logged so far; the ring keeps the last DV_EVENT_LOG_SIZE
+  unsigned long route_events; //number of route events (add, change, withdraw and expire) so far
+  long long start_time; //monotonic time when the tables were initialized
+  long long last_change; //monotonic time of the last route event; 0 if none
 
-int dv_update_fw_table(); //update forwarding table (g_fw_table) with the routing table (g_rt_table)
+  flow_cache_entry flow_cache[FLOW_CACHE_SIZE]; //flow cache of forwarding decisions
+  unsigned long fw_table_gen; //generation of fw_table; bumped whenever the forwarding table changes
+} dv_router;
 
-int dv_update_routing_info(int sock,
+char* dv_get_itf_name(dv_router* router, int sock); //return the interface name corresponding to incoming socket (sock)
+
+int dv_init_tables(dv_router* router, in_addr_t* addr, int* mask, int addr_num, int* sock); //initialize the rt_table, net_table, and fw_table of router with the router's network information
+
+void dv_index_tables(dv_router* router); //rebuild the indexes of the tables of router after they are filled in directly
+
+int dv_update_rt_table(dv_router* router, int sock, in_addr_t neighbor, dv_entry* dv, int dv_entry_num, int cost); //update rt_table with dv entries sent by neighbor which are reachable network via the neighbor over a link of cost
+
+int dv_update_rt_table_for_link_breakage(dv_router* router, int sock, in_addr_t neighbor, dv_entry* dv, int dv_entry_num); //update rt_table with dv entry sent by neighbor which becomes unreachable network due the link breakage (e.g., hub is down)
+
+int dv_update_fw_table(dv_router* router); //update forwarding table (fw_table) with the routing table (rt_table)
+
+int dv_set_link_cost(dv_router* router, int sock, int cost); //configure the cost of the link of socket sock
+
+void dv_measure_link_costs(dv_router* router); //measure the cost of every link from the queue depth and RTT of its socket if router->measure_costs is set
+
+void dv_invalidate_flow_cache(dv_router* router); //invalidate every flow cache entry after the forwarding table changes
+
+int dv_update_routing_info(dv_router* router, int sock,
  char* dat, int dat_len, in_addr_t src); //update routing table and forwarding table
 
-void dv_update_tables_for_timeout(long curtime, int myconfigint); //update the routing table and forwarding table for timeout
+void dv_update_tables_for_timeout(dv_router* router, long curtime, int myconfigint); //update the routing table and forwarding table for timeout
+
+int dv_save_checkpoint(dv_router* router, char* file); //write the learned routes that are up into the checkpoint file
+
+int dv_load_checkpoint(dv_router* router, char* file, int myconfigint); //add the routes of a checkpoint no older than DV_STALE_ROUTE_LIFETIME periods to the routing table as RTE_STALE; return the number of routes
+
+int dv_forward(dv_router* router, IPPkt* ippkt); //forward the packet to the appropriate next hop router or host
+
+void dv_show_routing_table(dv_router* router); //show routing table
+
+void dv_show_forwarding_table(dv_router* router); //show forwarding table
+
+void dv_show_link_costs(dv_router* router); //show the configured and measured cost of every link
+
+void dv_show_convergence(dv_router* router); //show the time since the last route change, the churn rate and the flapping routes
 
-int dv_forward(IPPkt* ippkt); //forward the packet to the appropriate next hop router or host
+void dv_show_events(dv_router* router); //show the event log
 
-void dv_show_routing_table(); //show routing table
+int dv_get_sock_for_destination(dv_router* router, int sock, in_addr_t src, in_addr_t dst); //return an appropriate socket for the flow from src to destination address dst with the forwarding table
 
-void dv_show_forwarding_table(); //show forwarding table
+int dv_ipaddr_to_hwaddr(dv_router* router, in_addr_t ippkt_src, in_addr_t ippkt_dst, HwAddr ethpkt_dst); //convert the dst IP address into the MAC address of the next hop of the flow from ippkt_src
 
-int dv_get_sock_for_destination(int sock, in_addr_t src, in_addr_t dst); //return an appropriate socket for destination address dst with the forwarding table
+char* dv_encode_dv_message(dv_router* router, ushort cmd, int sock, int* start, int* len); //construct a DV exchange message of the routing entries from *start on, and set *start to the first entry left out; the caller frees the returned buffer
 
-int dv_ipaddr_to_hwaddr(in_addr_t ippkt_dst, HwAddr ethpkt_dst); //convert the dst IP address into next hop's MAC address
+int dv_decode_dv_message(char* dat, int dat_len, dv_entry** dv, int* dv_entry_num, ushort* cmd, int* cost); //convert a DV exchange message into dv_entry array, command and the sender's cost of the link (0 if it is not given)
 
-int dv_broadcast_dv_message(); //broadcast the routing information with DV exchange message
+int dv_broadcast_dv_message(dv_router* router); //broadcast the routing information with DV exchange message
 
-int dv_broadcast_dv_message_for_link_breakage(); //broadcast the routing information with DV exchange message containing the network address related to the link which is broken due to a hub crash.
+int dv_broadcast_dv_message_for_link_breakage(dv_router* router, int sock); //broadcast the routing information with DV exchange message containing the network address related to the link which is broken due to a hub crash.
 
 #endif
@@ -0,0 +1,261 @@
+/*--------------------------------------------------------------------*/
+/* dvsim.c: DV convergence experiment on a synthetic topology.
+
+   usage : dvsim <routers> [line|ring|grid|random] [<configint>] [<seconds>]
+
+   It builds the topology of <routers> routers in memory: every link
+   between two routers is a LAN of its own, and host h0 (on r0) and host
+   h1 (on the last router) have stub LANs. All the stations run in one
+   process on the simulator of sim.c, with DV advertisements every
+   <configint> (2 by default) seconds of virtual time. The run ends when
+   every router has a route to every LAN, or after <seconds> (3600 by
+   default) of virtual time. h0 then sends a chat message to h1 over the
+   learned routes. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "stats.h"
+#include "topo-db.h"
+#include "sim.h"
+/*--------------------------------------------------------------------*/
+
+#define DVSIM_MAX_DEGREE (ADDR_NUM-1)
+//maximum number of links of a router; one more address is left for a stub LAN
+
+#define DVSIM_RANDOM_DEGREE 4
+//maximum number of links of a router in a random topology
+
+int g_routers; //number of routers
+int g_lans; //number of LANs including the 2 stub LANs
+int* g_link_a; //routers at both ends of each link; link k is LAN k
+int* g_link_b;
+int g_links_num;
+int g_links_max;
+
+int (*g_itfs)[ADDR_NUM]; //LANs of each router in the order of its IP addresses
+int* g_itfs_num;
+/*--------------------------------------------------------------------*/
+
+/* add a link between routers a and b unless one of them has no more ports */
+int add_link(int a, int b, int max_degree)
+{
+  if (a == b || g_itfs_num[a] >= max_degree || g_itfs_num[b] >= max_degree)
+    return(0);
+
+  if (g_links_num == g_links_max) {
+    g_links_max = g_links_max ? g_links_max * 2 : 64;
+    g_link_a = (int *) realloc(g_link_a, g_links_max * sizeof(int));
+    g_link_b = (int *) realloc(g_link_b, g_links_max * sizeof(int));
+    if (!g_link_a || !g_link_b) {
+      fprintf(stderr, "error : unable to realloc\n");
+      exit(1);
+    }
+  }
+
+  g_link_a[g_links_num] = a;
+  g_link_b[g_links_num] = b;
+  g_itfs[a][g_itfs_num[a]++] = g_links_num;
+  g_itfs[b][g_itfs_num[b]++] = g_links_num;
+  g_links_num++;
+  return(1);
+}
+
+/* connect the routers in the shape of kind */
+int make_links(char *kind)
+{
+  int side;
+  int i;
+
+  if (strcasecmp(kind, "line") == 0 || strcasecmp(kind, "ring") == 0) {
+    for (i = 0; i + 1 < g_routers; i++)
+      add_link(i, i + 1, DVSIM_MAX_DEGREE);
+    if (strcasecmp(kind, "ring") == 0 && g_routers > 2)
+      add_link(g_routers - 1, 0, DVSIM_MAX_DEGREE);
+  }
+  else if (strcasecmp(kind, "grid") == 0) {
+    for (side = 1; side * side < g_routers; side++)
+      ;
+    for (i = 0; i < g_routers; i++) {
+      if ((i + 1) % side != 0 && i + 1 < g_routers)
+        add_link(i, i + 1, DVSIM_MAX_DEGREE);
+      if (i + side < g_routers)
+        add_link(i, i + side, DVSIM_MAX_DEGREE);
+    }
+  }
+  else if (strcasecmp(kind, "random") == 0) {
+    /* a ring keeps the routers connected, and chords shorten the paths */
+    for (i = 0; i + 1 < g_routers; i++)
+      add_link(i, i + 1, DVSIM_RANDOM_DEGREE);
+    if (g_routers > 2)
+      add_link(g_routers - 1, 0, DVSIM_RANDOM_DEGREE);
+    for (i = 0; i < g_routers / 2; i++)
+      add_link(sim_random() % g_routers, sim_random() % g_routers, DVSIM_RANDOM_DEGREE);
+  }
+  else
+    return(0);
+
+  return(1);
+}
+
+/* network address of LAN k: 10.x.y.0/24 */
+in_addr_t lan_addr(int k)
+{
+  return htonl(0x0A000000 | (k << 8));
+}
+
+/* stage the MAC, IP and gateway entries of the topology and build it */
+void make_topology()
+{
+  char name[NAME_SIZE];
+  int* next_host; //next host number on each LAN
+  int mask = htonl(0xFFFFFF00); //255.255.255.0
+  HwAddr hw;
+  int i, j, k;
+
+  next_host = (int *) calloc(g_lans, sizeof(int));
+  if (!next_host) {
+    fprintf(stderr, "error : unable to calloc\n");
+    exit(1);
+  }
+
+  topo_reset_mac();
+  topo_reset_ip();
+  topo_reset_gw();
+
+  for (i = 0; i < g_routers; i++) {
+    sprintf(name, "r%d", i);
+    hw[0] = 0x02; hw[1] = 0x00;
+    hw[2] = i >> 24; hw[3] = i >> 16; hw[4] = i >> 8; hw[5] = i;
+    topo_add_mac(name, hw);
+
+    for (j = 0; j < g_itfs_num[i]; j++) {
+      k = g_itfs[i][j];
+      topo_add_ip(name, lan_addr(k) | htonl(++next_host[k]), mask);
+    }
+  }
+
+  for (k = 0; k < g_lans; k++) {
+    sprintf(name, "n%d", k);
+    topo_add_ip(name, lan_addr(k), mask);
+  }
+
+  for (i = 0; i < 2; i++) {
+    sprintf(name, "h%d", i);
+    hw[0] = 0x06; hw[1] = 0x00; hw[2] = 0; hw[3] = 0; hw[4] = 0; hw[5] = i;
+    topo_add_mac(name, hw);
+    topo_add_ip(name, lan_addr(g_links_num + i) | htonl(100), mask);
+    sprintf(name, "r%d", i == 0 ? 0 : g_routers - 1);
+    topo_add_gw(i == 0 ? "h0" : "h1", name);
+  }
+
+  topo_build();
+  free(next_host);
+}
+
+/* whether every router has a route to every LAN */
+int converged()
+{
+  return g_sim_routes >= (long) g_routers * g_lans;
+}
+
+/* main routine */
+int main(int argc, char *argv[])
+{
+  char *kind = "grid";
+  int configint = 2;
+  long seconds = 3600;
+  sim_station *h0;
+  struct timeval start, end;
+  char name[NAME_SIZE];
+  int i;
+
+  /* check usage */
+  if (argc < 2 || argc > 5 || (g_routers = atoi(argv[1])) < 2) {
+    fprintf(stderr, "usage : %s <routers> [line|ring|grid|random] [<configint>] [<seconds>]\n", argv[0]);
+    exit(1);
+  }
+  if (argc > 2)
+    kind = argv[2];
+  if (argc > 3)
+    configint = atoi(argv[3]);
+  if (argc > 4)
+    seconds = atol(argv[4]);
+  if (configint <= 0 || seconds <= 0) {
+    fprintf(stderr, "error : configint and seconds should be positive\n");
+    exit(1);
+  }
+
+  stats_init("dvsim", STATION_ROUTER);
+  sim_init();
+  gettimeofday(&start, NULL);
+
+  /* connect the routers */
+  g_itfs = calloc(g_routers, sizeof(*g_itfs));
+  g_itfs_num = (int *) calloc(g_routers, sizeof(int));
+  if (!g_itfs || !g_itfs_num) {
+    fprintf(stderr, "error : unable to calloc\n");
+    exit(1);
+  }
+  if (!make_links(kind)) {
+    fprintf(stderr, "error : unknown topology '%s'\n", kind);
+    exit(1);
+  }
+
+  /* stub LANs of h0 and h1 */
+  g_itfs[0][g_itfs_num[0]++] = g_links_num;
+  g_itfs[g_routers-1][g_itfs_num[g_routers-1]++] = g_links_num + 1;
+  g_lans = g_links_num + 2;
+  if (g_lans > 65536) {
+    fprintf(stderr, "error : %d LANs do not fit in 10.0.0.0/8\n", g_lans);
+    exit(1);
+  }
+
+  make_topology();
+
+  /* start the stations */
+  for (i = 0; i < g_lans; i++)
+    sim_add_lan();
+  for (i = 0; i < g_routers; i++) {
+    sprintf(name, "r%d", i);
+    sim_add_router(name, configint, g_itfs[i], g_itfs_num[i]);
+  }
+  h0 = sim_add_host("h0", "r0", g_links_num);
+  sprintf(name, "r%d", g_routers - 1);
+  sim_add_host("h1", name, g_links_num + 1);
+
+  printf("dvsim : %d routers and %d LANs in a %s topology, configint %d\n", g_routers, g_lans, kind, configint);
+  fflush(NULL);
+
+  /* let DV converge */
+  sim_run(seconds * 1000, converged);
+
+  gettimeofday(&end, NULL);
+  if (converged())
+    printf("converged at %.3f sec of virtual time (last route change at %.3f sec)\n",
+           g_sim_now / 1000.0, g_sim_last_change / 1000.0);
+  else
+    printf("not converged in %ld sec of virtual time: %ld of %ld routes\n",
+           seconds, g_sim_routes, (long) g_routers * g_lans);
+  printf("%lu events, %lu frames, %lu DV adverts, %lu route changes in %.3f sec of wall-clock time\n",
+         g_sim_events, g_sim_frames, g_stats->dv_adverts_sent, g_stats->route_changes,
+         (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0);
+
+  /* try the routes end to end */
+  sim_send_chat(h0, "h1", "hello-from-h0");
+  sim_run(g_sim_now + 1000, NULL);
+  if (g_sim_chats == 0) {
+    fflush(NULL);
+    fprintf(stderr, "error : h1 did not receive the message of h0 (TTL expired=%lu no route=%lu)\n",
+            g_stats->drops[DROP_TTL_EXPIRED], g_stats->drops[DROP_NO_ROUTE]);
+    return(1);
+  }
+
+  return(0);
+}
+/*--------------------------------------------------------------------*/
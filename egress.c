@@ -0,0 +1,370 @@
+/*--------------------------------------------------------------------*/
+/* egress.c: per-port egress queues of a router */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "stats.h"
+#include "egress.h"
+/*--------------------------------------------------------------------*/
+
+#define EGRESS_IP_OFFSET (2*sizeof(HwAddr) + sizeof(ushort))
+//offset of the IP header in a frame
+
+#define EGRESS_TYPE_OFFSET (EGRESS_IP_OFFSET + 2*sizeof(in_addr_t) + sizeof(ushort))
+//offset of the data type in a frame
+
+egress_port g_egress[EGRESS_MAX_PORTS]; //queues indexed by socket descriptor
+
+int g_egress_weight[] = { 1, 4, 1, 4 }; //weight of each data type: DV (unused), chat, bulk and ACK
+/*--------------------------------------------------------------------*/
+
+static egress_port* egress_port_of(int sd)
+{ //return the queues of sd, or NULL if sd has none
+  if(sd < 0 || sd >= EGRESS_MAX_PORTS)
+    return NULL;
+
+  return &g_egress[sd];
+}
+
+static void egress_push(egress_fifo* q, egress_frame* f)
+{ //append f to q
+  f->next = NULL;
+  if(q->tail)
+    q->tail->next = f;
+  else
+    q->head = f;
+  q->tail = f;
+}
+
+static egress_frame* egress_pop(egress_fifo* q)
+{ //take the first frame out of q
+  egress_frame* f = q->head;
+
+  q->head = f->next;
+  if(q->head == NULL)
+    q->tail = NULL;
+  return f;
+}
+
+static void egress_free(egress_frame* f)
+{
+  free(f->dat);
+  free(f);
+}
+
+static egress_frame* egress_next_data(egress_port* p)
+{ //take the next data frame in deficit round robin order, or NULL
+  egress_flow* flow;
+  egress_frame* f;
+  int k;
+
+  while(p->round_num > 0)
+  {
+    k = p->round[p->round_head];
+    flow = &p->flows[k];
+
+    /* a queue gets its quantum once per visit */
+    if(!p->topped)
+    {
+      flow->deficit += EGRESS_QUANTUM * flow->weight;
+      p->topped = 1;
+    }
+
+    if(flow->q.head->len <= flow->deficit)
+    {
+      f = egress_pop(&flow->q);
+      flow->deficit -= f->len;
+      p->data_bytes -= f->len;
+
+      /* an emptied queue leaves the round and loses what it did not use */
+      if(flow->q.head == NULL)
+      {
+        flow->active = 0;
+        flow->deficit = 0;
+        p->round_head = (p->round_head + 1) % EGRESS_FLOWS;
+        p->round_num--;
+        p->topped = 0;
+      }
+      return f;
+    }
+
+    /* the queue used its quantum; it goes to the back of the round */
+    p->round_head = (p->round_head + 1) % EGRESS_FLOWS;
+    p->round[(p->round_head + p->round_num - 1) % EGRESS_FLOWS] = k;
+    p->topped = 0;
+  }
+
+  return NULL;
+}
+
+static void egress_flush(egress_port* p)
+{ //drop every frame queued on p
+  int i;
+
+  if(p->cur)
+    egress_free(p->cur);
+  p->cur = NULL;
+  p->cur_off = 0;
+
+  if(p->held)
+    egress_free(p->held);
+  p->held = NULL;
+
+  while(p->ctrl.head)
+    egress_free(egress_pop(&p->ctrl));
+  for(i = 0; i < EGRESS_FLOWS; i++)
+  {
+    while(p->flows[i].q.head)
+      egress_free(egress_pop(&p->flows[i].q));
+    p->flows[i].active = 0;
+    p->flows[i].deficit = 0;
+  }
+
+  p->ctrl_bytes = 0;
+  p->data_bytes = 0;
+  p->round_head = 0;
+  p->round_num = 0;
+  p->topped = 0;
+}
+/*--------------------------------------------------------------------*/
+
+void egress_attach(int sd)
+{ //queue the frames sent on sd from now on
+  egress_port* p = egress_port_of(sd);
+
+  if(p == NULL)
+    return;
+
+  memset(p, 0, sizeof(egress_port));
+  p->attached = 1;
+}
+
+void egress_detach(int sd)
+{ //drop the frames queued on sd and write directly again
+  egress_port* p = egress_port_of(sd);
+
+  if(p == NULL || !p->attached)
+    return;
+
+  egress_flush(p);
+  p->attached = 0;
+}
+
+int egress_attached(int sd)
+{ //return 1 if the frames sent on sd are queued
+  egress_port* p = egress_port_of(sd);
+
+  return (p != NULL) && p->attached;
+}
+
+int egress_enqueue(int sd, char* dat, int len)
+{ //queue the frame dat (malloc'd; the queue frees it) and write what the socket takes; return 0 if it is dropped
+  egress_port* p = egress_port_of(sd);
+  egress_frame* f;
+  egress_flow* flow;
+  u_char type = DATA_CHAT;
+  unsigned int h = 2166136261U; //FNV-1a over destination, source and type
+  int i, k;
+
+  if(len > EGRESS_TYPE_OFFSET)
+    type = dat[EGRESS_TYPE_OFFSET];
+
+  /* tail drop when the queue of the class is full */
+  if((type == DATA_DV && p->ctrl_bytes + len > EGRESS_CTRL_LIMIT) ||
+     (type != DATA_DV && p->data_bytes + len > EGRESS_DATA_LIMIT))
+  {
+    p->drops++;
+    g_stats->drops[DROP_QUEUE_FULL]++;
+    free(dat);
+    return 0;
+  }
+
+  f = (egress_frame *) malloc(sizeof(egress_frame));
+  if (!f) {
+    fprintf(stderr, "error : unable to malloc\n");
+    exit(1);
+  }
+  f->len = len;
+  f->dat = dat;
+  g_stats->allocs++;
+
+  if(type == DATA_DV)
+  {
+    egress_push(&p->ctrl, f);
+    p->ctrl_bytes += len;
+  }
+  else
+  {
+    for(i = 0; i < 2*sizeof(in_addr_t) && EGRESS_IP_OFFSET + i < len; i++)
+    {
+      h ^= (u_char) dat[EGRESS_IP_OFFSET + i];
+      h *= 16777619U;
+    }
+    h ^= type;
+    h *= 16777619U;
+    k = h % EGRESS_FLOWS;
+    flow = &p->flows[k];
+
+    egress_push(&flow->q, f);
+    flow->weight = (type < sizeof(g_egress_weight)/sizeof(int)) ? g_egress_weight[type] : 1;
+    p->data_bytes += len;
+    if(!flow->active)
+    {
+      flow->active = 1;
+      flow->deficit = 0;
+      p->round[(p->round_head + p->round_num) % EGRESS_FLOWS] = k;
+      p->round_num++;
+    }
+  }
+
+  egress_drain(sd);
+  return 1;
+}
+
+int egress_drain(int sd)
+{ //write the queued frames until the socket would block; return -1 if the socket failed
+  egress_port* p = egress_port_of(sd);
+  int n;
+
+  if(p == NULL || !p->attached)
+    return 0;
+
+  while(1)
+  {
+    /* a frame started is finished first, then DV frames go before any data frame */
+    if(p->cur == NULL)
+    {
+      if(p->ctrl.head)
+      {
+        p->cur = egress_pop(&p->ctrl);
+        p->ctrl_bytes -= p->cur->len;
+      }
+      else
+      {
+        if(p->held == NULL)
+        {
+          p->held = egress_next_data(p);
+          p->held_late = 0;
+          if(p->held == NULL)
+            return 0;
+        }
+
+        /* the shaper lets the data frame go once its tokens are there */
+        if(p->shaper.rate > 0 && tb_delay(&p->shaper, p->held->len) > 0)
+        {
+          if(!p->held_late)
+          {
+            p->shaper.exceed_frames++;
+            p->shaper.exceed_bytes += p->held->len;
+            p->held_late = 1;
+          }
+          return 0;
+        }
+        if(p->shaper.rate > 0)
+        {
+          p->shaper.tokens -= p->held->len;
+          if(!p->held_late)
+          {
+            p->shaper.conform_frames++;
+            p->shaper.conform_bytes += p->held->len;
+          }
+        }
+
+        p->cur = p->held;
+        p->held = NULL;
+      }
+      p->cur_off = 0;
+    }
+
+    n = send(sd, p->cur->dat + p->cur_off, p->cur->len - p->cur_off, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if(n == -1)
+    {
+      if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return 0;
+
+      /* the hub is gone; the reader finds it out and closes the socket */
+      perror("egress_drain(): send() error");
+      egress_flush(p);
+      return -1;
+    }
+
+    p->cur_off += n;
+    if(p->cur_off < p->cur->len)
+      continue;
+
+    if(p->cur->len > EGRESS_TYPE_OFFSET && p->cur->dat[EGRESS_TYPE_OFFSET] == DATA_DV)
+      p->ctrl_sent++;
+    else
+      p->data_sent++;
+    STATS_PORT(sd)->tx_frames++;
+    STATS_PORT(sd)->tx_bytes += p->cur->len;
+
+    egress_free(p->cur);
+    p->cur = NULL;
+  }
+}
+
+int egress_pending(int sd)
+{ //return the number of bytes queued on sd
+  egress_port* p = egress_port_of(sd);
+
+  if(p == NULL || !p->attached)
+    return 0;
+
+  return p->ctrl_bytes + p->data_bytes + (p->cur ? p->cur->len - p->cur_off : 0) + (p->held ? p->held->len : 0);
+}
+
+long long egress_wait(int sd)
+{ //microseconds until sd has a frame to write: 0 now, -1 if nothing is queued
+  egress_port* p = egress_port_of(sd);
+
+  if(p == NULL || !p->attached)
+    return -1;
+
+  if(p->cur || p->ctrl.head)
+    return 0;
+  if(p->held)
+    return tb_delay(&p->shaper, p->held->len);
+  return p->data_bytes > 0 ? 0 : -1;
+}
+
+void egress_set_shaper(int sd, long rate, long burst)
+{ //shape the data frames sent on sd; rate 0 turns the shaper off
+  egress_port* p = egress_port_of(sd);
+
+  if(p == NULL || !p->attached)
+    return;
+
+  tb_set(&p->shaper, rate, burst);
+}
+
+void egress_show()
+{ //show the queues of the attached ports
+  egress_port* p;
+  int i;
+
+  printf("EGRESS QUEUES\n");
+  printf("  Port | Queued DV | Queued data | Active flows | DV sent | Data sent | Drops | Shaper (kbit/s) | Delayed frames\n");
+  for(i = 0; i < EGRESS_MAX_PORTS; i++)
+  {
+    p = &g_egress[i];
+    if(!p->attached)
+      continue;
+
+    printf("  %4d | %d | %d | %d | %lu | %lu | %lu | ", i, p->ctrl_bytes, p->data_bytes + (p->held ? p->held->len : 0),
+           p->round_num, p->ctrl_sent, p->data_sent, p->drops);
+    if(p->shaper.rate > 0)
+      printf("%ld/%ld | %lu\n", p->shaper.rate * 8 / 1000, p->shaper.burst, p->shaper.exceed_frames);
+    else
+      printf("off | -\n");
+  }
+  fflush(NULL);
+}
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,101 @@
+/*--------------------------------------------------------------------*/
+/* egress.h: per-port egress queues of a router.
+
+   A frame sent on an attached socket is queued instead of being written
+   with a blocking write(), and the event loop writes the queues out as
+   the hub takes them. DV frames have a queue of their own that is served
+   before anything else (strict priority), so adverts keep flowing while
+   the data queues are full. The other frames are spread by flow (source,
+   destination and data type) over EGRESS_FLOWS queues served by deficit
+   round robin: each backlogged flow may send EGRESS_QUANTUM bytes times
+   the weight of its data type per round, so one bulk transfer cannot
+   starve chat messages or the ACKs of other transfers. A port may also
+   have a shaper (see token-bucket.h) that holds the data frames until
+   its tokens are there; DV frames are not held. */
+
+#ifndef __EGRESS_H__
+#define __EGRESS_H__
+
+#include "common.h"
+#include "token-bucket.h"
+
+#define EGRESS_MAX_PORTS 64
+//queues are kept per socket descriptor; frames on larger descriptors are written directly
+
+#define EGRESS_FLOWS 16
+//data queues of a port; flows are hashed onto them
+
+#define EGRESS_QUANTUM 1500
+//bytes a data queue of weight 1 may send per round
+
+#define EGRESS_DATA_LIMIT (256*1024)
+//bytes of data frames queued on a port before new ones are dropped
+
+#define EGRESS_CTRL_LIMIT (64*1024)
+//bytes of DV frames queued on a port before new ones are dropped
+
+/* queued frame */
+typedef struct _egress_frame
+{
+  struct _egress_frame* next; //next frame of the queue
+  int len; //length of dat
+  char* dat; //frame as written on the socket
+} egress_frame;
+
+/* FIFO of frames */
+typedef struct _egress_fifo
+{
+  egress_frame* head;
+  egress_frame* tail;
+} egress_fifo;
+
+/* data queue served by deficit round robin */
+typedef struct _egress_flow
+{
+  egress_fifo q; //queued frames
+  int deficit; //bytes the queue may still send in this round
+  int weight; //weight of the data type of the last frame queued
+  int active; //whether the queue is in the round
+} egress_flow;
+
+/* egress queues of a port */
+typedef struct _egress_port
+{
+  int attached; //whether frames sent on the port are queued
+  egress_frame* cur; //frame being written; it is finished before any other
+  int cur_off; //bytes of cur already written
+  egress_fifo ctrl; //DV frames
+  int ctrl_bytes; //bytes queued in ctrl
+  egress_flow flows[EGRESS_FLOWS]; //data frames
+  int data_bytes; //bytes queued in flows
+  int round[EGRESS_FLOWS]; //ring of the active data queues in the order they are served
+  int round_head; //index in round of the queue being served
+  int round_num; //number of active data queues
+  int topped; //whether the queue being served got its quantum for this visit
+  token_bucket shaper; //shaper of the data frames; off unless set
+  egress_frame* held; //data frame taken from the flows and waiting for the tokens of the shaper
+  int held_late; //whether held has already been counted as exceeding the shaper
+  unsigned long ctrl_sent; //DV frames written
+  unsigned long data_sent; //data frames written
+  unsigned long drops; //frames dropped because the queue was full
+} egress_port;
+
+void egress_attach(int sd); //queue the frames sent on sd from now on
+
+void egress_detach(int sd); //drop the frames queued on sd and write directly again
+
+int egress_attached(int sd); //return 1 if the frames sent on sd are queued
+
+int egress_enqueue(int sd, char* dat, int len); //queue the frame dat (malloc'd; the queue frees it) and write what the socket takes; return 0 if it is dropped
+
+int egress_drain(int sd); //write the queued frames until the socket would block; return -1 if the socket failed
+
+int egress_pending(int sd); //return the number of bytes queued on sd
+
+long long egress_wait(int sd); //microseconds until sd has a frame to write: 0 now, -1 if nothing is queued
+
+void egress_set_shaper(int sd, long rate, long burst); //shape the data frames sent on sd; rate 0 turns the shaper off
+
+void egress_show(); //show the queues of the attached ports
+
+#endif
@@ -1,10 +1,15 @@
 /*--------------------------------------------------------------------*/
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/time.h>
 #include <string.h>
 #include <strings.h>
 #include <netinet/in.h>
 #include "common.h"
+#include "dist-vec.h"
+#include "stats.h"
+#include "trace.h"
+#include "topo-db.h"
 
 /* my DNS name */
 char myname[NAME_SIZE];
@@ -22,20 +27,53 @@ int mynetmask;
 /* my default gateway */
 in_addr_t mygwaddr;
 
+/* DNS name of my default gateway */
+char mygwname[NAME_SIZE];
+
 /* socket to hub */
 int sd = -1;
+
+/* descriptor watching the topology files */
+int topofd = -1;
+
+/* my addresses for the IP stack */
+dv_router myhost;
 /*--------------------------------------------------------------------*/
 
 void print_menu()
 {
   printf("#############################################\n");
+  printf("show stats       : show statistics\n");
+  printf("trace dump file  : write packet trace into file in pcapng format\n");
   printf("hostname message : send a message to the host\n");
+  printf("bulk hostname n  : send n bytes of test data to the host as a bulk transfer\n");
+  printf("bulkfile hostname file : send a file to the host as a bulk transfer\n");
   printf("help             : print the menu\n");
   printf("#############################################\n");
   fflush(NULL);
 }
 
 /*--------------------------------------------------------------------*/
+/* report a bulk transfer sent by this host that completed or was given up */
+void report_bulk(BulkTx* tx)
+{
+  char name[NAME_SIZE];
+  double secs = (tx->end - tx->start) / 1000000.0;
+
+  ipaddrtoname(tx->dst, name);
+  if(tx->state == BULK_DONE)
+  {
+    printf("bulk %u to %s : %u bytes acknowledged in %.3f sec", tx->id, name, tx->total, secs);
+    if(secs > 0)
+      printf(", goodput %.1f kbit/s", tx->total * 8 / secs / 1000);
+    printf(", %lu retransmissions, srtt %.3f ms\n", tx->retransmits, tx->srtt / 1000.0);
+  }
+  else
+    printf("bulk %u to %s : given up after %lu retransmissions, %u of %u segments acknowledged\n",
+           tx->id, name, tx->retransmits, tx->base, tx->segs);
+  fflush(NULL);
+}
+
 /* process packet data */
 int processdata(char* dat, int len, int type, in_addr_t src_addr)
 {
@@ -53,10 +91,114 @@ int processdata(char* dat, int len, int type, in_addr_t src_addr)
     /** the memory should be freed */
     free(dat);
   }
+  else if(type == DATA_BULK)
+  {
+    char name[NAME_SIZE];
+    BulkRx* rx;
+    double secs;
+
+    /* acknowledge the segment and report the transfer when its last segment is in */
+    rx = recv_bulk_segment(&myhost, sd, src_addr, len, dat);
+    if(rx != NULL)
+    {
+      ipaddrtoname(src_addr, name);
+      secs = (rx->last - rx->start) / 1000000.0;
+      printf("%s : bulk %u of %u bytes in %.3f sec", name, rx->id, rx->total, secs);
+      if(secs > 0)
+        printf(", goodput %.1f kbit/s", rx->total * 8 / secs / 1000);
+      printf(" (checksum %08x)\n", bulk_checksum(rx->buf, rx->total));
+      fflush(NULL);
+    }
+
+    free(dat);
+  }
+  else if(type == DATA_ACK)
+  {
+    BulkTx* tx;
+
+    /* the ACK slides the window of the transfer; report it when everything is acknowledged */
+    tx = recv_bulk_ack(&myhost, src_addr, len, dat);
+    if(tx != NULL)
+      report_bulk(tx);
+
+    free(dat);
+  }
 
   return(1);
 }
 
+/* send test data of the given length or the contents of a file as a bulk transfer */
+int processbulk(char *text, int isfile)
+{
+  char* destname;
+  char* dat;
+  long len;
+  unsigned int id;
+  FILE* fp;
+
+  /* figure out the dest host */
+  destname = text;
+  text = index(text, ' ');
+  if (text == NULL) {
+    fprintf(stderr, "error: bulk transfer undecipherable\n");
+    return(0);
+  }
+  *text = '\0';
+  text++;
+
+  if (isfile) {
+    if ((fp = fopen(text, "r")) == NULL) {
+      perror(text);
+      return(0);
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+  }
+  else {
+    fp = NULL;
+    len = atol(text);
+  }
+
+  if (len <= 0 || len > BULK_MAX_SIZE) {
+    fprintf(stderr, "error: the length of a bulk transfer should be 1 to %d bytes\n", BULK_MAX_SIZE);
+    if (fp)
+      fclose(fp);
+    return(0);
+  }
+
+  dat = (char *) malloc(len);
+  if (!dat) {
+    fprintf(stderr, "error : unable to malloc\n");
+    exit(1);
+  }
+
+  if (fp) {
+    if (fread(dat, 1, len, fp) != len) {
+      perror(text);
+      fclose(fp);
+      free(dat);
+      return(0);
+    }
+    fclose(fp);
+  }
+  else {
+    long i;
+    for (i = 0; i < len; i++)
+      dat[i] = (char) i;
+  }
+
+  /* send user data to IP layer in segments */
+  id = send_bulk_message(&myhost, sd, destname, len, dat);
+  if (id != 0)
+    printf("bulk %u to %s : sending %ld bytes in %ld segments (checksum %08x)\n", id, destname, len,
+           (len + BULK_SEG_SIZE - 1) / BULK_SEG_SIZE, bulk_checksum(dat, len));
+  fflush(NULL);
+
+  free(dat);
+  return(id != 0);
+}
+
 /* process the keyboard input */
 int processtext(char *text)
 {
@@ -79,13 +221,53 @@ int processtext(char *text)
   type = DATA_CHAT;
 
   /* send user data to IP layer */
-  send_app_message(sd, destname, len, type, text);
+  send_app_message(&myhost, sd, destname, len, type, text);
 
   return(1);
 }
 
-/*--------------------------------------------------------------------*/
+/* note my addresses found in the tables; the old ones are kept on failure */
+int note_my_addrinfo()
+{
+  HwAddr hwaddr;
+  in_addr_t ipaddr;
+  int netmask;
+  in_addr_t gwaddr;
 
+  /* note my own MAC address */
+  if (!nametohwaddr(myname, hwaddr)) {
+    fprintf(stderr, "error : unable to identify my MAC address\n");
+    return(0);
+  }
+
+  /* note my own IP address */
+  if (!nametoipaddr(myname, &ipaddr)) {
+    fprintf(stderr, "error : unable to identify my IP address\n");
+    return(0);
+  }
+
+  /* note my own subnet mask */
+  if (!nametonetmask(myname, &netmask)) {
+    fprintf(stderr, "error : unable to identify my subnet mask\n");
+    return(0);
+  }
+  
+  /* note my own default gateway IP address */
+  if (!nametogwaddr(mygwname, ipaddr, netmask, &gwaddr)) {
+    fprintf(stderr, "error : unable to identify my default gateway address\n");
+    return(0);
+  }
+
+  hwaddrcpy(myhwaddr, hwaddr);
+  myipaddr = ipaddr;
+  mynetmask = netmask;
+  mygwaddr = gwaddr;
+
+  /* register my address information with myhost for checking if the received packet is mine or not and for sending my packet to the specified destination */
+  set_host_addrinfo(&myhost, myhwaddr, myipaddr, mynetmask, mygwaddr);
+
+  return(1);
+}
 
 /*--------------------------------------------------------------------*/
 int main(int argc, char *argv[])
@@ -99,6 +281,10 @@ int main(int argc, char *argv[])
   /* print menu */
   print_menu();
 
+  /* set up statistics shared with external tools */
+  stats_init(argv[1], STATION_HOST);
+  stats_export();
+
   /* set station kind */
   set_station_kind(STATION_HOST);
 
@@ -118,52 +304,59 @@ int main(int argc, char *argv[])
   if (!init_gw_table(GW_FILE))
     exit(1);
 
-  /* note my DNS name */
+  /* note my DNS name and my default gateway's */
   strcpy(myname, argv[1]);
+  strcpy(mygwname, argv[3]);
 
-  /* note my own MAC address */
-  if (!nametohwaddr(argv[1], myhwaddr)) {
-    fprintf(stderr, "error : unable to identify my MAC address\n");
+  /* note my own addresses */
+  if (!note_my_addrinfo())
     exit(1);
-  }
 
-  /* note my own IP address */
-  if (!nametoipaddr(argv[1], &myipaddr)) {
-    fprintf(stderr, "error : unable to identify my IP address\n");
-    exit(1);
-  }
-
-  /* note my own subnet mask */
-  if (!nametonetmask(argv[1], &mynetmask)) {
-    fprintf(stderr, "error : unable to identify my subnet mask\n");
-    exit(1);
-  }
-  
-  /* note my own default gateway IP address */
-  if (!nametogwaddr(argv[3], myipaddr, mynetmask, &mygwaddr)) {
-    fprintf(stderr, "error : unable to identify my default gateway address\n");
-    exit(1);
-  }
-
-  /* register my address information with g_myhwaddr and g_myipaddrs for checking if the received packet is mine or not and for sending my packet to the specified destination */
-  set_host_addrinfo(myhwaddr, myipaddr, mynetmask, mygwaddr);
+  /* watch the topology files to reload the tables when they change */
+  topofd = topo_watch();
 
   /* keep moving packets around */
   while (1) {
     fd_set readset;
+    struct timeval tv;
+    long long wait;
+    BulkTx* tx;
 
-    /* watch stdin and socket */
+    /* watch stdin, socket and topology files */
     FD_ZERO(&readset);
     FD_SET(0,  &readset);
     
     if(sd != -1)
       FD_SET(sd, &readset);
 
-    if (select(sd+1, &readset, NULL, NULL, NULL) == -1) {
+    if(topofd != -1)
+      FD_SET(topofd, &readset);
+
+    /* wake up for the retransmission timer of the bulk transfers */
+    wait = bulk_timer_wait();
+    tv.tv_sec = wait / 1000000;
+    tv.tv_usec = wait % 1000000;
+
+    if (select((sd > topofd ? sd : topofd)+1, &readset, NULL, NULL, wait == -1 ? NULL : &tv) == -1) {
       perror("select");
       exit(1);
     }
 
+    /* retransmit the bulk segments timed out and report the transfers given up */
+    while ((tx = check_bulk_timers(&myhost)) != NULL)
+      report_bulk(tx);
+
+    /* any change of the topology files? */
+    if (topofd != -1 && FD_ISSET(topofd, &readset) && topo_watch_changed(topofd)) {
+      if (!reload_tables())
+        printf("admin: the topology files cannot be read, so the current tables are kept\n");
+      else if (!note_my_addrinfo())
+        printf("admin: the topology is reloaded, but my addresses are kept\n");
+      else
+        printf("admin: the topology is reloaded\n");
+      fflush(NULL);
+    }
+
     /* any keyboard input? */
     if (FD_ISSET(0, &readset)) {
       char bufr[MAXSTRING];
@@ -176,6 +369,14 @@ int main(int argc, char *argv[])
       /** FILL IN YOUR CODE: show routing table and forwarding table */
       if(strcasecmp(bufr, "help") == 0)
 	print_menu();
+      else if(strcasecmp(bufr, "show stats") == 0)
+        stats_show();
+      else if(strncasecmp(bufr, "trace dump ", 11) == 0)
+        trace_dump(bufr + 11);
+      else if(strncasecmp(bufr, "bulk ", 5) == 0)
+        processbulk(bufr + 5, 0);
+      else if(strncasecmp(bufr, "bulkfile ", 9) == 0)
+        processbulk(bufr + 9, 1);
       else
         processtext(bufr);
     }
@@ -186,11 +387,11 @@ int main(int argc, char *argv[])
       ushort len; //data length //@ it should be "ushort", not "int" in order to match with "len" field in IP header 
 
       char* dat = NULL; //payload of the received packet
-      u_char type; //data type = {DATA_DV, DATA_CHAT}
+      u_char type; //data type = {DATA_DV, DATA_CHAT, DATA_BULK, DATA_ACK}
 
       set_hub_up(); //set the hub related to socket sd to HUB_UP. After calling recvmessage(), if hub_status() returns HUB_DOWN, it means that the hub related to socket sd is down. So we need to close sd.      
 
-      dat = (char*) recvmessage(sd, &src_addr, &len, &type);
+      dat = (char*) recvmessage(&myhost, sd, &src_addr, &len, &type);
       /* NOTE: the compiler complains if there is no type casting like above */
 
       if (dat == NULL && (hub_status() == HUB_DOWN)) {
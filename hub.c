@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/types.h> 
 #include <sys/socket.h> 
 #include <netinet/in.h> 
@@ -14,12 +15,35 @@
 #include <signal.h>
 
 #include "common.h"
+#include "stats.h"
+#include "trace.h"
+#include "mac-learn.h"
+#include "token-bucket.h"
 /*--------------------------------------------------------------------*/
 
 /*--------------------------------------------------------------------*/
 
 char *mylan;
 
+int switch_mode; //whether frames are switched by learned MAC addresses instead of flooded
+mac_learn_table mactable; //MAC learning table in switch mode
+mcast_table groups; //members of the multicast groups, learned from their reports
+
+long police_rate; //policer of every station in bytes per second; 0 if off
+long police_burst; //depth of the policer in bytes
+
+/* police every station connected now and later with rate and burst */
+void set_police(long rate, long burst, fd_set *livesdset, int livesdmax, int servsock)
+{
+  int sd;
+
+  police_rate = rate;
+  police_burst = burst;
+  for (sd = 3; sd <= livesdmax; sd++)
+    if (sd != servsock && FD_ISSET(sd, livesdset))
+      police_set(sd, rate, burst);
+}
+
 /* clean up before exit */
 void cleanup()
 {
@@ -42,9 +66,25 @@ main(int argc, char *argv[])
   fd_set livesdset;
   int    livesdmax;
 
+  int    argi;
+
   /* check usage */
-  if (argc != 2) {
-    fprintf(stderr, "usage : %s <my lan name>\n", argv[0]);
+  for (argi = 2; argi < argc; argi++) {
+    if (strcasecmp(argv[argi], "switch") == 0) {
+      switch_mode = 1;
+      mac_learn_init(&mactable);
+    } else if (strcasecmp(argv[argi], "police") == 0 && argi + 2 < argc) {
+      char police[MAXSTRING];
+
+      snprintf(police, sizeof(police), "%s %s", argv[argi+1], argv[argi+2]);
+      if (!tb_parse(police, &police_rate, &police_burst))
+        break;
+      argi += 2;
+    } else
+      break;
+  }
+  if (argc < 2 || argi < argc) {
+    fprintf(stderr, "usage : %s <my lan name> [switch] [police <kbit/s> <burst bytes>]\n", argv[0]);
     exit(1);
   }
 
@@ -52,6 +92,11 @@ main(int argc, char *argv[])
   set_station_kind(STATION_HUB);
 
   mylan = strdup(argv[1]);
+  mcast_init(&groups);
+
+  /* set up statistics shared with external tools */
+  stats_init(mylan, STATION_HUB);
+  stats_export();
 
   /* setup signal handlers to clean up */
   signal(SIGTERM, cleanup);
@@ -82,6 +127,34 @@ main(int argc, char *argv[])
       exit(1);
     }
 
+    /* any keyboard input? */
+    if (FD_ISSET(0, &readset)) {
+      char bufr[MAXSTRING];
+
+      if (fgets(bufr, MAXSTRING, stdin) == NULL) {
+	/* no more watching the closed stdin */
+	FD_CLR(0, &livesdset);
+      } else {
+	bufr[strcspn(bufr, "\n")] = '\0';
+	if (strcasecmp(bufr, "show stats") == 0)
+	  stats_show();
+	else if (strncasecmp(bufr, "trace dump ", 11) == 0)
+	  trace_dump(bufr + 11);
+	else if (strcasecmp(bufr, "show police") == 0)
+	  police_show();
+	else if (strcasecmp(bufr, "show groups") == 0)
+	  mcast_show(&groups, getcurtime());
+	else if (strncasecmp(bufr, "set police ", 11) == 0) {
+	  long rate, burst;
+
+	  if (tb_parse(bufr + 11, &rate, &burst))
+	    set_police(rate, burst, &livesdset, livesdmax, servsock);
+	  else
+	    printf("usage : set police <kbit/s> <burst bytes>|off (burst of %d bytes at least)\n", BUF_SIZE);
+	}
+      }
+    }
+
     /* figure out the request and serve it */
     for (frsock=3; frsock <= livesdmax; frsock++) {
 
@@ -113,15 +186,56 @@ main(int argc, char *argv[])
 	  /* no more watching this sock */
 	  close(frsock);
 	  FD_CLR(frsock, &livesdset);
+	  police_reset(frsock);
+	  mcast_forget_sock(&groups, frsock);
+	  if (switch_mode)
+	    mac_learn_forget_sock(&mactable, frsock);
+
+	} else if (!ethpkt_is_control(pkt) &&
+		   !police_frame(frsock, 2*sizeof(HwAddr) + sizeof(ushort) + pkt->len)) {
+	  /* the station sends faster than its policer allows; DV messages and membership reports pass */
+	  g_stats->drops[DROP_POLICED]++;
+	  trace_ethpkt(TRACE_DROP, DROP_POLICED, frsock, pkt);
+	  freeethpkt(pkt);
+
+	} else if (mcast_snoop(&groups, pkt, frsock, getcurtime())) {
+	  /* a membership report is taken by the hub */
+	  freeethpkt(pkt);
 
 	} else {
-	  /* send the pkt to all others */
-	  for (tosock=3; tosock <= livesdmax; tosock++) {
-	    /* skip server socket and sender socket */
-	    if (tosock == servsock || tosock == frsock) continue;
+	  long curtime = getcurtime();
+	  int members[MCAST_MAX_MEMBERS];
+	  int members_num = 0;
+	  int i;
+
+	  tosock = -1;
+	  if (switch_mode) {
+	    /* learn the sender and look up the port of the receiver */
+	    mac_learn_update(&mactable, pkt->src, frsock, curtime);
+	    if (!hwaddr_is_group(pkt->dst))
+	      tosock = mac_learn_lookup(&mactable, pkt->dst, curtime);
+	  }
+	  if (hwaddr_is_group(pkt->dst))
+	    members_num = mcast_members(&groups, pkt->dst, members, curtime);
+
+	  if (tosock != -1) {
+	    /* send the pkt only to the learned port unless it came from there */
+	    if (tosock != frsock && FD_ISSET(tosock, &livesdset))
+	      forwardethpkt(tosock, pkt);
+	  } else if (members_num > 0) {
+	    /* send the pkt only to the members of its group */
+	    for (i = 0; i < members_num; i++)
+	      if (members[i] != frsock && FD_ISSET(members[i], &livesdset))
+		forwardethpkt(members[i], pkt);
+	  } else {
+	    /* send the pkt to all others */
+	    for (tosock=3; tosock <= livesdmax; tosock++) {
+	      /* skip server socket and sender socket */
+	      if (tosock == servsock || tosock == frsock) continue;
 
-	    if (FD_ISSET(tosock, &livesdset))
+	      if (FD_ISSET(tosock, &livesdset))
 		forwardethpkt(tosock, pkt);
+	    }
 	  }
 
 #ifdef _DEBUG
@@ -150,6 +264,7 @@ main(int argc, char *argv[])
 		
 	/* include this in the active sd set */
 	FD_SET(csd, &livesdset);
+	police_set(csd, police_rate, police_burst);
 	if (csd > livesdmax)
 	  livesdmax = csd;
 
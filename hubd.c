@@ -0,0 +1,639 @@
+/*--------------------------------------------------------------------*/
+/* hubd.c: many hubs in one process
+
+   hubd serves every LAN given on its command line with one epoll loop.
+   Each LAN still has its own listening socket and ".<lan>.info" link, so
+   hosts and routers connect to it as they do to a hub. Frames are relayed
+   as they arrive on the wire, without being parsed into EthPkt, through
+   buffers taken from one pool shared by all the LANs. Station sockets are
+   non-blocking: what a station cannot take at once waits on its own output
+   queue, so a station that stops reading never holds up the others. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include "common.h"
+#include "stats.h"
+#include "trace.h"
+#include "mac-learn.h"
+#include "token-bucket.h"
+/*--------------------------------------------------------------------*/
+
+#define HUBD_HDR_SIZE (2*sizeof(HwAddr) + sizeof(ushort))
+//size of the frame header on the wire: dst, src and len
+
+#define HUBD_FRAME_SIZE (HUBD_HDR_SIZE + ETH_MAX_PAYLOAD)
+//size of a pool buffer, which holds the largest frame
+
+#define HUBD_EVENTS 64
+//number of events taken from epoll at once
+
+#define HUBD_MAX_STATIONS 256
+//maximum number of stations on a LAN
+
+#define HUBD_OUT_LIMIT (256*1024)
+//bytes queued for a station before further frames to it are dropped
+
+/* LAN served by hubd */
+typedef struct _hubd_lan
+{
+  char *name; //LAN name
+  int servsock; //listening socket of the LAN
+  mac_learn_table mactable; //MAC learning table in switch mode
+  mcast_table groups; //members of the multicast groups, learned from their reports
+} hubd_lan;
+
+/* frame waiting on the output queue of a station */
+typedef struct _hubd_out
+{
+  struct _hubd_out *next;
+  int len; //length of dat
+  char dat[1]; //rest of the frame as written on the socket
+} hubd_out;
+
+/* station connected to a LAN */
+typedef struct _hubd_conn
+{
+  int lan; //index of the LAN in g_lans
+  char *frame; //pool buffer of the frame being received; NULL between frames
+  int have; //number of bytes of the frame received so far
+  hubd_out *out_head, *out_tail; //frames the station has not taken yet
+  int out_sent; //bytes of out_head already written
+  int out_bytes; //bytes on the output queue
+} hubd_conn;
+
+/* pool buffer on the free list */
+typedef struct _hubd_buf
+{
+  struct _hubd_buf *next;
+} hubd_buf;
+
+hubd_lan *g_lans; //LANs served
+int g_lans_num; //number of LANs
+
+hubd_conn **g_conns; //connected stations indexed by socket descriptor; NULL for other descriptors
+int g_conns_size; //number of slots of g_conns
+
+int *g_lan_socks; //sockets of the stations on each LAN, g_lan_socks_num[lan] of them at g_lan_socks[lan*HUBD_MAX_STATIONS]
+int *g_lan_socks_num;
+
+hubd_buf *g_pool; //free buffers of the shared frame pool
+int g_pool_size; //number of buffers allocated for the pool
+
+int switch_mode; //whether frames are switched by learned MAC addresses instead of flooded
+
+long police_rate; //policer of every station in bytes per second; 0 if off
+long police_burst; //depth of the policer in bytes
+
+#ifdef __linux__
+int g_epfd; //epoll instance
+#endif
+/*--------------------------------------------------------------------*/
+
+/* clean up before exit */
+void cleanup()
+{
+  char linkname[MAXSTRING];
+  int i;
+
+  /* unlink the links */
+  for (i = 0; i < g_lans_num; i++) {
+    sprintf(linkname, ".%s.info", g_lans[i].name);
+    unlink(linkname);
+  }
+
+  exit(0);
+}
+
+/* take a frame buffer from the shared pool */
+char *pool_get()
+{
+  hubd_buf *buf;
+
+  if (g_pool == NULL) {
+    buf = (hubd_buf *) malloc(HUBD_FRAME_SIZE);
+    if (!buf) {
+      fprintf(stderr, "error : unable to malloc\n");
+      exit(1);
+    }
+    g_stats->allocs++;
+    g_pool_size++;
+    return((char *) buf);
+  }
+
+  buf = g_pool;
+  g_pool = buf->next;
+  return((char *) buf);
+}
+
+/* return a frame buffer to the shared pool */
+void pool_put(char *frame)
+{
+  hubd_buf *buf = (hubd_buf *) frame;
+
+  buf->next = g_pool;
+  g_pool = buf;
+}
+
+/* watch sd for input */
+int watch_sock(int sd)
+{
+#ifdef __linux__
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.fd = sd;
+  if (epoll_ctl(g_epfd, EPOLL_CTL_ADD, sd, &ev) == -1) {
+    perror("epoll_ctl");
+    return(0);
+  }
+#endif
+  return(1);
+}
+
+/* watch sd for output as well as input while frames wait for it */
+void watch_output(int sd, int on)
+{
+#ifdef __linux__
+  struct epoll_event ev;
+
+  ev.events = on ? EPOLLIN | EPOLLOUT : EPOLLIN;
+  ev.data.fd = sd;
+  if (epoll_ctl(g_epfd, EPOLL_CTL_MOD, sd, &ev) == -1)
+    perror("epoll_ctl");
+#endif
+}
+
+/* accept a station on a LAN */
+void accept_conn(int lan)
+{
+  struct sockaddr_in caddr;
+  socklen_t caddrlen;
+  int csd;
+  int *socks;
+
+  /* accept a connection request */
+  caddrlen = sizeof(caddr);
+  csd = accept(g_lans[lan].servsock, (struct sockaddr *) &caddr, &caddrlen);
+  if (csd == -1) {
+    perror("accept");
+    return;
+  }
+
+  /* a station is never waited for, neither on read nor on write */
+  if (fcntl(csd, F_SETFL, fcntl(csd, F_GETFL) | O_NONBLOCK) == -1) {
+    perror("fcntl");
+    close(csd);
+    return;
+  }
+
+  if (g_lan_socks_num[lan] >= HUBD_MAX_STATIONS || !watch_sock(csd)) {
+    fprintf(stderr, "error : too many stations, so '%d' is refused\n", csd);
+    close(csd);
+    return;
+  }
+
+  /* grow the descriptor table */
+  if (csd >= g_conns_size) {
+    int size = g_conns_size * 2;
+
+    while (csd >= size)
+      size *= 2;
+    g_conns = (hubd_conn **) realloc(g_conns, size * sizeof(hubd_conn *));
+    if (!g_conns) {
+      fprintf(stderr, "error : unable to realloc\n");
+      exit(1);
+    }
+    memset(g_conns + g_conns_size, 0, (size - g_conns_size) * sizeof(hubd_conn *));
+    g_conns_size = size;
+  }
+
+  g_conns[csd] = (hubd_conn *) calloc(1, sizeof(hubd_conn));
+  if (!g_conns[csd]) {
+    fprintf(stderr, "error : unable to calloc\n");
+    exit(1);
+  }
+  g_conns[csd]->lan = lan;
+  police_set(csd, police_rate, police_burst);
+
+  /* include this in the stations of the LAN */
+  socks = g_lan_socks + lan * HUBD_MAX_STATIONS;
+  socks[g_lan_socks_num[lan]++] = csd;
+
+  printf("admin: connect to '%s' from '%s' at '%d'\n",
+         g_lans[lan].name, inet_ntoa(caddr.sin_addr), csd);
+}
+
+/* disconnect a station */
+void close_conn(int sd)
+{
+  hubd_conn *conn = g_conns[sd];
+  int *socks = g_lan_socks + conn->lan * HUBD_MAX_STATIONS;
+  int i;
+
+  printf("admin: disconnect from '%s' at '%d'\n", g_lans[conn->lan].name, sd);
+
+  /* no more watching this sock */
+  for (i = 0; i < g_lan_socks_num[conn->lan]; i++) {
+    if (socks[i] == sd) {
+      socks[i] = socks[--g_lan_socks_num[conn->lan]];
+      break;
+    }
+  }
+  mcast_forget_sock(&g_lans[conn->lan].groups, sd);
+  if (switch_mode)
+    mac_learn_forget_sock(&g_lans[conn->lan].mactable, sd);
+
+  if (conn->frame)
+    pool_put(conn->frame);
+  while (conn->out_head) {
+    hubd_out *out = conn->out_head;
+
+    conn->out_head = out->next;
+    free(out);
+  }
+  free(conn);
+  g_conns[sd] = NULL;
+  police_reset(sd);
+  close(sd); //closing removes sd from the epoll set
+}
+
+/* send a whole frame to sd; what sd cannot take now is queued for it */
+int send_frame(int sd, EthPkt *view, char *frame, int len)
+{
+  hubd_conn *conn = g_conns[sd];
+  hubd_out *out;
+  int sent = 0;
+  int ret_val;
+
+  /* a station that stops reading loses its own frames only */
+  if (conn->out_bytes + len > HUBD_OUT_LIMIT) {
+    g_stats->drops[DROP_QUEUE_FULL]++;
+    trace_ethpkt(TRACE_DROP, DROP_QUEUE_FULL, sd, view);
+    return(0);
+  }
+
+  trace_ethpkt(TRACE_TX, 0, sd, view);
+
+  /* write what the socket takes unless earlier frames still wait */
+  while (conn->out_head == NULL && sent < len) {
+    ret_val = write(sd, frame + sent, len - sent);
+    if (ret_val == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      perror("write");
+      return(0);
+    }
+    sent += ret_val;
+  }
+
+  /* queue the rest and write it when sd is writable */
+  if (sent < len) {
+    out = (hubd_out *) malloc(sizeof(hubd_out) + len - sent);
+    if (!out) {
+      fprintf(stderr, "error : unable to malloc\n");
+      exit(1);
+    }
+    g_stats->allocs++;
+    out->next = NULL;
+    out->len = len - sent;
+    memcpy(out->dat, frame + sent, out->len);
+    if (conn->out_tail)
+      conn->out_tail->next = out;
+    else {
+      conn->out_head = out;
+      watch_output(sd, 1);
+    }
+    conn->out_tail = out;
+    conn->out_bytes += out->len;
+  }
+
+  STATS_PORT(sd)->tx_frames++;
+  STATS_PORT(sd)->tx_bytes += len;
+  return(1);
+}
+
+/* write the queued frames that sd takes now */
+void flush_conn(int sd)
+{
+  hubd_conn *conn = g_conns[sd];
+  hubd_out *out;
+  int ret_val;
+
+  while ((out = conn->out_head) != NULL) {
+    ret_val = write(sd, out->dat + conn->out_sent, out->len - conn->out_sent);
+    if (ret_val == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      perror("write");
+      close_conn(sd);
+      return;
+    }
+    conn->out_sent += ret_val;
+    if (conn->out_sent == out->len) {
+      conn->out_head = out->next;
+      if (conn->out_head == NULL)
+        conn->out_tail = NULL;
+      conn->out_bytes -= out->len;
+      conn->out_sent = 0;
+      free(out);
+    }
+  }
+
+  /* nothing waits any more */
+  watch_output(sd, 0);
+}
+
+/* relay the complete frame received on frsock to the other stations of its LAN */
+void relay_frame(int frsock, char *frame, int len)
+{
+  hubd_conn *conn = g_conns[frsock];
+  hubd_lan *lan = &g_lans[conn->lan];
+  int *socks = g_lan_socks + conn->lan * HUBD_MAX_STATIONS;
+  EthPkt view; //header of the frame for tracing and learning; dat points into frame
+  int tosock = -1;
+  int members[MCAST_MAX_MEMBERS];
+  int members_num = 0;
+  long curtime;
+  int i;
+
+  memcpy(view.dst, frame, sizeof(HwAddr));
+  memcpy(view.src, frame + sizeof(HwAddr), sizeof(HwAddr));
+  view.len = len - HUBD_HDR_SIZE;
+  view.dat = frame + HUBD_HDR_SIZE;
+
+  trace_ethpkt(TRACE_RX, 0, frsock, &view);
+  STATS_PORT(frsock)->rx_frames++;
+  STATS_PORT(frsock)->rx_bytes += len;
+
+  /* the station sends faster than its policer allows; DV messages and membership reports pass */
+  if (!ethpkt_is_control(&view) && !police_frame(frsock, len)) {
+    g_stats->drops[DROP_POLICED]++;
+    trace_ethpkt(TRACE_DROP, DROP_POLICED, frsock, &view);
+    return;
+  }
+
+  /* a membership report is taken by the hub */
+  curtime = getcurtime();
+  if (mcast_snoop(&lan->groups, &view, frsock, curtime))
+    return;
+
+  if (switch_mode) {
+    /* learn the sender and look up the port of the receiver */
+    mac_learn_update(&lan->mactable, view.src, frsock, curtime);
+    if (!hwaddr_is_group(view.dst))
+      tosock = mac_learn_lookup(&lan->mactable, view.dst, curtime);
+  }
+  if (hwaddr_is_group(view.dst))
+    members_num = mcast_members(&lan->groups, view.dst, members, curtime);
+
+  if (tosock != -1) {
+    /* send the frame only to the learned port unless it came from there */
+    if (tosock != frsock && g_conns[tosock] != NULL)
+      send_frame(tosock, &view, frame, len);
+  } else if (members_num > 0) {
+    /* send the frame only to the members of its group */
+    for (i = 0; i < members_num; i++)
+      if (members[i] != frsock && g_conns[members[i]] != NULL)
+        send_frame(members[i], &view, frame, len);
+  } else {
+    /* send the frame to all others on the LAN */
+    for (i = 0; i < g_lan_socks_num[conn->lan]; i++) {
+      if (socks[i] != frsock)
+        send_frame(socks[i], &view, frame, len);
+    }
+  }
+}
+
+/* receive what is available on sd; a frame is relayed once it is complete */
+void recv_conn(int sd)
+{
+  hubd_conn *conn = g_conns[sd];
+  int need; //size of the frame, or of its header until the header is in
+  int ret_val;
+
+  if (conn->frame == NULL) {
+    conn->frame = pool_get();
+    conn->have = 0;
+  }
+
+  need = HUBD_HDR_SIZE;
+  if (conn->have >= HUBD_HDR_SIZE) {
+    ushort len;
+
+    memcpy(&len, conn->frame + 2*sizeof(HwAddr), sizeof(ushort));
+    need += ntohs(len);
+  }
+
+  /* one read per readiness keeps every station served in turn */
+  ret_val = read(sd, conn->frame + conn->have, need - conn->have);
+  if (ret_val <= 0) {
+    /* a stale readiness finds nothing to read */
+    if (ret_val == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (conn->have == 0) {
+        pool_put(conn->frame);
+        conn->frame = NULL;
+      }
+      return;
+    }
+    close_conn(sd);
+    return;
+  }
+  conn->have += ret_val;
+
+  if (conn->have == HUBD_HDR_SIZE) { //the header is in; a frame may have no payload
+    ushort len;
+
+    memcpy(&len, conn->frame + 2*sizeof(HwAddr), sizeof(ushort));
+    len = ntohs(len);
+
+    /* the frames after a corrupt length cannot be found, so the station is disconnected */
+    if (len > ETH_MAX_PAYLOAD) {
+      printf("recv_conn(): invalid frame length %d from '%d'\n", len, sd);
+      g_stats->drops[DROP_MALFORMED]++;
+      close_conn(sd);
+      return;
+    }
+    need += len;
+  }
+
+  if (conn->have == need) {
+    relay_frame(sd, conn->frame, need);
+    pool_put(conn->frame);
+    conn->frame = NULL;
+  }
+}
+
+/* main routine */
+int main(int argc, char *argv[])
+{
+#ifdef __linux__
+  struct epoll_event events[HUBD_EVENTS];
+  int first = 1; //index of the first LAN name in argv
+  int i, n;
+
+  /* check usage */
+  if (argc > first && strcasecmp(argv[first], "switch") == 0) {
+    switch_mode = 1;
+    first++;
+  }
+  if (argc > first + 2 && strcasecmp(argv[first], "police") == 0) {
+    char police[MAXSTRING];
+
+    snprintf(police, sizeof(police), "%s %s", argv[first+1], argv[first+2]);
+    if (!tb_parse(police, &police_rate, &police_burst))
+      first = argc; //show the usage
+    else
+      first += 3;
+  }
+  if (argc - first < 1) {
+    fprintf(stderr, "usage : %s [switch] [police <kbit/s> <burst bytes>] <lan name-1> [<lan name-2> ... ]\n", argv[0]);
+    exit(1);
+  }
+
+  /* set station kind */
+  set_station_kind(STATION_HUB);
+
+  /* set up statistics shared with external tools */
+  stats_init("hubd", STATION_HUB);
+  stats_export();
+
+  /* setup signal handlers to clean up */
+  signal(SIGTERM, cleanup);
+  signal(SIGINT, cleanup);
+  signal(SIGPIPE, SIG_IGN); //a write to a closed station fails with EPIPE instead
+
+  g_epfd = epoll_create1(0);
+  if (g_epfd == -1) {
+    perror("epoll_create1");
+    exit(1);
+  }
+  /* epoll refuses a regular file or /dev/null as stdin; hubd then runs without a console */
+  if (!watch_sock(0))
+    printf("admin: stdin cannot be watched, so there is no console\n");
+
+  g_lans_num = argc - first;
+  g_lans = (hubd_lan *) calloc(g_lans_num, sizeof(hubd_lan));
+  g_lan_socks = (int *) malloc(g_lans_num * HUBD_MAX_STATIONS * sizeof(int));
+  g_lan_socks_num = (int *) calloc(g_lans_num, sizeof(int));
+  g_conns_size = 64;
+  g_conns = (hubd_conn **) calloc(g_conns_size, sizeof(hubd_conn *));
+  if (!g_lans || !g_lan_socks || !g_lan_socks_num || !g_conns) {
+    fprintf(stderr, "error : unable to calloc\n");
+    exit(1);
+  }
+
+  /* get ready to receive requests on every LAN */
+  for (i = 0; i < g_lans_num; i++) {
+    g_lans[i].name = argv[first + i];
+    g_lans[i].servsock = initlan(g_lans[i].name);
+    if (g_lans[i].servsock == -1) {
+      g_lans_num = i; //unlink only the links made by this process
+      cleanup();
+    }
+    if (switch_mode)
+      mac_learn_init(&g_lans[i].mactable);
+    mcast_init(&g_lans[i].groups);
+
+    if (!watch_sock(g_lans[i].servsock))
+      cleanup();
+  }
+
+  /* accept requests and process them */
+  while (1) {
+    n = epoll_wait(g_epfd, events, HUBD_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      cleanup();
+    }
+
+    for (i = 0; i < n; i++) {
+      int sd = events[i].data.fd;
+      int lan;
+
+      /* any keyboard input? */
+      if (sd == 0) {
+        char bufr[MAXSTRING];
+
+        if (fgets(bufr, MAXSTRING, stdin) == NULL) {
+          /* no more watching the closed stdin */
+          epoll_ctl(g_epfd, EPOLL_CTL_DEL, 0, NULL);
+        } else {
+          bufr[strcspn(bufr, "\n")] = '\0';
+          if (strcasecmp(bufr, "show stats") == 0) {
+            stats_show();
+            printf("  LANs=%d frame pool=%d x %d bytes\n", g_lans_num, g_pool_size, (int) HUBD_FRAME_SIZE);
+          }
+          else if (strncasecmp(bufr, "trace dump ", 11) == 0)
+            trace_dump(bufr + 11);
+          else if (strcasecmp(bufr, "show police") == 0)
+            police_show();
+          else if (strcasecmp(bufr, "show groups") == 0) {
+            for (lan = 0; lan < g_lans_num; lan++) {
+              printf("LAN %s: ", g_lans[lan].name);
+              mcast_show(&g_lans[lan].groups, getcurtime());
+            }
+          }
+          else if (strncasecmp(bufr, "set police ", 11) == 0) {
+            long rate, burst;
+            int sd;
+
+            /* police every station connected now and later */
+            if (tb_parse(bufr + 11, &rate, &burst)) {
+              police_rate = rate;
+              police_burst = burst;
+              for (sd = 0; sd < g_conns_size; sd++)
+                if (g_conns[sd] != NULL)
+                  police_set(sd, police_rate, police_burst);
+            }
+            else
+              printf("usage : set police <kbit/s> <burst bytes>|off (burst of %d bytes at least)\n", BUF_SIZE);
+          }
+        }
+        continue;
+      }
+
+      /* a station? */
+      if (sd < g_conns_size && g_conns[sd] != NULL) {
+        if (events[i].events & EPOLLOUT)
+          flush_conn(sd);
+        if (g_conns[sd] != NULL && (events[i].events & ~EPOLLOUT))
+          recv_conn(sd);
+        continue;
+      }
+
+      /* a connect to one of the LANs */
+      for (lan = 0; lan < g_lans_num; lan++) {
+        if (g_lans[lan].servsock == sd) {
+          accept_conn(lan);
+          break;
+        }
+      }
+    }
+    fflush(NULL);
+  }
+#else
+  fprintf(stderr, "error : %s needs epoll\n", argv[0]);
+  return(1);
+#endif
+}
+/*--------------------------------------------------------------------*/
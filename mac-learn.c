@@ -0,0 +1,255 @@
+/*--------------------------------------------------------------------*/
+/* mac-learn.c: MAC address learning table for a hub in switch mode,
+   and multicast group memberships for every hub */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "mac-learn.h"
+/*--------------------------------------------------------------------*/
+
+/* hash a MAC address into a slot index */
+static int mac_learn_hash(HwAddr addr)
+{
+  unsigned int h = 2166136261U; //FNV-1a
+  int i;
+
+  for(i = 0; i < sizeof(HwAddr); i++)
+  {
+    h ^= addr[i];
+    h *= 16777619U;
+  }
+
+  return h & (MAC_LEARN_TABLE_SIZE-1);
+}
+
+/* return 1 if the entry holds a live (not freed and not aged) address */
+static int mac_learn_alive(mac_learn_entry* ent, long curtime)
+{
+  return (ent->sock != -1) && (curtime - ent->time <= MAC_LEARN_AGING_TIME);
+}
+
+void mac_learn_init(mac_learn_table* table)
+{ //empty the learning table
+  int i;
+
+  memset(table, 0, sizeof(mac_learn_table));
+  for(i = 0; i < MAC_LEARN_TABLE_SIZE; i++)
+    table->ent[i].sock = -1;
+}
+
+void mac_learn_update(mac_learn_table* table, HwAddr addr, int sock, long curtime)
+{ //learn that addr is reachable through sock
+  mac_learn_entry* ent;
+  mac_learn_entry* reuse = NULL; //first free slot on the probe sequence
+  int i, idx;
+
+  if(hwaddr_is_group(addr)) //a group address never appears as a source
+    return;
+
+  idx = mac_learn_hash(addr);
+  for(i = 0; i < MAC_LEARN_TABLE_SIZE; i++, idx = (idx+1) & (MAC_LEARN_TABLE_SIZE-1))
+  {
+    ent = &table->ent[idx];
+    if(!ent->used)
+      break;
+
+    if(hwaddrcmp(ent->addr, addr) == 0)
+    {
+      ent->sock = sock;
+      ent->time = curtime;
+      return;
+    }
+
+    if((reuse == NULL) && !mac_learn_alive(ent, curtime))
+      reuse = ent;
+  }
+
+  if(reuse == NULL)
+  {
+    if(i == MAC_LEARN_TABLE_SIZE) //the table is full; the address is flooded to
+      return;
+
+    reuse = ent;
+  }
+
+  hwaddrcpy(reuse->addr, addr);
+  reuse->sock = sock;
+  reuse->time = curtime;
+  reuse->used = 1;
+}
+
+int mac_learn_lookup(mac_learn_table* table, HwAddr addr, long curtime)
+{ //return the socket toward addr, or -1 if it is unknown
+  mac_learn_entry* ent;
+  int i, idx;
+
+  idx = mac_learn_hash(addr);
+  for(i = 0; i < MAC_LEARN_TABLE_SIZE; i++, idx = (idx+1) & (MAC_LEARN_TABLE_SIZE-1))
+  {
+    ent = &table->ent[idx];
+    if(!ent->used)
+      break;
+
+    if(hwaddrcmp(ent->addr, addr) == 0)
+      return mac_learn_alive(ent, curtime) ? ent->sock : -1;
+  }
+
+  return -1;
+}
+
+void mac_learn_forget_sock(mac_learn_table* table, int sock)
+{ //forget the addresses learned on a closed socket
+  int i;
+
+  for(i = 0; i < MAC_LEARN_TABLE_SIZE; i++)
+  {
+    if(table->ent[i].sock == sock)
+      table->ent[i].sock = -1; //the slot stays used so that probing goes on past it
+  }
+}
+
+int hwaddr_is_group(HwAddr addr)
+{ //return 1 if addr is a broadcast or multicast address
+  return addr[0] & 0x01;
+}
+/*--------------------------------------------------------------------*/
+
+void mcast_init(mcast_table* table)
+{ //empty the membership table
+  memset(table, 0, sizeof(mcast_table));
+}
+
+/* return the slot of group addr; a free slot is taken for it if create is set */
+static mcast_group* mcast_find(mcast_table* table, HwAddr addr, int create)
+{
+  mcast_group* free_grp = NULL;
+  int i;
+
+  for(i = 0; i < MCAST_TABLE_SIZE; i++)
+  {
+    if(!table->grp[i].used)
+    {
+      if(free_grp == NULL)
+        free_grp = &table->grp[i];
+    }
+    else if(hwaddrcmp(table->grp[i].addr, addr) == 0)
+      return &table->grp[i];
+  }
+
+  if(!create || free_grp == NULL) //the table is full; the group is flooded to
+    return NULL;
+
+  hwaddrcpy(free_grp->addr, addr);
+  free_grp->used = 1;
+  free_grp->members_num = 0;
+  return free_grp;
+}
+
+/* drop the member at index i of grp, and the group with its last member */
+static void mcast_remove(mcast_group* grp, int i)
+{
+  grp->members_num--;
+  grp->sock[i] = grp->sock[grp->members_num];
+  grp->time[i] = grp->time[grp->members_num];
+  if(grp->members_num == 0)
+    grp->used = 0;
+}
+
+int mcast_snoop(mcast_table* table, EthPkt* ethpkt, int sock, long curtime)
+{ //note the membership if ethpkt is a report received on sock; return 1 if it is one
+  mcast_group* grp;
+  int i;
+
+  /* a report is an IP packet of type DATA_JOIN sent to the group */
+  if(!hwaddr_is_group(ethpkt->dst) || hwaddrcmp(ethpkt->dst, BCASTADDR) == 0 ||
+     ethpkt->len < IP_HDR_SIZE || ethpkt->dat[10] != DATA_JOIN)
+    return 0;
+
+  grp = mcast_find(table, ethpkt->dst, 1);
+  if(grp == NULL)
+    return 1;
+
+  for(i = 0; i < grp->members_num; i++)
+  {
+    if(grp->sock[i] == sock)
+    {
+      grp->time[i] = curtime;
+      return 1;
+    }
+  }
+
+  if(grp->members_num < MCAST_MAX_MEMBERS)
+  {
+    grp->sock[grp->members_num] = sock;
+    grp->time[grp->members_num] = curtime;
+    grp->members_num++;
+  }
+  return 1;
+}
+
+int mcast_members(mcast_table* table, HwAddr addr, int* socks, long curtime)
+{ //fill socks with the members of group addr and return their number; 0 if it is flooded
+  mcast_group* grp;
+  int i, num = 0;
+
+  if(hwaddrcmp(addr, BCASTADDR) == 0)
+    return 0;
+
+  grp = mcast_find(table, addr, 0);
+  if(grp == NULL)
+    return 0;
+
+  for(i = grp->members_num - 1; i >= 0; i--)
+  {
+    if(curtime - grp->time[i] > MCAST_AGING_TIME)
+      mcast_remove(grp, i);
+    else
+      socks[num++] = grp->sock[i];
+  }
+
+  return num;
+}
+
+void mcast_forget_sock(mcast_table* table, int sock)
+{ //forget the memberships of a closed socket
+  mcast_group* grp;
+  int i, j;
+
+  for(i = 0; i < MCAST_TABLE_SIZE; i++)
+  {
+    grp = &table->grp[i];
+    for(j = grp->members_num - 1; grp->used && j >= 0; j--)
+    {
+      if(grp->sock[j] == sock)
+        mcast_remove(grp, j);
+    }
+  }
+}
+
+void mcast_show(mcast_table* table, long curtime)
+{ //show the groups and their members
+  mcast_group* grp;
+  char addr[MAXSTRING];
+  int i, j;
+
+  printf("MULTICAST GROUPS\n");
+  printf("  Group | Members (socket/age in seconds)\n");
+  for(i = 0; i < MCAST_TABLE_SIZE; i++)
+  {
+    grp = &table->grp[i];
+    if(!grp->used)
+      continue;
+
+    hwaddrtostr(grp->addr, addr);
+    printf("  %s |", addr);
+    for(j = 0; j < grp->members_num; j++)
+      printf(" %d/%ld", grp->sock[j], curtime - grp->time[j]);
+    printf("\n");
+  }
+  fflush(NULL);
+}
+/*--------------------------------------------------------------------*/
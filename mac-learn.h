@@ -0,0 +1,86 @@
+/*--------------------------------------------------------------------*/
+/* mac-learn.h: MAC address learning table for a hub in switch mode,
+   and multicast group memberships for every hub.
+
+   The table maps a station's MAC address to the socket it was last seen
+   on. It is open-addressed with linear probing, so a lookup costs one or
+   a few probes regardless of the number of ports.
+
+   A station joins a group by sending a membership report (an IP packet
+   of type DATA_JOIN) to the group's MAC address. The hub snoops these
+   reports, notes the socket as a member of the group and keeps the
+   report to itself. A frame to a group with members then goes only to
+   them. A group without members is flooded like broadcast. */
+
+#ifndef __MAC_LEARN_H__
+#define __MAC_LEARN_H__
+
+#include "common.h"
+
+#define MAC_LEARN_TABLE_SIZE 256
+//number of slots of the learning table; it should be a power of 2
+
+#define MAC_LEARN_AGING_TIME 300
+//seconds after which a learned address is forgotten unless it is seen again
+
+/* learned MAC address */
+typedef struct _mac_learn_entry
+{
+  HwAddr addr; //station's MAC address
+  int sock; //socket the station was seen on; -1 if the entry is free for reuse
+  long time; //the last time the station was seen
+  int used; //whether this slot has ever been used (terminates probing)
+} mac_learn_entry;
+
+/* MAC learning table */
+typedef struct _mac_learn_table
+{
+  mac_learn_entry ent[MAC_LEARN_TABLE_SIZE];
+} mac_learn_table;
+
+void mac_learn_init(mac_learn_table* table); //empty the learning table
+
+void mac_learn_update(mac_learn_table* table, HwAddr addr, int sock, long curtime); //learn that addr is reachable through sock
+
+int mac_learn_lookup(mac_learn_table* table, HwAddr addr, long curtime); //return the socket toward addr, or -1 if it is unknown
+
+void mac_learn_forget_sock(mac_learn_table* table, int sock); //forget the addresses learned on a closed socket
+
+int hwaddr_is_group(HwAddr addr); //return 1 if addr is a broadcast or multicast address
+
+#define MCAST_TABLE_SIZE 16
+//groups a hub keeps the members of
+
+#define MCAST_MAX_MEMBERS 64
+//member sockets of a group
+
+#define MCAST_AGING_TIME 120
+//seconds after which a member is forgotten unless it reports again; routers report at every DV advertisement
+
+/* multicast group and its members */
+typedef struct _mcast_group
+{
+  HwAddr addr; //group MAC address
+  int used; //whether this slot holds a group
+  int members_num; //number of members
+  int sock[MCAST_MAX_MEMBERS]; //socket of each member
+  long time[MCAST_MAX_MEMBERS]; //the last report of each member
+} mcast_group;
+
+/* multicast membership table */
+typedef struct _mcast_table
+{
+  mcast_group grp[MCAST_TABLE_SIZE];
+} mcast_table;
+
+void mcast_init(mcast_table* table); //empty the membership table
+
+int mcast_snoop(mcast_table* table, EthPkt* ethpkt, int sock, long curtime); //note the membership if ethpkt is a report received on sock; return 1 if it is one
+
+int mcast_members(mcast_table* table, HwAddr addr, int* socks, long curtime); //fill socks with the members of group addr and return their number; 0 if it is flooded
+
+void mcast_forget_sock(mcast_table* table, int sock); //forget the memberships of a closed socket
+
+void mcast_show(mcast_table* table, long curtime); //show the groups and their members
+
+#endif
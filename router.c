@@ -6,6 +6,12 @@
 #include <netinet/in.h>
 #include <ctype.h> //isdigit()
 #include "common.h"
+#include "dist-vec.h"
+#include "stats.h"
+#include "trace.h"
+#include "topo-db.h"
+#include "egress.h"
+#include "token-bucket.h"
 #include <signal.h> //signal()
 #include <errno.h> //errno
 
@@ -30,6 +36,21 @@ int myconfigint;
 int sds[ADDR_NUM];
 int sds_num;
 
+/* configured costs of the links to hubs, in the order of sds */
+int costs[ADDR_NUM];
+
+/* descriptor watching the topology files */
+int topofd = -1;
+
+/* checkpoint of my routing table for a warm restart */
+char myrtfile[NAME_SIZE+8];
+
+/* my addresses and DV tables */
+dv_router myrouter;
+
+/* set by the timer; the event loop advertises, so the egress queues are never touched in the signal handler */
+volatile sig_atomic_t timer_expired;
+
 /*--------------------------------------------------------------------*/
 
 void print_menu()
@@ -37,6 +58,18 @@ void print_menu()
   printf("#############################################\n");
   printf("show rt          : show routing table\n");
   printf("show ft          : show forwarding table\n");
+  printf("show convergence : show the time since the last route change, churn and flaps\n");
+  printf("show events      : show the DV event log\n");
+  printf("show costs       : show the cost of the links\n");
+  printf("show queues      : show the egress queues of the links\n");
+  printf("show police      : show the policers of the links\n");
+  printf("set police lan kbit/s burst|off : drop the frames from lan beyond the rate\n");
+  printf("set shape lan kbit/s burst|off  : hold the data frames to lan beyond the rate\n");
+  printf("set cost lan n   : set the cost of the link to lan to n\n");
+  printf("set cost measured on|off : add the queue depth and RTT of the links to their costs\n");
+  printf("set summarize on|off : advertise contiguous routes as their covering prefix\n");
+  printf("show stats       : show statistics\n");
+  printf("trace dump file  : write packet trace into file in pcapng format\n");
   printf("hostname message : send a message to the host\n");
   printf("help             : print the menu\n");
   printf("#############################################\n");
@@ -63,10 +96,16 @@ int processdata(int sock, char* dat, int len, int type, in_addr_t src_addr)
   }
   else if(type == DATA_DV)
   { /** FILL IN YOUR CODE in dv_update_routing_info() function */
-		dv_update_routing_info(sock, dat, len, src_addr);
+		dv_update_routing_info(&myrouter, sock, dat, len, src_addr);
    /** the memory should be freed */
     free(dat);
   }
+  else
+  { /* a router takes no bulk data or acks, and the hubs already took the membership reports */
+    if(type != DATA_JOIN)
+      g_stats->drops[DROP_UNSUPPORTED]++;
+    free(dat);
+  }
   
   return(1);
 }
@@ -93,7 +132,7 @@ int processtext(char *text)
   type = DATA_CHAT;
 
   /* send user data to IP layer */
-  send_app_message(sds[0], destname, len, type, text);
+  send_app_message(&myrouter, sds[0], destname, len, type, text);
   return(1);
 }
 
@@ -114,27 +153,44 @@ void setalarm(int interval)
 
 /* handler for timer (config or reconfig) expiration */
 void timeout()
+{
+  /* re-set the signal handler */
+  signal(SIGALRM, timeout);
+
+  timer_expired = 1; //the event loop advertises after select() is interrupted
+}
+
+/* update the tables and advertise at the expiration of the timer */
+void advertise()
 {
   long curtime;
   int ret_val;
+  int j;
 
   /* note current time */
   curtime = getcurtime();
 #ifdef _DEBUG
-  // printf("timeout(): current time: %s\n", timetostring(curtime));
+  // printf("advertise(): current time: %s\n", timetostring(curtime));
 #endif
-  
-  /* re-set the signal handler */
-  signal(SIGALRM, timeout);
 
   /** FILL IN YOUR CODE in dv_update_tables_for_timeout() function */
-  dv_update_tables_for_timeout(curtime, myconfigint);
+  dv_update_tables_for_timeout(&myrouter, curtime, myconfigint);
+
+  /* advertise with the current load of the links */
+  dv_measure_link_costs(&myrouter);
+
+  /* keep the learned routes for the next start */
+  dv_save_checkpoint(&myrouter, myrtfile);
 	
+  /* report the all-routers group to the hubs first, so that they pass the DV messages to the routers only */
+  for(j = 0; j < myrouter.port_table_size; j++)
+    send_group_reports(&myrouter, myrouter.port_table[j].itf);
+
   /* broadcast its routing information through DV message */
-  ret_val = dv_broadcast_dv_message(myipaddrs);
+  ret_val = dv_broadcast_dv_message(&myrouter);
   if(ret_val != 1)
   {
-    printf("timeout(): the router cannot broadcast its routing information to its neighbors\n");
+    printf("advertise(): the router cannot broadcast its routing information to its neighbors\n");
     return;
   }
 }
@@ -142,6 +198,126 @@ void timeout()
 /*--------------------------------------------------------------------*/
 
 
+/* note my addresses found in the tables; the old ones are kept on failure.
+   once the networks are attached (myipaddrs_num > 0), my addresses and masks must stay the same,
+   since the net, routing and forwarding tables were built from them */
+int note_my_addrinfo()
+{
+  HwAddr hwaddr;
+  in_addr_t ipaddrs[ADDR_NUM];
+  int ipaddrs_num;
+  int netmasks[ADDR_NUM];
+  int i;
+
+  /* note my own MAC address */
+  if (!nametohwaddr(myname, hwaddr)) {
+    fprintf(stderr, "error : unable to identify my MAC address\n");
+    return(0);
+  }
+
+  /* note my own IP addresses */
+  if(!dns_name_to_ipaddr(myname, ipaddrs, &ipaddrs_num))
+  {
+    printf("there is no entry for %s in DNS system\n", myname);
+    return(0);
+  }
+
+  if(myipaddrs_num > 0 && ipaddrs_num != myipaddrs_num)
+  {
+    fprintf(stderr, "error : the number of my IP addresses cannot change while running\n");
+    return(0);
+  }
+
+  /* note my own subnet masks */
+  if (get_netmasks_for_addrs(ipaddrs, ipaddrs_num, netmasks) != ipaddrs_num)
+  {
+    fprintf(stderr, "error : unable to identify all my subnet masks\n");
+    return(0);
+  }
+
+  for(i = 0; i < myipaddrs_num; i++)
+  {
+    if(ipaddrs[i] != myipaddrs[i] || netmasks[i] != mynetmasks[i])
+    {
+      fprintf(stderr, "error : my IP addresses and subnet masks cannot change while running\n");
+      return(0);
+    }
+  }
+
+  hwaddrcpy(myhwaddr, hwaddr);
+  for(i = 0; i < ipaddrs_num; i++)
+  {
+    myipaddrs[i] = ipaddrs[i];
+    mynetmasks[i] = netmasks[i];
+  }
+  myipaddrs_num = ipaddrs_num;
+  mynetmasks_num = ipaddrs_num;
+
+  /* register my address information with myrouter for checking if the received packet is mine or not and for sending my packet to the specified destination */
+  set_router_addrinfo(&myrouter, myhwaddr, myipaddrs, myipaddrs_num, mynetmasks);
+
+  return(1);
+}
+
+/* process "set cost ..." of the keyboard input */
+int set_cost(char *arg)
+{
+  char lanname[NAME_SIZE];
+  int cost;
+  char* name;
+  int i;
+
+  if (strcasecmp(arg, "measured on") == 0 || strcasecmp(arg, "measured off") == 0) {
+    myrouter.measure_costs = (strcasecmp(arg, "measured on") == 0);
+    dv_measure_link_costs(&myrouter);
+    return(1);
+  }
+
+  if (sscanf(arg, "%31s %d", lanname, &cost) != 2) {
+    fprintf(stderr, "error: usage is \"set cost <lan-name> <cost>\"\n");
+    return(0);
+  }
+
+  for (i = 0; i < sds_num; i++) {
+    name = get_lanname(sds[i]);
+    if (name != NULL && strcmp(name, lanname) == 0)
+      return dv_set_link_cost(&myrouter, sds[i], cost);
+  }
+
+  fprintf(stderr, "error: there is no link to '%s'\n", lanname);
+  return(0);
+}
+
+/* handle "set police|shape <lan-name> <kbit/s> <burst>|off" */
+int set_bucket(char *arg, int shape)
+{
+  char lanname[NAME_SIZE];
+  long rate, burst;
+  int n = 0;
+  char* name;
+  int i;
+
+  if (sscanf(arg, "%31s %n", lanname, &n) != 1 || !tb_parse(arg + n, &rate, &burst)) {
+    fprintf(stderr, "error: usage is \"set %s <lan-name> <kbit/s> <burst bytes>|off\" with a burst of %d bytes at least\n",
+            shape ? "shape" : "police", BUF_SIZE);
+    return(0);
+  }
+
+  for (i = 0; i < sds_num; i++) {
+    name = get_lanname(sds[i]);
+    if (name != NULL && strcmp(name, lanname) == 0) {
+      if (shape)
+        egress_set_shaper(sds[i], rate, burst);
+      else
+        police_set(sds[i], rate, burst);
+      return(1);
+    }
+  }
+
+  fprintf(stderr, "error: there is no link to '%s'\n", lanname);
+  return(0);
+}
+
 /*--------------------------------------------------------------------*/
 int main(int argc, char *argv[])
 {
@@ -154,20 +330,39 @@ int main(int argc, char *argv[])
 
   /* check usage */
   if (argc < 4) {
-    printf("usage : %s <my-name> <configint> <lan-name-1> [<lan-name-2> ... ]\n", argv[0]);
+    printf("usage : %s <my-name> <configint> <lan-name-1>[:<cost>] [<lan-name-2>[:<cost>] ... ]\n", argv[0]);
     exit(1);
   }
 
   /* print menu */
   print_menu();
 
+  /* set up statistics shared with external tools */
+  stats_init(argv[1], STATION_ROUTER);
+  stats_export();
+
   sds_num = 0;
   max_sd = 0;
   /* get hooked on to the lans */
   for(i = 0; i < argc-3; i++)
   {
+    char* cost; //cost of the link given as "<lan-name>:<cost>"
+
+    costs[i] = 1;
+    if((cost = index(argv[3+i], ':')) != NULL)
+    {
+      *cost = '\0';
+      costs[i] = atoi(cost + 1);
+      if((costs[i] < 1) || (costs[i] > DV_COST_MAX))
+      {
+        printf("the cost of the link to %s (%s) is not in [1, %d]\n", argv[3+i], cost + 1, DV_COST_MAX);
+        exit(1);
+      }
+    }
+
     if((sds[i] = hooktolan(argv[3+i])) == -1)
       exit(1);
+    egress_attach(sds[i]); //frames to the hub go through the egress queues of the port
 
     add_lanname_entry(sds[i], argv[3+i]);
  
@@ -215,52 +410,58 @@ int main(int argc, char *argv[])
   /* note my DNS name */
   strcpy(myname, argv[1]);
 
-  /* note my own MAC address */
-  if (!nametohwaddr(argv[1], myhwaddr)) {
-    fprintf(stderr, "error : unable to identify my MAC address\n");
+  /* note my own addresses */
+  if (!note_my_addrinfo())
     exit(1);
-  }
-
-  /* note my own IP addresses */
-  if(!dns_name_to_ipaddr(myname, myipaddrs, &myipaddrs_num))
-  {
-    printf("there is no entry for %s in DNS system\n", myname);
-    exit(1);
-  }
 
-  /* note my own subnet masks */
-  ret_val = get_netmasks_for_addrs(myipaddrs, myipaddrs_num, mynetmasks);
-
-  if (ret_val != myipaddrs_num)
-  {
-    fprintf(stderr, "error : unable to identify all my subnet masks\n");
-    exit(1);
-  }
-  
-  /* register my address information with g_myhwaddr and g_myipaddr for checking if the received packet is mine or not and for sending my packet to the specified destination */
-  set_router_addrinfo(myhwaddr, myipaddrs, myipaddrs_num, mynetmasks);
+  /* watch the topology files to reload the tables when they change */
+  topofd = topo_watch();
 	  
-  /* initialize g_rt_table, g_net_table, and g_fw_table with the router's network information */
-	dv_init_tables(myipaddrs, mynetmasks, myipaddrs_num, sds);
+  /* initialize the rt_table, net_table, and fw_table of myrouter with the router's network information */
+	dv_init_tables(&myrouter, myipaddrs, mynetmasks, myipaddrs_num, sds);
+  for(i = 0; i < sds_num; i++)
+    dv_set_link_cost(&myrouter, sds[i], costs[i]);
 	
   /* determine whether to run DV routing protocol or not according to myconfigint */
   if(myconfigint > 0)
   {
+    /* forward with the routes of the previous run until DV confirms or expires them */
+    sprintf(myrtfile, ".%s.rt", myname);
+    ret_val = dv_load_checkpoint(&myrouter, myrtfile, myconfigint);
+    if(ret_val > 0)
+      printf("admin: %d routes are restored from %s\n", ret_val, myrtfile);
+
     /* set timer to generate DV message */
+    signal(SIGALRM, timeout);
     setalarm(myconfigint);
 
     /* mimic a timeout to send DV msg now */
-    timeout();
+    advertise();
   }
 
   /* keep moving packets around */
   while (1) { //while
     fd_set readset;
+    fd_set writeset;
+    struct timeval tv; //until a shaper lets a held frame go
+    long long wait = -1;
+    long long port_wait;
 
-    /* watch stdin and socket */
+    /* advertise if the timer expired since the last round */
+    if(timer_expired)
+    {
+      timer_expired = 0;
+      advertise();
+    }
+
+    /* watch stdin, sockets and topology files, and the sockets with queued frames for writing */
     FD_ZERO(&readset);
+    FD_ZERO(&writeset);
     FD_SET(0, &readset);
 
+    if(topofd != -1)
+      FD_SET(topofd, &readset);
+
     if(sds_num == 0)
     {
       printf("There is no active hub connected to this router!\n");
@@ -271,9 +472,17 @@ int main(int argc, char *argv[])
     { 
       if(sds[i] != -1)
         FD_SET(sds[i], &readset);
+      if(sds[i] == -1 || (port_wait = egress_wait(sds[i])) == -1)
+        continue;
+      if(port_wait == 0)
+        FD_SET(sds[i], &writeset);
+      else if(wait == -1 || port_wait < wait)
+        wait = port_wait;
     }
+    tv.tv_sec = wait / 1000000;
+    tv.tv_usec = wait % 1000000;
 
-    if (select(max_sd+1, &readset, NULL, NULL, NULL) == -1)
+    if (select((max_sd > topofd ? max_sd : topofd)+1, &readset, &writeset, NULL, wait == -1 ? NULL : &tv) == -1)
     {
       if(errno == EINTR) //Interrupted system call by SIGALRM
         continue;
@@ -282,6 +491,27 @@ int main(int argc, char *argv[])
       exit(1);
     }
 
+    /* let the hubs take the queued frames, DV frames first, and the frames the shapers let go */
+    for(i = 0; i < sds_num; i++)
+    {
+      if(FD_ISSET(sds[i], &writeset) || (wait != -1 && egress_wait(sds[i]) == 0))
+        egress_drain(sds[i]);
+    }
+
+    /* any change of the topology files? the attached networks and the learned routes are kept */
+    if (topofd != -1 && FD_ISSET(topofd, &readset) && topo_watch_changed(topofd)) {
+      if (!reload_tables())
+        printf("admin: the topology files cannot be read, so the current tables are kept\n");
+      else {
+        dv_invalidate_flow_cache(&myrouter); //the cached MAC addresses may have changed
+        if (!note_my_addrinfo())
+          printf("admin: the topology is reloaded, but my addresses are kept\n");
+        else
+          printf("admin: the topology is reloaded\n");
+      }
+      fflush(NULL);
+    }
+
     /* any keyboard input? */
     if (FD_ISSET(0, &readset)) {
       char bufr[MAXSTRING];
@@ -293,9 +523,33 @@ int main(int argc, char *argv[])
 
       /** FILL IN YOUR CODE: show routing table and forwarding table */
       if(strcasecmp(bufr, "show rt") == 0)
-        dv_show_routing_table();
+        dv_show_routing_table(&myrouter);
       else if(strcasecmp(bufr, "show ft") == 0)
-        dv_show_forwarding_table();
+        dv_show_forwarding_table(&myrouter);
+      else if(strcasecmp(bufr, "show convergence") == 0)
+        dv_show_convergence(&myrouter);
+      else if(strcasecmp(bufr, "show events") == 0)
+        dv_show_events(&myrouter);
+      else if(strcasecmp(bufr, "show costs") == 0)
+        dv_show_link_costs(&myrouter);
+      else if(strcasecmp(bufr, "show queues") == 0)
+        egress_show();
+      else if(strcasecmp(bufr, "show police") == 0)
+        police_show();
+      else if(strncasecmp(bufr, "set police ", 11) == 0)
+        set_bucket(bufr + 11, 0);
+      else if(strncasecmp(bufr, "set shape ", 10) == 0)
+        set_bucket(bufr + 10, 1);
+      else if(strncasecmp(bufr, "set cost ", 9) == 0)
+        set_cost(bufr + 9);
+      else if(strcasecmp(bufr, "set summarize on") == 0)
+        myrouter.summarize = 1;
+      else if(strcasecmp(bufr, "set summarize off") == 0)
+        myrouter.summarize = 0;
+      else if(strcasecmp(bufr, "show stats") == 0)
+        stats_show();
+      else if(strncasecmp(bufr, "trace dump ", 11) == 0)
+        trace_dump(bufr + 11);
       else if(strcasecmp(bufr, "help") == 0)
 				print_menu();
       else
@@ -316,7 +570,7 @@ int main(int argc, char *argv[])
 
         set_hub_up(); //set the hub related to socket sd to HUB_UP. After calling recvmessage(), if hub_status() returns HUB_DOWN, it means that the hub related to socket sd is down. So we need to close sd.
 
-        dat = (char*) recvmessage(hubsock, &src_addr, &len, &type);
+        dat = (char*) recvmessage(&myrouter, hubsock, &src_addr, &len, &type);
         /* NOTE: the compiler complains if there is no type casting like above */
         if (dat == NULL && (hub_status() == HUB_DOWN)) {
           char* lanname;
@@ -327,9 +581,11 @@ int main(int argc, char *argv[])
             delete_lanname_entry(hubsock);
 
             /** FILL IN YOUR CODE in dv_broadcast_dv_message_for_link_breakage() function */
-            dv_broadcast_dv_message_for_link_breakage(hubsock, myipaddrs); //broadcast the routing information with DV exchange message containing the network address related to the link which is broken due to a hub crash.
+            dv_broadcast_dv_message_for_link_breakage(&myrouter, hubsock); //broadcast the routing information with DV exchange message containing the network address related to the link which is broken due to a hub crash.
           }
 
+          egress_detach(hubsock);
+          police_reset(hubsock);
           close(hubsock);
 
           /* adjust sds[], sds_num and max_sd */
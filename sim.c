@@ -0,0 +1,373 @@
+/*--------------------------------------------------------------------*/
+/* sim.c: discrete-event simulation of hosts and routers in one process */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "dist-vec.h"
+#include "stats.h"
+#include "mac-learn.h"
+#include "sim.h"
+/*--------------------------------------------------------------------*/
+
+/* attachment of a station to a LAN */
+typedef struct _sim_sock
+{
+  sim_station* station; //station
+  int lan; //index of the LAN
+} sim_sock;
+
+/* LAN */
+typedef struct _sim_lan
+{
+  int* socks; //virtual sockets of the stations on the LAN
+  int socks_num; //number of sockets
+  int socks_max; //number of sockets allocated
+} sim_lan;
+
+long long g_sim_now; //virtual time in milliseconds
+unsigned long g_sim_events; //number of events processed
+unsigned long g_sim_frames; //number of frames delivered
+long g_sim_routes; //number of routing entries of all the routers
+long long g_sim_last_change; //virtual time of the last route change
+unsigned long g_sim_chats; //number of chat messages delivered to the stations
+
+sim_event* g_sim_queue; //binary heap of the scheduled events ordered by time and seq
+int g_sim_queue_size; //number of scheduled events
+int g_sim_queue_max; //number of events allocated
+unsigned long g_sim_seq; //sequence number of the next scheduled event
+
+sim_sock* g_sim_socks; //attachments indexed by virtual socket - SIM_FIRST_SOCK
+int g_sim_socks_num;
+int g_sim_socks_max;
+
+sim_lan* g_sim_lans; //LANs
+int g_sim_lans_num;
+int g_sim_lans_max;
+
+sim_frame* g_sim_rx; //frame being received
+int g_sim_rx_off; //bytes of g_sim_rx read so far
+
+unsigned long g_sim_rand = 1; //state of sim_random()
+/*--------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------*/
+/* grow an array of entry-sized elements to hold one more */
+static void* sim_grow(void* array, int num, int* max, size_t entry)
+{
+  if(num < *max)
+    return array;
+
+  *max = (*max > 0) ? *max * 2 : 16;
+  array = realloc(array, *max * entry);
+  if(array == NULL)
+  {
+    fprintf(stderr, "error : unable to realloc\n");
+    exit(1);
+  }
+  return array;
+}
+
+unsigned long sim_random()
+{ //pseudo-random number of a fixed sequence for reproducible runs
+  g_sim_rand = g_sim_rand * 6364136223846793005UL + 1442695040888963407UL;
+  return g_sim_rand >> 33;
+}
+
+/*--------------------------------------------------------------------*/
+/* the event queue */
+static int sim_event_before(sim_event* a, sim_event* b)
+{
+  return (a->time < b->time) || (a->time == b->time && a->seq < b->seq);
+}
+
+static void sim_schedule(long long time, int kind, int sock, sim_station* st, sim_frame* frame)
+{ //add an event to the queue
+  sim_event ev;
+  int i, parent;
+
+  ev.time = time;
+  ev.seq = g_sim_seq++;
+  ev.kind = kind;
+  ev.sock = sock;
+  ev.station = st;
+  ev.frame = frame;
+
+  g_sim_queue = (sim_event*) sim_grow(g_sim_queue, g_sim_queue_size, &g_sim_queue_max, sizeof(sim_event));
+  for(i = g_sim_queue_size++; i > 0; i = parent)
+  {
+    parent = (i - 1) / 2;
+    if(!sim_event_before(&ev, &g_sim_queue[parent]))
+      break;
+    g_sim_queue[i] = g_sim_queue[parent];
+  }
+  g_sim_queue[i] = ev;
+}
+
+static sim_event sim_next_event()
+{ //take the earliest event out of the queue
+  sim_event ev = g_sim_queue[0];
+  sim_event last = g_sim_queue[--g_sim_queue_size];
+  int i, child;
+
+  for(i = 0; (child = 2*i + 1) < g_sim_queue_size; i = child)
+  {
+    if(child + 1 < g_sim_queue_size && sim_event_before(&g_sim_queue[child+1], &g_sim_queue[child]))
+      child++;
+    if(!sim_event_before(&g_sim_queue[child], &last))
+      break;
+    g_sim_queue[i] = g_sim_queue[child];
+  }
+  g_sim_queue[i] = last;
+  return ev;
+}
+
+/*--------------------------------------------------------------------*/
+/* hooks of the socket I/O and the clock */
+static ssize_t sim_net_read(int sd, void* buf, size_t n)
+{ //read from the frame being delivered
+  if(g_sim_rx == NULL || g_sim_rx_off >= g_sim_rx->len)
+    return 0;
+
+  if(n > g_sim_rx->len - g_sim_rx_off)
+    n = g_sim_rx->len - g_sim_rx_off;
+  memcpy(buf, g_sim_rx->dat + g_sim_rx_off, n);
+  g_sim_rx_off += n;
+  return n;
+}
+
+static ssize_t sim_net_write(int sd, const void* buf, size_t n)
+{ //deliver the frame to the stations on the LAN of sd after SIM_LINK_DELAY
+  sim_lan* lan;
+  sim_frame* frame;
+  sim_station* st;
+  HwAddr dst;
+  int i;
+
+  if(sd < SIM_FIRST_SOCK || sd >= SIM_FIRST_SOCK + g_sim_socks_num)
+    return -1;
+  lan = &g_sim_lans[g_sim_socks[sd - SIM_FIRST_SOCK].lan];
+
+  frame = (sim_frame*) malloc(sizeof(sim_frame) + n);
+  if(frame == NULL)
+  {
+    fprintf(stderr, "error : unable to malloc\n");
+    exit(1);
+  }
+  frame->refs = 0;
+  frame->len = n;
+  memcpy(frame->dat, buf, n);
+  memcpy(dst, buf, sizeof(HwAddr));
+
+  for(i = 0; i < lan->socks_num; i++)
+  {
+    if(lan->socks[i] == sd)
+      continue;
+
+    st = g_sim_socks[lan->socks[i] - SIM_FIRST_SOCK].station;
+    if(!hwaddr_is_mine(&st->router, dst)) //the LAN passes a group's frames to its members only, as a hub does once it learns them
+      continue;
+
+    frame->refs++;
+    sim_schedule(g_sim_now + SIM_LINK_DELAY, SIM_FRAME, lan->socks[i], NULL, frame);
+  }
+
+  if(frame->refs == 0)
+    free(frame);
+  return n;
+}
+
+static long sim_clock()
+{ //virtual time in seconds
+  return (long) (g_sim_now / 1000);
+}
+
+static long long sim_monoclock()
+{ //virtual time in microseconds
+  return g_sim_now * 1000;
+}
+
+void sim_init()
+{ //hook the socket I/O and the clock into the simulator
+  g_net_read = sim_net_read;
+  g_net_write = sim_net_write;
+  g_clock_hook = sim_clock;
+  g_monoclock_hook = sim_monoclock;
+}
+
+/*--------------------------------------------------------------------*/
+/* topology */
+int sim_add_lan()
+{ //add a LAN and return its index
+  g_sim_lans = (sim_lan*) sim_grow(g_sim_lans, g_sim_lans_num, &g_sim_lans_max, sizeof(sim_lan));
+  memset(&g_sim_lans[g_sim_lans_num], 0, sizeof(sim_lan));
+  return g_sim_lans_num++;
+}
+
+static int sim_attach(sim_station* st, int lan)
+{ //attach st to lan and return the virtual socket
+  sim_lan* l = &g_sim_lans[lan];
+  int sd;
+
+  g_sim_socks = (sim_sock*) sim_grow(g_sim_socks, g_sim_socks_num, &g_sim_socks_max, sizeof(sim_sock));
+  g_sim_socks[g_sim_socks_num].station = st;
+  g_sim_socks[g_sim_socks_num].lan = lan;
+  sd = SIM_FIRST_SOCK + g_sim_socks_num++;
+
+  l->socks = (int*) sim_grow(l->socks, l->socks_num, &l->socks_max, sizeof(int));
+  l->socks[l->socks_num++] = sd;
+  return sd;
+}
+
+sim_station* sim_add_router(char* name, int configint, int* lans, int lans_num)
+{ //add a router attached to lans in the order of its IP addresses in the topology
+  sim_station* st;
+  HwAddr hwaddr;
+  in_addr_t ipaddrs[ADDR_NUM];
+  int netmasks[ADDR_NUM];
+  int ipaddrs_num;
+  int i;
+
+  st = (sim_station*) calloc(1, sizeof(sim_station));
+  if(st == NULL)
+  {
+    fprintf(stderr, "error : unable to calloc\n");
+    exit(1);
+  }
+  strncpy(st->name, name, NAME_SIZE-1);
+  st->configint = configint;
+
+  if(!nametohwaddr(name, hwaddr) || !dns_name_to_ipaddr(name, ipaddrs, &ipaddrs_num) ||
+     get_netmasks_for_addrs(ipaddrs, ipaddrs_num, netmasks) != ipaddrs_num || ipaddrs_num != lans_num)
+  {
+    fprintf(stderr, "error : unable to identify the addresses of %s\n", name);
+    exit(1);
+  }
+  set_router_addrinfo(&st->router, hwaddr, ipaddrs, ipaddrs_num, netmasks);
+
+  for(i = 0; i < lans_num; i++)
+    st->socks[i] = sim_attach(st, lans[i]);
+
+  dv_init_tables(&st->router, ipaddrs, netmasks, ipaddrs_num, st->socks);
+  g_sim_routes += st->router.rt_table_size;
+
+  /* the first advertisement of each router comes at a random phase of configint */
+  if(configint > 0)
+    sim_schedule(g_sim_now + sim_random() % (configint * 1000), SIM_TIMER, -1, st, NULL);
+
+  return st;
+}
+
+sim_station* sim_add_host(char* name, char* gwname, int lan)
+{ //add a host attached to lan
+  sim_station* st;
+  HwAddr hwaddr;
+  in_addr_t ipaddr;
+  int netmask;
+  in_addr_t gwaddr;
+
+  st = (sim_station*) calloc(1, sizeof(sim_station));
+  if(st == NULL)
+  {
+    fprintf(stderr, "error : unable to calloc\n");
+    exit(1);
+  }
+  strncpy(st->name, name, NAME_SIZE-1);
+
+  if(!nametohwaddr(name, hwaddr) || !nametoipaddr(name, &ipaddr) ||
+     !nametonetmask(name, &netmask) || !nametogwaddr(gwname, ipaddr, netmask, &gwaddr))
+  {
+    fprintf(stderr, "error : unable to identify the addresses of %s\n", name);
+    exit(1);
+  }
+  set_host_addrinfo(&st->router, hwaddr, ipaddr, netmask, gwaddr);
+
+  st->socks[0] = sim_attach(st, lan);
+  return st;
+}
+
+int sim_send_chat(sim_station* st, char* dstname, char* text)
+{ //let st send a chat message to dstname now
+  return send_app_message(&st->router, st->socks[0], dstname, strlen(text), DATA_CHAT, text);
+}
+
+/*--------------------------------------------------------------------*/
+/* process the events */
+static void sim_deliver(sim_event* ev)
+{ //let the station of ev->sock receive ev->frame as recvmessage() would from its hub
+  sim_station* st = g_sim_socks[ev->sock - SIM_FIRST_SOCK].station;
+  in_addr_t src;
+  ushort len;
+  u_char type;
+  char* dat;
+  char name[NAME_SIZE];
+  int rt_table_size; //size of the routing table before the DV message
+
+  g_sim_rx = ev->frame;
+  g_sim_rx_off = 0;
+  set_hub_up();
+
+  dat = recvmessage(&st->router, ev->sock, &src, &len, &type);
+  if(dat != NULL)
+  {
+    if(type == DATA_DV && st->router.kind == STATION_ROUTER)
+    {
+      rt_table_size = st->router.rt_table_size;
+      dv_update_routing_info(&st->router, ev->sock, dat, len, src);
+      g_sim_routes += st->router.rt_table_size - rt_table_size;
+    }
+    else if(type == DATA_CHAT)
+    {
+      ipaddrtoname(src, name);
+      printf("%s <- %s : %.*s\n", st->name, name, len, dat);
+      g_sim_chats++;
+    }
+    free(dat);
+  }
+
+  g_sim_rx = NULL;
+  g_sim_frames++;
+  if(--ev->frame->refs == 0)
+    free(ev->frame);
+}
+
+static void sim_timeout(sim_station* st)
+{ //the DV advertisement timer of st expires, as timeout() of router.c
+  dv_update_tables_for_timeout(&st->router, getcurtime(), st->configint);
+  dv_broadcast_dv_message(&st->router);
+
+  sim_schedule(g_sim_now + st->configint * 1000, SIM_TIMER, -1, st, NULL);
+}
+
+void sim_run(long long until, int (*done)())
+{ //process the events up to virtual time until, or until done() returns 1
+  sim_event ev;
+  unsigned long route_changes; //route changes before the event
+
+  while(g_sim_queue_size > 0 && g_sim_queue[0].time <= until)
+  {
+    if(done != NULL && done())
+      return;
+
+    ev = sim_next_event();
+    g_sim_now = ev.time;
+    g_sim_events++;
+
+    route_changes = g_stats->route_changes;
+
+    if(ev.kind == SIM_FRAME)
+      sim_deliver(&ev);
+    else
+      sim_timeout(ev.station);
+
+    if(g_stats->route_changes != route_changes)
+      g_sim_last_change = g_sim_now;
+  }
+
+  if(g_sim_now < until)
+    g_sim_now = until;
+}
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,88 @@
+/*--------------------------------------------------------------------*/
+/* sim.h: discrete-event simulation of hosts and routers in one process.
+
+   The simulator runs the code of the stations (recvmessage, sendmessage
+   and the dv_* functions) without sockets or processes:
+
+     - every attachment of a station to a LAN is a virtual socket, and
+       g_net_write/g_net_read carry the frames written on it to the other
+       stations of the LAN as delivery events
+     - g_clock_hook and g_monoclock_hook return the virtual time of the
+       event being processed,
+       and the DV advertisement timer of each router is an event instead
+       of SIGALRM
+     - each station keeps its own addresses and DV tables in a dv_router,
+       which is given to the IP helpers and the dv_* functions
+
+   Like a switch, a LAN delivers a unicast frame only to the station with
+   the destination MAC address. */
+
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include "common.h"
+#include "dist-vec.h"
+
+#define SIM_LINK_DELAY 1
+//delay of a frame on a LAN in milliseconds
+
+#define SIM_FIRST_SOCK 3
+//first virtual socket descriptor, past stdin, stdout and stderr
+
+/* event kind */
+enum SIM_EVENT
+{
+  SIM_FRAME = 0, //delivery of a frame to a station
+  SIM_TIMER = 1  //DV advertisement timer of a router
+};
+
+/* frame in flight; shared by its deliveries */
+typedef struct _sim_frame
+{
+  int refs; //number of deliveries left
+  int len; //length of dat
+  char dat[1]; //frame as written on the socket
+} sim_frame;
+
+/* scheduled event */
+typedef struct _sim_event
+{
+  long long time; //virtual time in milliseconds
+  unsigned long seq; //order of scheduling among events of the same time
+  int kind; //SIM_FRAME or SIM_TIMER
+  int sock; //virtual socket receiving the frame
+  struct _sim_station* station; //station of the timer
+  sim_frame* frame; //frame to deliver
+} sim_event;
+
+/* simulated host or router */
+typedef struct _sim_station
+{
+  char name[NAME_SIZE]; //DNS name
+  dv_router router; //addresses and, for a router, DV tables
+  int socks[ADDR_NUM]; //virtual sockets to the LANs, one per IP address
+  int configint; //DV advertisement interval of a router in seconds
+} sim_station;
+
+extern long long g_sim_now; //virtual time in milliseconds
+extern unsigned long g_sim_events; //number of events processed
+extern unsigned long g_sim_frames; //number of frames delivered
+extern long g_sim_routes; //number of routing entries of all the routers
+extern long long g_sim_last_change; //virtual time of the last route change
+extern unsigned long g_sim_chats; //number of chat messages delivered to the stations
+
+void sim_init(); //hook the socket I/O and the clock into the simulator
+
+int sim_add_lan(); //add a LAN and return its index
+
+sim_station* sim_add_router(char* name, int configint, int* lans, int lans_num); //add a router attached to lans in the order of its IP addresses in the topology
+
+sim_station* sim_add_host(char* name, char* gwname, int lan); //add a host attached to lan
+
+int sim_send_chat(sim_station* st, char* dstname, char* text); //let st send a chat message to dstname now
+
+void sim_run(long long until, int (*done)()); //process the events up to virtual time until, or until done() returns 1
+
+unsigned long sim_random(); //pseudo-random number of a fixed sequence for reproducible runs
+
+#endif
@@ -0,0 +1,178 @@
+/*--------------------------------------------------------------------*/
+/* stats.c: per-station counters */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "stats.h"
+/*--------------------------------------------------------------------*/
+
+/* statistics block used until the first port is counted; it has no per-port counters */
+station_stats g_local_stats;
+
+station_stats* g_stats = &g_local_stats; //statistics block of this station
+size_t g_stats_size = sizeof(station_stats); //size of g_stats including its per-port counters
+int g_stats_mapped; //whether g_stats is mapped from the exported file
+
+/* name of the exported statistics file */
+char g_stats_file[MAXSTRING];
+
+char* g_drop_reason_names[DROP_REASON_NUM] = { "wrong MAC", "wrong IP", "no route", "queue full", "policed", "TTL expired",
+                                             "malformed", "bad checksum", "unsupported" };
+
+/*--------------------------------------------------------------------*/
+void stats_init(char* name, int kind)
+{ //initialize the statistics block
+  if(g_stats != &g_local_stats && !g_stats_mapped) //counted before this; start over
+    free(g_stats);
+  g_stats = &g_local_stats;
+  g_stats_size = sizeof(station_stats);
+  memset(g_stats, 0, sizeof(station_stats)); //the counters of the ports are allocated at the first one
+  g_stats->magic = STATS_MAGIC;
+  g_stats->version = STATS_VERSION;
+  g_stats->pid = getpid();
+  g_stats->kind = kind;
+  strncpy(g_stats->name, name, NAME_SIZE-1);
+  g_stats->start_time = getcurtime();
+}
+
+int stats_export()
+{ //move the statistics block into the shared file ".<name>.stats" for external tools
+  station_stats* shared;
+  int fd;
+
+  sprintf(g_stats_file, ".%s.stats", g_stats->name);
+  fd = open(g_stats_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd == -1)
+  {
+    perror("stats_export(): open");
+    return 0;
+  }
+
+  if(ftruncate(fd, g_stats_size) == -1)
+  {
+    perror("stats_export(): ftruncate");
+    close(fd);
+    return 0;
+  }
+
+  shared = (station_stats*) mmap(NULL, g_stats_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(shared == MAP_FAILED)
+  {
+    perror("stats_export(): mmap");
+    return 0;
+  }
+
+  memcpy(shared, g_stats, g_stats_size);
+  if(g_stats != &g_local_stats)
+    free(g_stats);
+  g_stats = shared;
+  g_stats_mapped = 1;
+  return 1;
+}
+
+port_stats* stats_grow_ports(int sd)
+{ //grow the per-port counters to hold socket sd and return its counters; an exported file grows with them
+  static port_stats discard; //counters of an invalid socket, or of one the block cannot grow to
+  station_stats* st;
+  size_t size;
+  int num;
+  int fd;
+
+  if(sd < 0)
+    return &discard;
+  if(sd < g_stats->ports_num)
+    return STATS_PORTS(g_stats) + sd;
+
+  for(num = (g_stats->ports_num > 0) ? 2*g_stats->ports_num : STATS_INIT_PORTS; num <= sd; num *= 2)
+    ;
+  size = sizeof(station_stats) + num*sizeof(port_stats);
+
+  if(g_stats_mapped)
+  { //extend the shared file and map it again; a tool maps it again when ports_num changes
+    fd = open(g_stats_file, O_RDWR);
+    if(fd == -1 || ftruncate(fd, size) == -1)
+    {
+      perror("stats_grow_ports(): ftruncate");
+      if(fd != -1)
+        close(fd);
+      return &discard;
+    }
+
+    st = (station_stats*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(st == MAP_FAILED)
+    {
+      perror("stats_grow_ports(): mmap");
+      return &discard;
+    }
+    munmap(g_stats, g_stats_size);
+  }
+  else
+  {
+    st = (station_stats*) calloc(1, size);
+    if(st == NULL)
+    {
+      fprintf(stderr, "error : unable to calloc\n");
+      exit(1);
+    }
+    memcpy(st, g_stats, g_stats_size);
+    if(g_stats != &g_local_stats)
+      free(g_stats);
+  }
+
+  st->ports_num = num;
+  g_stats = st;
+  g_stats_size = size;
+  return STATS_PORTS(g_stats) + sd;
+}
+
+void stats_show()
+{ //show statistics
+  port_stats* ps;
+  int i;
+
+  printf("STATISTICS OF %s (up %ld sec)\n", g_stats->name, getcurtime() - g_stats->start_time);
+  printf("  Port | RxFrames | RxBytes | TxFrames | TxBytes\n");
+  for(i = 0; i < g_stats->ports_num; i++)
+  {
+    ps = STATS_PORTS(g_stats) + i;
+    if(ps->rx_frames == 0 && ps->tx_frames == 0)
+      continue;
+
+    printf("  %4d | %lu | %lu | %lu | %lu\n", i, ps->rx_frames, ps->rx_bytes, ps->tx_frames, ps->tx_bytes);
+  }
+
+  printf("  Drops :");
+  for(i = 0; i < DROP_REASON_NUM; i++)
+    printf(" %s=%lu", g_drop_reason_names[i], g_stats->drops[i]);
+  printf("\n");
+
+  if(g_stats->kind == STATION_ROUTER)
+  {
+    printf("  DV adverts sent=%lu rcvd=%lu | DV breakages sent=%lu rcvd=%lu | route changes=%lu\n",
+	   g_stats->dv_adverts_sent, g_stats->dv_adverts_rcvd,
+	   g_stats->dv_breakages_sent, g_stats->dv_breakages_rcvd, g_stats->route_changes);
+    printf("  Flow cache hits=%lu misses=%lu\n", g_stats->flow_cache_hits, g_stats->flow_cache_misses);
+  }
+
+  if(g_stats->bulk_segs_sent > 0 || g_stats->bulk_segs_rcvd > 0 || g_stats->bulk_segs_dropped > 0)
+  {
+    printf("  Bulk segments sent=%lu rcvd=%lu dropped=%lu | bulk bytes rcvd=%lu\n",
+	   g_stats->bulk_segs_sent, g_stats->bulk_segs_rcvd, g_stats->bulk_segs_dropped, g_stats->bulk_bytes_rcvd);
+    printf("  Bulk retransmissions=%lu timeouts=%lu | bulk ACKs rcvd=%lu\n",
+	   g_stats->bulk_segs_retx, g_stats->bulk_timeouts, g_stats->bulk_acks_rcvd);
+  }
+
+  printf("  Allocations : %lu\n", g_stats->allocs);
+  fflush(NULL);
+}
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,96 @@
+/*--------------------------------------------------------------------*/
+/* stats.h: per-station counters for frames, bytes, drops, allocations
+   and DV events.
+
+   Every station (hub, host or router) runs a single thread, which is the
+   only writer of its statistics block. The block can be exported into a
+   shared file ".<name>.stats" that an external tool maps read-only and
+   polls, so reading the counters never disturbs the data path. */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "common.h"
+
+#define STATS_MAGIC 0x53544154
+//magic number at the head of the exported statistics file ("STAT")
+
+#define STATS_VERSION 9
+//layout version of station_stats
+
+#define STATS_INIT_PORTS 64
+//per-port counters allocated at first; the block grows when a larger socket descriptor is counted
+
+/* reason of a dropped packet */
+enum STATS_DROP
+{
+  DROP_WRONG_MAC = 0,  //ethernet frame destined to another station
+  DROP_WRONG_IP = 1,   //IP packet destined to another station
+  DROP_NO_ROUTE = 2,   //no forwarding entry for the destination
+  DROP_QUEUE_FULL = 3, //egress queue is full
+  DROP_POLICED = 4,    //frame exceeding the policer of its port
+  DROP_TTL_EXPIRED = 5, //IP packet whose TTL ran out at a router
+  DROP_MALFORMED = 6,  //frame or IP packet of a wrong length or version
+  DROP_BAD_CKSUM = 7,  //IP packet with a wrong header checksum
+  DROP_UNSUPPORTED = 8, //IP packet of a type its receiver does not take
+  DROP_REASON_NUM = 9  //number of drop reasons
+};
+
+/* counters of an interface port */
+typedef struct _port_stats
+{
+  unsigned long rx_frames; //received ethernet frames
+  unsigned long rx_bytes; //received bytes including ethernet header
+  unsigned long tx_frames; //sent ethernet frames
+  unsigned long tx_bytes; //sent bytes including ethernet header
+} port_stats;
+
+/* statistics block of a station; port_stats[ports_num] indexed by socket descriptor follows it */
+typedef struct _station_stats
+{
+  unsigned int magic; //STATS_MAGIC
+  unsigned int version; //STATS_VERSION
+  int pid; //process id of the station
+  int kind; //station kind = {STATION_HUB, STATION_HOST, STATION_ROUTER}
+  char name[NAME_SIZE]; //station name (LAN name for a hub)
+  long start_time; //the time when the station started
+
+  int ports_num; //number of per-port counters following the block
+  unsigned long drops[DROP_REASON_NUM]; //dropped packets per reason
+
+  unsigned long dv_adverts_sent; //DV advertisement messages sent
+  unsigned long dv_adverts_rcvd; //DV advertisement messages received
+  unsigned long dv_breakages_sent; //DV link breakage messages sent
+  unsigned long dv_breakages_rcvd; //DV link breakage messages received
+  unsigned long route_changes; //routing entries added, changed or brought down
+  unsigned long flow_cache_hits; //forwarded packets whose decision was found in the flow cache
+  unsigned long flow_cache_misses; //forwarded packets looked up in the forwarding table
+
+  unsigned long bulk_segs_sent; //bulk segments sent
+  unsigned long bulk_segs_rcvd; //bulk segments copied into a reassembly buffer
+  unsigned long bulk_segs_dropped; //bulk segments malformed, duplicated or out of the window
+  unsigned long bulk_bytes_rcvd; //bytes of completed bulk transfers
+  unsigned long bulk_segs_retx; //bulk segments sent again
+  unsigned long bulk_acks_rcvd; //bulk ACKs matching a transfer being sent
+  unsigned long bulk_timeouts; //bulk retransmission timeouts
+
+  unsigned long allocs; //memory allocations on the packet path
+} station_stats;
+
+extern station_stats* g_stats; //statistics block of this station
+
+/* per-port counters following the statistics block st */
+#define STATS_PORTS(st) ((port_stats*) ((station_stats*) (st) + 1))
+
+/* return the counters of the port for socket sd */
+#define STATS_PORT(sd) (((sd) >= 0 && (sd) < g_stats->ports_num) ? STATS_PORTS(g_stats) + (sd) : stats_grow_ports(sd))
+
+void stats_init(char* name, int kind); //initialize the statistics block
+
+int stats_export(); //move the statistics block into the shared file ".<name>.stats"
+
+void stats_show(); //show statistics
+
+port_stats* stats_grow_ports(int sd); //grow the per-port counters to hold socket sd and return its counters
+
+#endif
@@ -0,0 +1,160 @@
+/*--------------------------------------------------------------------*/
+/* token-bucket.c: token buckets for policing and shaping */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "stats.h"
+#include "token-bucket.h"
+/*--------------------------------------------------------------------*/
+
+token_bucket* g_police; //policers indexed by socket descriptor
+int g_police_size; //number of slots of g_police
+/*--------------------------------------------------------------------*/
+
+static void tb_refill(token_bucket* tb)
+{ //add the tokens earned since the last refill
+  long long now = getmonotime();
+
+  tb->tokens += (now - tb->last) * (double) tb->rate / 1000000;
+  if(tb->tokens > tb->burst)
+    tb->tokens = tb->burst;
+  tb->last = now;
+}
+
+void tb_set(token_bucket* tb, long rate, long burst)
+{ //set rate and burst and fill the bucket; rate 0 turns it off
+  tb->rate = rate;
+  tb->burst = burst;
+  tb->tokens = burst;
+  tb->last = getmonotime();
+}
+
+int tb_conform(token_bucket* tb, int len)
+{ //take len tokens and return 1 if they are there, or return 0; counts the frame either way
+  int need = len;
+
+  if(tb->rate > 0)
+  {
+    /* a frame larger than the burst conforms to a full bucket, or it would exceed forever */
+    if(need > tb->burst)
+      need = tb->burst;
+
+    tb_refill(tb);
+    if(tb->tokens < need)
+    {
+      tb->exceed_frames++;
+      tb->exceed_bytes += len;
+      return 0;
+    }
+    tb->tokens -= need;
+  }
+
+  tb->conform_frames++;
+  tb->conform_bytes += len;
+  return 1;
+}
+
+long long tb_delay(token_bucket* tb, int len)
+{ //microseconds until len tokens are there; 0 if they are now or the bucket is off
+  if(tb->rate == 0)
+    return 0;
+
+  /* a frame larger than the burst waits for a full bucket and may then go */
+  if(len > tb->burst)
+    len = tb->burst;
+
+  tb_refill(tb);
+  if(tb->tokens >= len)
+    return 0;
+
+  return (long long) ((len - tb->tokens) * 1000000 / tb->rate) + 1;
+}
+
+int tb_parse(char* text, long* rate, long* burst)
+{ //parse "<kbit/s> <burst bytes>" or "off"; return 0 if invalid
+  long kbps;
+
+  if(strcasecmp(text, "off") == 0)
+  {
+    *rate = 0;
+    *burst = 0;
+    return 1;
+  }
+
+  if(sscanf(text, "%ld %ld", &kbps, burst) != 2 || kbps <= 0 || *burst < BUF_SIZE)
+    return 0;
+
+  *rate = kbps * 1000 / 8;
+  return 1;
+}
+/*--------------------------------------------------------------------*/
+
+int police_frame(int sd, int len)
+{ //return 1 if a frame of len bytes received on sd conforms to its policer
+  if(sd < 0 || sd >= g_police_size) //never policed
+    return 1;
+
+  return tb_conform(&g_police[sd], len);
+}
+
+void police_set(int sd, long rate, long burst)
+{ //set the policer of sd; rate 0 turns it off
+  int size;
+
+  if(sd < 0 || (sd >= g_police_size && rate == 0))
+    return;
+
+  if(sd >= g_police_size)
+  {
+    size = g_police_size ? g_police_size * 2 : TB_INIT_PORTS;
+    while(sd >= size)
+      size *= 2;
+    g_police = (token_bucket*) realloc(g_police, size * sizeof(token_bucket));
+    if(g_police == NULL)
+    {
+      fprintf(stderr, "error : unable to realloc\n");
+      exit(1);
+    }
+    memset(g_police + g_police_size, 0, (size - g_police_size) * sizeof(token_bucket));
+    g_police_size = size;
+  }
+
+  tb_set(&g_police[sd], rate, burst);
+}
+
+void police_reset(int sd)
+{ //turn the policer of sd off and clear its counters
+  if(sd < 0 || sd >= g_police_size)
+    return;
+
+  memset(&g_police[sd], 0, sizeof(token_bucket));
+}
+
+void police_show()
+{ //show the policers that are on or have counted frames
+  token_bucket* tb;
+  char* lanname;
+  int i;
+
+  printf("POLICERS\n");
+  printf("  Port | LAN | Rate (kbit/s) | Burst | Conform frames/bytes | Exceed frames/bytes\n");
+  for(i = 0; i < g_police_size; i++)
+  {
+    tb = &g_police[i];
+    if(tb->rate == 0 && tb->exceed_frames == 0)
+      continue;
+
+    lanname = get_lanname(i);
+    printf("  %4d | %s | %ld | %ld | %lu/%lu | %lu/%lu\n", i, lanname ? lanname : "-",
+           tb->rate * 8 / 1000, tb->burst, tb->conform_frames, tb->conform_bytes,
+           tb->exceed_frames, tb->exceed_bytes);
+  }
+  fflush(NULL);
+}
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,49 @@
+/*--------------------------------------------------------------------*/
+/* token-bucket.h: token buckets for policing and shaping.
+
+   A bucket fills with tokens at rate bytes per second up to burst bytes,
+   and a frame of n bytes conforms when it finds n tokens, which it takes.
+   A policer drops the frames that exceed; it is kept per socket, so a hub
+   polices each station connected to it and a router each of its links.
+   A shaper (see egress.h) holds them in the queue until the tokens are
+   there. A frame larger than the burst takes a full bucket. A bucket with
+   rate 0 is off and every frame conforms. */
+
+#ifndef __TOKEN_BUCKET_H__
+#define __TOKEN_BUCKET_H__
+
+#include "common.h"
+
+#define TB_INIT_PORTS 64
+//policers are kept per socket descriptor; the table grows to the largest descriptor policed
+
+/* token bucket with its counters */
+typedef struct _token_bucket
+{
+  long rate; //bytes per second; 0 if the bucket is off
+  long burst; //depth of the bucket in bytes
+  double tokens; //bytes the bucket holds
+  long long last; //monotonic time of the last refill in microseconds
+  unsigned long conform_frames; //frames that found their tokens
+  unsigned long conform_bytes;
+  unsigned long exceed_frames; //frames that did not (dropped by a policer, delayed by a shaper)
+  unsigned long exceed_bytes;
+} token_bucket;
+
+void tb_set(token_bucket* tb, long rate, long burst); //set rate and burst and fill the bucket; rate 0 turns it off
+
+int tb_conform(token_bucket* tb, int len); //take len tokens and return 1 if they are there, or return 0; counts the frame either way
+
+long long tb_delay(token_bucket* tb, int len); //microseconds until len tokens are there; 0 if they are now or the bucket is off
+
+int tb_parse(char* text, long* rate, long* burst); //parse "<kbit/s> <burst bytes>" or "off"; return 0 if invalid
+
+int police_frame(int sd, int len); //return 1 if a frame of len bytes received on sd conforms to its policer
+
+void police_set(int sd, long rate, long burst); //set the policer of sd; rate 0 turns it off
+
+void police_reset(int sd); //turn the policer of sd off and clear its counters
+
+void police_show(); //show the policers that are on or have counted frames
+
+#endif
@@ -0,0 +1,45 @@
+/*--------------------------------------------------------------------*/
+/* topo-compile.c: compile the conf files into a topology image.
+
+   usage : topo_compile [<image file>]
+
+   It parses mac-addr.conf, ip-addr.conf and gateway.conf in the current
+   directory and writes their image with the hash indexes into the image
+   file (topology.db by default). Hubs, hosts and routers started in the
+   same directory map the image instead of parsing the conf files, as long
+   as it is newer than all of them. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "topo-db.h"
+/*--------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+  char* file = TOPO_FILE;
+
+  if (argc > 2) {
+    fprintf(stderr, "usage : %s [<image file>]\n", argv[0]);
+    exit(1);
+  }
+
+  if (argc == 2)
+    file = argv[1];
+
+  /* always parse the conf files */
+  g_topo_image_file = NULL;
+  if (!init_mac_table(MAC_FILE) || !init_ip_table(IP_FILE) || !init_gw_table(GW_FILE))
+    exit(1);
+
+  if (!topo_write(file))
+    exit(1);
+
+  printf("%s : %u MAC, %u IP and %u gateway entries in %u bytes\n", file,
+	 g_topo->mac_num, g_topo->ip_num, g_topo->gw_num, g_topo->size);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,668 @@
+/*--------------------------------------------------------------------*/
+/* topo-db.c: topology database of MAC addresses, IP addresses and
+   default gateways */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "common.h"
+#include "topo-db.h"
+/*--------------------------------------------------------------------*/
+
+topo_header* g_topo; //topology image in use
+size_t g_topo_mapped_size; //size of the mapping if g_topo is a mapped file; 0 if it is built in memory
+int g_topo_image_tried; //whether g_topo_image_file has been tried
+
+char* g_topo_image_file = TOPO_FILE; //compiled image tried before the conf files
+
+/* entries parsed from the conf files and staged for topo_build(); names are interned */
+typedef struct _topo_stage_mac
+{
+  char* name; //node name
+  HwAddr addr; //node MAC address
+} topo_stage_mac;
+
+typedef struct _topo_stage_ip
+{
+  char* name; //name
+  in_addr_t addr; //IP address
+  int mask; //subnet mask
+} topo_stage_ip;
+
+typedef struct _topo_stage_gw
+{
+  char* host; //host name
+  char* gw; //gateway name
+} topo_stage_gw;
+
+topo_stage_mac* g_stage_mac;
+int g_stage_mac_num, g_stage_mac_max;
+
+topo_stage_ip* g_stage_ip;
+int g_stage_ip_num, g_stage_ip_max;
+
+topo_stage_gw* g_stage_gw;
+int g_stage_gw_num, g_stage_gw_max;
+
+/*--------------------------------------------------------------------*/
+unsigned int topo_hash_name(char* name)
+{ //hash a name
+  unsigned int h = 2166136261U; //FNV-1a
+
+  while(*name)
+  {
+    h ^= (unsigned char) *name++;
+    h *= 16777619U;
+  }
+  return h;
+}
+
+unsigned int topo_hash_ipaddr(in_addr_t addr)
+{ //hash an IP address
+  unsigned int h = addr * 2654435761U;
+
+  return h ^ (h >> 16);
+}
+
+unsigned int topo_hash_hwaddr(HwAddr addr)
+{ //hash a MAC address
+  unsigned int h = 2166136261U; //FNV-1a
+  int i;
+
+  for(i = 0; i < sizeof(HwAddr); i++)
+  {
+    h ^= addr[i];
+    h *= 16777619U;
+  }
+  return h;
+}
+/*--------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------*/
+/* release the image in use */
+static void topo_release()
+{
+  if(g_topo == NULL)
+    return;
+
+  if(g_topo_mapped_size > 0)
+    munmap(g_topo, g_topo_mapped_size);
+  else
+    free(g_topo);
+
+  g_topo = NULL;
+  g_topo_mapped_size = 0;
+}
+
+/* whether a was modified after b; equal times cannot tell, so they do not count as newer */
+static int topo_newer(struct stat* a, struct stat* b)
+{
+#ifdef __linux__
+  if(a->st_mtim.tv_sec != b->st_mtim.tv_sec)
+    return a->st_mtim.tv_sec > b->st_mtim.tv_sec;
+  return a->st_mtim.tv_nsec > b->st_mtim.tv_nsec;
+#else
+  return a->st_mtime > b->st_mtime;
+#endif
+}
+
+/* whether num entries of elem_size bytes at off lie inside an image of size bytes */
+static int topo_region_ok(unsigned int off, unsigned int num, unsigned int elem_size, unsigned int size)
+{
+  return (unsigned long long) off + (unsigned long long) num * elem_size <= size;
+}
+
+/* whether every slot of the hash index at off refers to one of num entries, and one slot is empty to end the probes */
+static int topo_index_ok(topo_header* image, unsigned int off, unsigned int num)
+{
+  unsigned int* index = (unsigned int*) ((char*) image + off);
+  int empty = 0;
+  unsigned int h;
+
+  for(h = 0; h < image->index_size; h++)
+  {
+    if(index[h] > num)
+      return 0;
+    if(index[h] == 0)
+      empty = 1;
+  }
+  return empty;
+}
+
+/* check every region of a mapped image and every offset and link in it before any lookup follows them */
+static int topo_image_ok(topo_header* image)
+{
+  topo_mac_entry* mac;
+  topo_ip_entry* ip;
+  topo_gw_entry* gw;
+  unsigned int n = image->index_size;
+  unsigned int i;
+
+  if((n == 0) || ((n & (n-1)) != 0)) //the lookups mask hashes with index_size-1
+    return 0;
+
+  if(!topo_region_ok(image->mac_off, image->mac_num, sizeof(topo_mac_entry), image->size) ||
+     !topo_region_ok(image->ip_off, image->ip_num, sizeof(topo_ip_entry), image->size) ||
+     !topo_region_ok(image->gw_off, image->gw_num, sizeof(topo_gw_entry), image->size) ||
+     !topo_region_ok(image->mac_name_index_off, n, sizeof(unsigned int), image->size) ||
+     !topo_region_ok(image->mac_addr_index_off, n, sizeof(unsigned int), image->size) ||
+     !topo_region_ok(image->ip_name_index_off, n, sizeof(unsigned int), image->size) ||
+     !topo_region_ok(image->ip_addr_index_off, n, sizeof(unsigned int), image->size) ||
+     !topo_region_ok(image->str_off, image->str_size, 1, image->size))
+    return 0;
+
+  /* the last name of the string pool is terminated, so a name starting in the pool ends in it */
+  if((image->str_size > 0) && (((char*) image)[image->str_off + image->str_size - 1] != '\0'))
+    return 0;
+
+  if(!topo_index_ok(image, image->mac_name_index_off, image->mac_num) ||
+     !topo_index_ok(image, image->mac_addr_index_off, image->mac_num) ||
+     !topo_index_ok(image, image->ip_name_index_off, image->ip_num) ||
+     !topo_index_ok(image, image->ip_addr_index_off, image->ip_num))
+    return 0;
+
+  mac = (topo_mac_entry*) ((char*) image + image->mac_off);
+  for(i = 0; i < image->mac_num; i++)
+  {
+    if(mac[i].name >= image->str_size)
+      return 0;
+  }
+
+  /* topo_build() chains an entry only after the ones before it, so a next going forward cannot loop */
+  ip = (topo_ip_entry*) ((char*) image + image->ip_off);
+  for(i = 0; i < image->ip_num; i++)
+  {
+    if((ip[i].name >= image->str_size) ||
+       ((ip[i].next != -1) && ((ip[i].next <= (int) i) || (ip[i].next >= (int) image->ip_num))) ||
+       ((ip[i].mac != -1) && ((ip[i].mac < 0) || (ip[i].mac >= (int) image->mac_num))))
+      return 0;
+  }
+
+  gw = (topo_gw_entry*) ((char*) image + image->gw_off);
+  for(i = 0; i < image->gw_num; i++)
+  {
+    if((gw[i].host >= image->str_size) || (gw[i].gw >= image->str_size))
+      return 0;
+  }
+
+  return 1;
+}
+
+int topo_load_image()
+{ //map g_topo_image_file if it is newer than the conf files; return 1 if the image is in use
+  char* conf_files[3] = { MAC_FILE, IP_FILE, GW_FILE };
+  struct stat image_st, conf_st;
+  topo_header* image;
+  int fd;
+  int i;
+
+  if(g_topo_image_file == NULL)
+    return 0;
+
+  if(g_topo_image_tried)
+    return (g_topo != NULL) && (g_topo_mapped_size > 0);
+  g_topo_image_tried = 1;
+
+  if(stat(g_topo_image_file, &image_st) == -1) //there is no compiled image
+    return 0;
+
+  for(i = 0; i < 3; i++)
+  {
+    if((stat(conf_files[i], &conf_st) == 0) && !topo_newer(&image_st, &conf_st))
+    {
+      printf("topo_load_image(): %s is not newer than %s, so the conf files are parsed\n", g_topo_image_file, conf_files[i]);
+      return 0;
+    }
+  }
+
+  if(image_st.st_size < sizeof(topo_header))
+  {
+    printf("topo_load_image(): %s is too short\n", g_topo_image_file);
+    return 0;
+  }
+
+  fd = open(g_topo_image_file, O_RDONLY);
+  if(fd == -1)
+  {
+    perror("topo_load_image(): open");
+    return 0;
+  }
+
+  image = (topo_header*) mmap(NULL, image_st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(image == MAP_FAILED)
+  {
+    perror("topo_load_image(): mmap");
+    return 0;
+  }
+
+  if((image->magic != TOPO_MAGIC) || (image->version != TOPO_VERSION) || (image->size != image_st.st_size))
+  {
+    printf("topo_load_image(): %s is not a topology image of version %d\n", g_topo_image_file, TOPO_VERSION);
+    munmap(image, image_st.st_size);
+    return 0;
+  }
+
+  if(!topo_image_ok(image))
+  {
+    printf("topo_load_image(): %s is corrupt, so the conf files are parsed\n", g_topo_image_file);
+    munmap(image, image_st.st_size);
+    return 0;
+  }
+
+  topo_release();
+  g_topo = image;
+  g_topo_mapped_size = image_st.st_size;
+  return 1;
+}
+/*--------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------*/
+/* make room for one more staged entry of elem_size bytes */
+static void* topo_grow(void* arr, int num, int* max, int elem_size)
+{
+  if(num < *max)
+    return arr;
+
+  *max = (*max == 0) ? 64 : 2*(*max);
+  arr = realloc(arr, (*max)*elem_size);
+  if(arr == NULL)
+  {
+    fprintf(stderr, "error : unable to realloc\n");
+    exit(1);
+  }
+  return arr;
+}
+
+void topo_reset_mac()
+{ //forget the staged MAC entries before parsing the MAC conf file
+  g_stage_mac_num = 0;
+}
+
+void topo_reset_ip()
+{ //forget the staged IP entries before parsing the IP conf file
+  g_stage_ip_num = 0;
+}
+
+void topo_reset_gw()
+{ //forget the staged gateway entries before parsing the gateway conf file
+  g_stage_gw_num = 0;
+}
+
+void topo_add_mac(char* name, HwAddr addr)
+{ //stage a MAC entry parsed from the conf file
+  g_stage_mac = (topo_stage_mac*) topo_grow(g_stage_mac, g_stage_mac_num, &g_stage_mac_max, sizeof(topo_stage_mac));
+  g_stage_mac[g_stage_mac_num].name = intern_name(name);
+  hwaddrcpy(g_stage_mac[g_stage_mac_num].addr, addr);
+  g_stage_mac_num++;
+}
+
+void topo_add_ip(char* name, in_addr_t addr, int mask)
+{ //stage an IP entry parsed from the conf file
+  g_stage_ip = (topo_stage_ip*) topo_grow(g_stage_ip, g_stage_ip_num, &g_stage_ip_max, sizeof(topo_stage_ip));
+  g_stage_ip[g_stage_ip_num].name = intern_name(name);
+  g_stage_ip[g_stage_ip_num].addr = addr;
+  g_stage_ip[g_stage_ip_num].mask = mask;
+  g_stage_ip_num++;
+}
+
+void topo_add_gw(char* host, char* gw)
+{ //stage a gateway entry parsed from the conf file
+  g_stage_gw = (topo_stage_gw*) topo_grow(g_stage_gw, g_stage_gw_num, &g_stage_gw_max, sizeof(topo_stage_gw));
+  g_stage_gw[g_stage_gw_num].host = intern_name(host);
+  g_stage_gw[g_stage_gw_num].gw = intern_name(gw);
+  g_stage_gw_num++;
+}
+/*--------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------*/
+/* string pool under construction: interned name -> offset */
+typedef struct _topo_str_map
+{
+  char** name; //interned names
+  unsigned int* off; //offsets of the names in the string pool
+  int size; //number of slots (a power of 2)
+  unsigned int pool_size; //size of the string pool so far
+} topo_str_map;
+
+/* return the offset of an interned name in the string pool, adding it if it is new */
+static unsigned int topo_str_offset(topo_str_map* map, char* name)
+{
+  int h;
+
+  for(h = topo_hash_name(name) & (map->size-1); map->name[h] != NULL; h = (h+1) & (map->size-1))
+  {
+    if(map->name[h] == name) //interned names are compared by pointer
+      return map->off[h];
+  }
+
+  map->name[h] = name;
+  map->off[h] = map->pool_size;
+  map->pool_size += strlen(name) + 1;
+  return map->off[h];
+}
+
+/* insert entry i into the hash index at off unless find() already knows the key */
+#define TOPO_INDEX_INSERT(off, hash, found, i) \
+  do { \
+    unsigned int* index = (unsigned int*) TOPO_PTR(off); \
+    int h; \
+    if((found) == -1) \
+    { \
+      for(h = (hash) & (g_topo->index_size-1); index[h] != 0; h = (h+1) & (g_topo->index_size-1)) \
+        ; \
+      index[h] = (i)+1; \
+    } \
+  } while(0)
+
+void topo_build()
+{ //build the image of the staged entries in memory and use it
+  topo_header hdr;
+  topo_header* image;
+  topo_str_map map;
+  unsigned int* mac_name; //name offsets of the staged entries
+  unsigned int* ip_name;
+  unsigned int* gw_host;
+  unsigned int* gw_gw;
+  int names; //upper bound of the number of distinct names
+  int i, j;
+
+  /* assign every distinct name its offset in the string pool */
+  names = g_stage_mac_num + g_stage_ip_num + 2*g_stage_gw_num;
+  for(map.size = 16; map.size < 2*names; map.size *= 2)
+    ;
+  map.name = (char**) calloc(map.size, sizeof(char*));
+  map.off = (unsigned int*) calloc(map.size, sizeof(unsigned int));
+  mac_name = (unsigned int*) malloc((g_stage_mac_num+1)*sizeof(unsigned int));
+  ip_name = (unsigned int*) malloc((g_stage_ip_num+1)*sizeof(unsigned int));
+  gw_host = (unsigned int*) malloc((g_stage_gw_num+1)*sizeof(unsigned int));
+  gw_gw = (unsigned int*) malloc((g_stage_gw_num+1)*sizeof(unsigned int));
+  if(!map.name || !map.off || !mac_name || !ip_name || !gw_host || !gw_gw)
+  {
+    fprintf(stderr, "error : unable to malloc\n");
+    exit(1);
+  }
+  map.pool_size = 0;
+
+  for(i = 0; i < g_stage_mac_num; i++)
+    mac_name[i] = topo_str_offset(&map, g_stage_mac[i].name);
+  for(i = 0; i < g_stage_ip_num; i++)
+    ip_name[i] = topo_str_offset(&map, g_stage_ip[i].name);
+  for(i = 0; i < g_stage_gw_num; i++)
+  {
+    gw_host[i] = topo_str_offset(&map, g_stage_gw[i].host);
+    gw_gw[i] = topo_str_offset(&map, g_stage_gw[i].gw);
+  }
+
+  /* lay out the image */
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = TOPO_MAGIC;
+  hdr.version = TOPO_VERSION;
+  hdr.mac_num = g_stage_mac_num;
+  hdr.ip_num = g_stage_ip_num;
+  hdr.gw_num = g_stage_gw_num;
+  for(hdr.index_size = 16; hdr.index_size < 2*hdr.mac_num || hdr.index_size < 2*hdr.ip_num; hdr.index_size *= 2)
+    ;
+
+  hdr.mac_off = sizeof(topo_header);
+  hdr.ip_off = hdr.mac_off + hdr.mac_num*sizeof(topo_mac_entry);
+  hdr.gw_off = hdr.ip_off + hdr.ip_num*sizeof(topo_ip_entry);
+  hdr.mac_name_index_off = hdr.gw_off + hdr.gw_num*sizeof(topo_gw_entry);
+  hdr.mac_addr_index_off = hdr.mac_name_index_off + hdr.index_size*sizeof(unsigned int);
+  hdr.ip_name_index_off = hdr.mac_addr_index_off + hdr.index_size*sizeof(unsigned int);
+  hdr.ip_addr_index_off = hdr.ip_name_index_off + hdr.index_size*sizeof(unsigned int);
+  hdr.str_off = hdr.ip_addr_index_off + hdr.index_size*sizeof(unsigned int);
+  hdr.str_size = (map.pool_size + 3) & ~3;
+  hdr.size = hdr.str_off + hdr.str_size;
+
+  image = (topo_header*) calloc(1, hdr.size);
+  if(image == NULL)
+  {
+    fprintf(stderr, "error : unable to calloc\n");
+    exit(1);
+  }
+  memcpy(image, &hdr, sizeof(hdr));
+
+  topo_release();
+  g_topo = image;
+
+  /* fill in the string pool and the entries */
+  for(i = 0; i < map.size; i++)
+  {
+    if(map.name[i] != NULL)
+      strcpy(TOPO_NAME(map.off[i]), map.name[i]);
+  }
+
+  for(i = 0; i < g_topo->mac_num; i++)
+  {
+    TOPO_MAC(i)->name = mac_name[i];
+    hwaddrcpy(TOPO_MAC(i)->addr, g_stage_mac[i].addr);
+  }
+
+  for(i = 0; i < g_topo->ip_num; i++)
+  {
+    TOPO_IP(i)->name = ip_name[i];
+    TOPO_IP(i)->addr = g_stage_ip[i].addr;
+    TOPO_IP(i)->mask = g_stage_ip[i].mask;
+    TOPO_IP(i)->next = -1;
+  }
+
+  for(i = 0; i < g_topo->gw_num; i++)
+  {
+    TOPO_GW(i)->host = gw_host[i];
+    TOPO_GW(i)->gw = gw_gw[i];
+  }
+
+  /* build the hash indexes; the first entry wins on duplicated keys */
+  for(i = 0; i < g_topo->mac_num; i++)
+  {
+    TOPO_INDEX_INSERT(g_topo->mac_name_index_off, topo_hash_name(TOPO_NAME(mac_name[i])),
+		      topo_find_mac_by_name(TOPO_NAME(mac_name[i])), i);
+    TOPO_INDEX_INSERT(g_topo->mac_addr_index_off, topo_hash_hwaddr(TOPO_MAC(i)->addr),
+		      topo_find_mac_by_addr(TOPO_MAC(i)->addr), i);
+  }
+
+  for(i = 0; i < g_topo->ip_num; i++)
+  {
+    j = topo_find_ip_by_name(TOPO_NAME(ip_name[i]));
+    if(j != -1)
+    { //chain the entry after the others with the same name in the order of the conf file
+      while(TOPO_IP(j)->next != -1)
+	j = TOPO_IP(j)->next;
+      TOPO_IP(j)->next = i;
+    }
+    TOPO_INDEX_INSERT(g_topo->ip_name_index_off, topo_hash_name(TOPO_NAME(ip_name[i])), j, i);
+    TOPO_INDEX_INSERT(g_topo->ip_addr_index_off, topo_hash_ipaddr(TOPO_IP(i)->addr),
+		      topo_find_ip_by_addr(TOPO_IP(i)->addr), i);
+
+    TOPO_IP(i)->mac = topo_find_mac_by_name(TOPO_NAME(ip_name[i]));
+  }
+
+  free(map.name);
+  free(map.off);
+  free(mac_name);
+  free(ip_name);
+  free(gw_host);
+  free(gw_gw);
+}
+
+int topo_write(char* file)
+{ //write the image in use into file; readers keep the old file until it is replaced at once
+  char tmpfile[MAXSTRING];
+  int fd;
+
+  if(g_topo == NULL)
+  {
+    printf("topo_write(): there is no topology to write\n");
+    return 0;
+  }
+
+  snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", file);
+  fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd == -1)
+  {
+    perror("topo_write(): open");
+    return 0;
+  }
+
+  if(write(fd, g_topo, g_topo->size) != g_topo->size)
+  {
+    perror("topo_write(): write");
+    close(fd);
+    unlink(tmpfile);
+    return 0;
+  }
+  close(fd);
+
+  if(rename(tmpfile, file) == -1)
+  {
+    perror("topo_write(): rename");
+    unlink(tmpfile);
+    return 0;
+  }
+
+  return 1;
+}
+/*--------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------*/
+int topo_watch()
+{ //start watching the topology files; return a descriptor to select() on, or -1
+#ifdef __linux__
+  int fd;
+
+  /* watch the directory rather than the files since a new image (or a conf
+     file saved by an editor) replaces the old file by rename */
+  fd = inotify_init();
+  if(fd == -1)
+  {
+    perror("topo_watch(): inotify_init");
+    return -1;
+  }
+
+  if(inotify_add_watch(fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+  {
+    perror("topo_watch(): inotify_add_watch");
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+#else
+  return -1; //topology files are not watched without inotify
+#endif
+}
+
+int topo_watch_changed(int fd)
+{ //consume the events on fd; return 1 if a topology file has changed
+#ifdef __linux__
+  char buf[BUF_SIZE] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event* ev;
+  char* ptr;
+  int len;
+  int changed = 0;
+
+  len = read(fd, buf, sizeof(buf));
+  if(len <= 0)
+  {
+    perror("topo_watch_changed(): read");
+    return 0;
+  }
+
+  for(ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ev->len)
+  {
+    ev = (struct inotify_event*) ptr;
+    if(ev->len == 0)
+      continue;
+
+    if(strcmp(ev->name, MAC_FILE) == 0 || strcmp(ev->name, IP_FILE) == 0 || strcmp(ev->name, GW_FILE) == 0 ||
+       (g_topo_image_file != NULL && strcmp(ev->name, g_topo_image_file) == 0))
+      changed = 1;
+  }
+
+  return changed;
+#else
+  return 0;
+#endif
+}
+/*--------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------*/
+int topo_find_mac_by_name(char* name)
+{ //return the MAC entry of name, or -1
+  unsigned int* index;
+  int h;
+
+  if(g_topo == NULL)
+    return -1;
+
+  index = (unsigned int*) TOPO_PTR(g_topo->mac_name_index_off);
+  for(h = topo_hash_name(name) & (g_topo->index_size-1); index[h] != 0; h = (h+1) & (g_topo->index_size-1))
+  {
+    if(strcmp(TOPO_NAME(TOPO_MAC(index[h]-1)->name), name) == 0)
+      return index[h]-1;
+  }
+  return -1;
+}
+
+int topo_find_mac_by_addr(HwAddr addr)
+{ //return the MAC entry of addr, or -1
+  unsigned int* index;
+  int h;
+
+  if(g_topo == NULL)
+    return -1;
+
+  index = (unsigned int*) TOPO_PTR(g_topo->mac_addr_index_off);
+  for(h = topo_hash_hwaddr(addr) & (g_topo->index_size-1); index[h] != 0; h = (h+1) & (g_topo->index_size-1))
+  {
+    if(hwaddrcmp(TOPO_MAC(index[h]-1)->addr, addr) == 0)
+      return index[h]-1;
+  }
+  return -1;
+}
+
+int topo_find_ip_by_name(char* name)
+{ //return the first IP entry of name, or -1; the others follow through next
+  unsigned int* index;
+  int h;
+
+  if(g_topo == NULL)
+    return -1;
+
+  index = (unsigned int*) TOPO_PTR(g_topo->ip_name_index_off);
+  for(h = topo_hash_name(name) & (g_topo->index_size-1); index[h] != 0; h = (h+1) & (g_topo->index_size-1))
+  {
+    if(strcmp(TOPO_NAME(TOPO_IP(index[h]-1)->name), name) == 0)
+      return index[h]-1;
+  }
+  return -1;
+}
+
+int topo_find_ip_by_addr(in_addr_t addr)
+{ //return the IP entry of addr, or -1
+  unsigned int* index;
+  int h;
+
+  if(g_topo == NULL)
+    return -1;
+
+  index = (unsigned int*) TOPO_PTR(g_topo->ip_addr_index_off);
+  for(h = topo_hash_ipaddr(addr) & (g_topo->index_size-1); index[h] != 0; h = (h+1) & (g_topo->index_size-1))
+  {
+    if(TOPO_IP(index[h]-1)->addr == addr)
+      return index[h]-1;
+  }
+  return -1;
+}
+/*--------------------------------------------------------------------*/
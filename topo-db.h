@@ -0,0 +1,125 @@
+/*--------------------------------------------------------------------*/
+/* topo-db.h: topology database of MAC addresses, IP addresses and default
+   gateways.
+
+   The database is one contiguous image that starts with topo_header and
+   refers to everything else by byte offsets from the start of the image:
+
+     topo_header
+     topo_mac_entry[mac_num]     MAC address of each node
+     topo_ip_entry[ip_num]       IP addresses; the entries of a node are chained by next
+     topo_gw_entry[gw_num]       default gateway of each host
+     4 hash indexes              name->MAC, MAC->MAC entry, name->first IP, IP->IP entry;
+                                 index_size slots each, holding an entry index + 1 or 0
+     string pool                 every distinct name once, '\0'-terminated
+
+   'topo_compile' writes the image of the conf files into TOPO_FILE, and
+   every station maps that file read-only instead of parsing the conf files.
+   Without an up-to-date image, init_*_table() parses the conf files and
+   builds the same image in memory. The image is in the byte-order of the
+   machine that compiled it. */
+
+#ifndef __TOPO_DB_H__
+#define __TOPO_DB_H__
+
+#include "common.h"
+
+#define TOPO_FILE "topology.db"
+//compiled topology image
+
+#define TOPO_MAGIC 0x4F504F54
+//magic number at the head of the image ("TOPO")
+
+#define TOPO_VERSION 1
+//layout version of the image
+
+/* header of the topology image */
+typedef struct _topo_header
+{
+  unsigned int magic; //TOPO_MAGIC
+  unsigned int version; //TOPO_VERSION
+  unsigned int size; //size of the whole image in bytes
+
+  unsigned int mac_num; //number of MAC entries
+  unsigned int ip_num; //number of IP entries
+  unsigned int gw_num; //number of gateway entries
+  unsigned int mac_off; //offset of the MAC entries
+  unsigned int ip_off; //offset of the IP entries
+  unsigned int gw_off; //offset of the gateway entries
+
+  unsigned int index_size; //number of slots of each hash index (a power of 2)
+  unsigned int mac_name_index_off; //offset of name -> MAC entry index
+  unsigned int mac_addr_index_off; //offset of MAC address -> MAC entry index
+  unsigned int ip_name_index_off; //offset of name -> first IP entry index
+  unsigned int ip_addr_index_off; //offset of IP address -> IP entry index
+
+  unsigned int str_off; //offset of the string pool
+  unsigned int str_size; //size of the string pool
+} topo_header;
+
+/* MAC address of a node */
+typedef struct _topo_mac_entry
+{
+  unsigned int name; //offset of the node name in the string pool
+  HwAddr addr; //MAC address
+  ushort pad;
+} topo_mac_entry;
+
+/* IP address of a LAN, router or host */
+typedef struct _topo_ip_entry
+{
+  unsigned int name; //offset of the name in the string pool
+  in_addr_t addr; //IP address in network byte-order
+  int mask; //subnet mask in network byte-order
+  int next; //next IP entry with the same name; -1 for the last one
+  int mac; //MAC entry with the same name; -1 if there is none
+} topo_ip_entry;
+
+/* default gateway of a host */
+typedef struct _topo_gw_entry
+{
+  unsigned int host; //offset of the host name in the string pool
+  unsigned int gw; //offset of the gateway name in the string pool
+} topo_gw_entry;
+
+extern topo_header* g_topo; //topology image in use; NULL until a table is initialized
+
+extern char* g_topo_image_file; //compiled image tried before the conf files; NULL to always parse the conf files
+
+extern int g_topo_image_tried; //whether g_topo_image_file has been tried; cleared to map it again
+
+/* access the parts of the topology image */
+#define TOPO_PTR(off) ((char*) g_topo + (off))
+#define TOPO_MAC(i) ((topo_mac_entry*) TOPO_PTR(g_topo->mac_off) + (i))
+#define TOPO_IP(i) ((topo_ip_entry*) TOPO_PTR(g_topo->ip_off) + (i))
+#define TOPO_GW(i) ((topo_gw_entry*) TOPO_PTR(g_topo->gw_off) + (i))
+#define TOPO_NAME(off) (TOPO_PTR(g_topo->str_off) + (off))
+
+unsigned int topo_hash_name(char* name); //hash a name
+unsigned int topo_hash_ipaddr(in_addr_t addr); //hash an IP address
+unsigned int topo_hash_hwaddr(HwAddr addr); //hash a MAC address
+
+int topo_load_image(); //map g_topo_image_file if it is newer than the conf files; return 1 if the image is in use
+
+void topo_reset_mac(); //forget the staged MAC entries before parsing the MAC conf file
+void topo_reset_ip(); //forget the staged IP entries before parsing the IP conf file
+void topo_reset_gw(); //forget the staged gateway entries before parsing the gateway conf file
+
+void topo_add_mac(char* name, HwAddr addr); //stage a MAC entry parsed from the conf file
+void topo_add_ip(char* name, in_addr_t addr, int mask); //stage an IP entry parsed from the conf file
+void topo_add_gw(char* host, char* gw); //stage a gateway entry parsed from the conf file
+
+void topo_build(); //build the image of the staged entries in memory and use it
+
+int topo_write(char* file); //write the image in use into file
+
+int topo_watch(); //start watching the topology files; return a descriptor to select() on, or -1
+
+int topo_watch_changed(int fd); //consume the events on fd; return 1 if a topology file has changed
+
+int topo_find_mac_by_name(char* name); //return the MAC entry of name, or -1
+int topo_find_mac_by_addr(HwAddr addr); //return the MAC entry of addr, or -1
+int topo_find_ip_by_name(char* name); //return the first IP entry of name, or -1
+int topo_find_ip_by_addr(in_addr_t addr); //return the IP entry of addr, or -1
+
+#endif
@@ -0,0 +1,181 @@
+/*--------------------------------------------------------------------*/
+/* trace.c: always-on packet trace ring with pcapng export */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "trace.h"
+/*--------------------------------------------------------------------*/
+
+trace_record g_trace_ring[TRACE_RING_SIZE]; //trace ring
+unsigned long g_trace_head; //number of records written so far; the ring keeps the last TRACE_RING_SIZE
+
+/*--------------------------------------------------------------------*/
+/* take the next slot of the ring and stamp it */
+static trace_record* trace_next(int action, int reason, int sd)
+{
+  trace_record* rec;
+  struct timespec ts;
+
+  rec = &g_trace_ring[g_trace_head++ & (TRACE_RING_SIZE-1)];
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  rec->ts = ts.tv_sec*1000000000UL + ts.tv_nsec;
+  rec->port = sd;
+  rec->action = action;
+  rec->reason = reason;
+
+  return rec;
+}
+
+void trace_ethpkt(int action, int reason, int sd, EthPkt* ethpkt)
+{ //record an ethernet frame whose len is in host byte-order
+  trace_record* rec;
+
+  rec = trace_next(action, reason, sd);
+  memcpy(rec->dst, ethpkt->dst, sizeof(HwAddr));
+  memcpy(rec->src, ethpkt->src, sizeof(HwAddr));
+  rec->len = ethpkt->len;
+
+  /* peek at the IP header at the head of the payload */
+  if(ethpkt->dat != NULL && ethpkt->len >= IP_HDR_SIZE)
+  {
+    memcpy(&rec->ipdst, ethpkt->dat, sizeof(in_addr_t));
+    memcpy(&rec->ipsrc, ethpkt->dat + sizeof(in_addr_t), sizeof(in_addr_t));
+    rec->type = ethpkt->dat[2*sizeof(in_addr_t) + sizeof(ushort)];
+  }
+  else
+  {
+    rec->ipdst = 0;
+    rec->ipsrc = 0;
+    rec->type = TRACE_NO_TYPE;
+  }
+}
+
+void trace_ippkt(int action, int reason, int sd, IPPkt* ippkt)
+{ //record an IP packet whose ethernet header is not at hand
+  trace_record* rec;
+
+  rec = trace_next(action, reason, sd);
+  memset(rec->dst, 0, sizeof(HwAddr));
+  memset(rec->src, 0, sizeof(HwAddr));
+  rec->ipdst = ippkt->dst;
+  rec->ipsrc = ippkt->src;
+  rec->len = IP_HDR_SIZE + ippkt->len;
+  rec->type = ippkt->type;
+}
+/*--------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------*/
+/* body of pcapng interface description block */
+typedef struct _trace_idb
+{
+  ushort linktype; //link type
+  ushort reserved;
+  unsigned int snaplen; //maximum captured length; 0 means no limit
+  ushort tsresol_code; //option if_tsresol
+  ushort tsresol_len;
+  u_char tsresol; //timestamp resolution as a negative power of 10
+  u_char pad[3];
+  ushort end_code; //option opt_endofopt
+  ushort end_len;
+} trace_idb;
+
+/* write a pcapng block of type with body of len bytes (len is a multiple of 4) */
+static int trace_write_block(FILE* fp, unsigned int type, void* body, unsigned int len)
+{
+  unsigned int total = len + 3*sizeof(unsigned int);
+
+  if(fwrite(&type, sizeof(type), 1, fp) != 1 ||
+     fwrite(&total, sizeof(total), 1, fp) != 1 ||
+     fwrite(body, len, 1, fp) != 1 ||
+     fwrite(&total, sizeof(total), 1, fp) != 1)
+    return 0;
+
+  return 1;
+}
+
+int trace_dump(char* file)
+{ //write the trace ring into file in pcapng format
+  FILE* fp;
+  trace_record* rec;
+  unsigned long i, first;
+  unsigned int shb[4]; //section header: magic, version, section length (unknown)
+  trace_idb idb; //interface description
+  unsigned int epb[5 + TRACE_RECORD_LEN/4]; //enhanced packet: interface, timestamp, lengths and record
+  u_char* ptr;
+  int port;
+  ushort len;
+
+  fp = fopen(file, "w");
+  if(fp == NULL)
+  {
+    perror("trace_dump(): fopen");
+    return 0;
+  }
+
+  shb[0] = 0x1A2B3C4D; //byte-order magic
+  ptr = (u_char*) &shb[1];
+  ((ushort*) ptr)[0] = 1; //major version
+  ((ushort*) ptr)[1] = 0; //minor version
+  shb[2] = 0xFFFFFFFF; //section length is not specified
+  shb[3] = 0xFFFFFFFF;
+
+  memset(&idb, 0, sizeof(idb));
+  idb.linktype = TRACE_LINKTYPE;
+  idb.tsresol_code = 9;
+  idb.tsresol_len = 1;
+  idb.tsresol = 9; //timestamps are in nanoseconds
+
+  if(!trace_write_block(fp, 0x0A0D0D0A, shb, sizeof(shb)) ||
+     !trace_write_block(fp, 0x00000001, &idb, sizeof(idb)))
+  {
+    perror("trace_dump(): fwrite");
+    fclose(fp);
+    return 0;
+  }
+
+  first = (g_trace_head > TRACE_RING_SIZE) ? g_trace_head - TRACE_RING_SIZE : 0;
+  for(i = first; i < g_trace_head; i++)
+  {
+    rec = &g_trace_ring[i & (TRACE_RING_SIZE-1)];
+
+    epb[0] = 0; //interface id
+    epb[1] = rec->ts >> 32;
+    epb[2] = rec->ts & 0xFFFFFFFF;
+    epb[3] = TRACE_RECORD_LEN; //captured length
+    epb[4] = TRACE_RECORD_LEN; //original length
+
+    /* serialize the record in network byte-order */
+    ptr = (u_char*) &epb[5];
+    memset(ptr, 0, TRACE_RECORD_LEN);
+    port = htonl(rec->port);
+    memcpy(ptr, &port, sizeof(port));
+    memcpy(ptr+4, rec->dst, sizeof(HwAddr));
+    memcpy(ptr+10, rec->src, sizeof(HwAddr));
+    memcpy(ptr+16, &rec->ipdst, sizeof(in_addr_t));
+    memcpy(ptr+20, &rec->ipsrc, sizeof(in_addr_t));
+    len = htons(rec->len);
+    memcpy(ptr+24, &len, sizeof(len));
+    ptr[26] = rec->type;
+    ptr[27] = rec->action;
+    ptr[28] = rec->reason;
+
+    if(!trace_write_block(fp, 0x00000006, epb, sizeof(epb)))
+    {
+      perror("trace_dump(): fwrite");
+      fclose(fp);
+      return 0;
+    }
+  }
+
+  fclose(fp);
+  printf("trace_dump(): %lu records are written into %s\n", g_trace_head - first, file);
+  return 1;
+}
+/*--------------------------------------------------------------------*/
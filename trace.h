@@ -0,0 +1,69 @@
+/*--------------------------------------------------------------------*/
+/* trace.h: always-on packet trace kept in a binary ring buffer.
+
+   Every frame a station receives, sends, forwards or drops is recorded
+   with its metadata only (no payload), so tracing stays cheap enough to
+   leave on at full rate. "trace dump <file>" writes the ring as pcapng
+   with link type LINKTYPE_USER0 (147); each packet of the capture is one
+   trace record serialized as below, all fields in network byte-order:
+
+     offset  size  field
+          0     4  port (socket descriptor)
+          4     6  destination MAC address
+         10     6  source MAC address
+         16     4  destination IP address (0 if not an IP packet)
+         20     4  source IP address (0 if not an IP packet)
+         24     2  ethernet payload length
+         26     1  IP data type (TRACE_NO_TYPE if not an IP packet)
+         27     1  action = {TRACE_RX, TRACE_TX, TRACE_FWD, TRACE_DROP}
+         28     1  drop reason (enum STATS_DROP) for TRACE_DROP
+         29     3  padding */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "common.h"
+
+#define TRACE_RING_SIZE 8192
+//number of records in the trace ring; it should be a power of 2
+
+#define TRACE_NO_TYPE 0xFF
+//data type recorded for a frame that does not carry an IP packet
+
+#define TRACE_LINKTYPE 147
+//pcapng link type of the trace records (LINKTYPE_USER0)
+
+#define TRACE_RECORD_LEN 32
+//length of a serialized trace record in the pcapng file
+
+/* action taken on a traced frame */
+enum TRACE_ACTION
+{
+  TRACE_RX = 0,  //received
+  TRACE_TX = 1,  //sent
+  TRACE_FWD = 2, //forwarded by router
+  TRACE_DROP = 3 //dropped
+};
+
+/* trace record */
+typedef struct _trace_record
+{
+  unsigned long ts; //timestamp in nanoseconds since 1970
+  int port; //socket descriptor
+  HwAddr dst; //destination MAC address
+  HwAddr src; //source MAC address
+  in_addr_t ipdst; //destination IP address
+  in_addr_t ipsrc; //source IP address
+  ushort len; //ethernet payload length
+  u_char type; //IP data type
+  u_char action; //action taken on the frame
+  u_char reason; //drop reason
+} trace_record;
+
+void trace_ethpkt(int action, int reason, int sd, EthPkt* ethpkt); //record an ethernet frame whose len is in host byte-order
+
+void trace_ippkt(int action, int reason, int sd, IPPkt* ippkt); //record an IP packet whose ethernet header is not at hand
+
+int trace_dump(char* file); //write the trace ring into file in pcapng format
+
+#endif
@@ -1,5 +1,6 @@
 /*----------------------------------------------------------------*/
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
 #include <strings.h>
@@ -10,14 +11,20 @@
 #include <netdb.h>
 #include <time.h> 
 #include <errno.h>
+#include <unistd.h>
 #include "common.h"
 #include "dist-vec.h"
+#include "stats.h"
+#include "trace.h"
+#include "topo-db.h"
+#include "egress.h"
+#include "token-bucket.h"
 
 /* hardware broadcast address */
 HwAddr BCASTADDR = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
 
-/* hardware multicast address */
-HwAddr MCASTADDR = { 0x80, 0x00, 0x00, 0x00, 0x00, 0x00 };
+/* base of hardware multicast addresses; a group's address adds the low 23 bits of its IP address */
+HwAddr MCASTADDR = { 0x01, 0x00, 0x5E, 0x00, 0x00, 0x00 };
 
 /* IP multicast address */
 in_addr_t IP_BCASTADDR = 0xffffffff; //IP broadcast address
@@ -26,28 +33,6 @@ in_addr_t IP_BCASTADDR = 0xffffffff; //IP broadcast address
 
 
 /*----------------------------------------------------------------*/
-/* MAC address entry for node name */
-typedef struct _mac_table_entry 
-{
-  char* name; //node name
-  HwAddr addr; //node MAC address
-} mac_table_entry;
-
-/* IP address entry for LAN, router, or host name */
-typedef struct _ip_table_entry 
-{
-  char* name; //name
-  in_addr_t addr; //IP address
-  int mask; //subnet mask
-} ip_table_entry;
-
-/* Default gateway entry for host */
-typedef struct _gw_table_entry 
-{
-  char* host; //host name
-  char* gw; //gateway name
-} gw_table_entry;
-
 /* LAN name entry for hub */
 typedef struct _lan_table_entry
 {
@@ -55,30 +40,12 @@ typedef struct _lan_table_entry
   char lanname[NAME_SIZE]; //lan name
 } lan_table_entry;
 
-int g_station_kind; //let us know what kind of station the program is: {hub, host, router}
-
-mac_table_entry g_mac_table[MAXNODES]; //MAC address table
-int g_mac_table_size; //size of g_mac_table
+int g_station_kind; //let us know what kind of station the program is: {hub, host, router}; the IP stack uses the kind of its dv_router
 
-ip_table_entry g_ip_table[MAXNODES]; //IP address table
-int g_ip_table_size; //size of g_ip_table
-
-gw_table_entry g_gw_table[MAXNODES]; //default gateway table
-int g_gw_table_size; //size of g_gw_table
-
-/* my MAC address */
-HwAddr g_myhwaddr;
-
-/* my IP address */
-in_addr_t g_myipaddrs[ADDR_NUM];
-int g_myipaddrs_num;
-
-/* my subnet mask in network byte-order */
-int g_mynetmasks[ADDR_NUM];
-int g_mynetmasks_num;
-
-/* my default gateway */
-in_addr_t g_mygwaddr;
+/* pool of interned names shared by all the configuration tables */
+char** g_name_pool; //open-addressed set of names
+int g_name_pool_size; //number of slots of g_name_pool (a power of 2)
+int g_name_pool_num; //number of names in g_name_pool
 
 /* my hub's status */
 int g_hub_status; //it is used to notify the IP stack or Ethernet stack that the hub is down when the received data size is zero.
@@ -87,6 +54,12 @@ int g_hub_status; //it is used to notify the IP stack or Ethernet stack that the
 lan_table_entry g_lan_table[MAXNODES];
 int g_lan_table_size;
 
+/* socket I/O and clock, replaced by the simulator */
+ssize_t (*g_net_read)(int sd, void *buf, size_t n) = read;
+ssize_t (*g_net_write)(int sd, const void *buf, size_t n) = write;
+long (*g_clock_hook)() = NULL;
+long long (*g_monoclock_hook)() = NULL;
+
 /******************************************************************/
 /* set station kind */
 void set_station_kind(int kind)
@@ -167,33 +140,33 @@ char* get_lanname(int hubsock)
 }
 
 
-/* Host registers its address information with g_myhwaddr and g_myipaddrs for checking if the received packet is mine or not and for sending my packet to the specified destination */
-void set_host_addrinfo(HwAddr myhwaddr, in_addr_t myipaddr, int mynetmask, in_addr_t mygwaddr)
+/* Host registers its address information with host->hwaddr and host->ipaddrs for checking if the received packet is mine or not and for sending my packet to the specified destination */
+void set_host_addrinfo(dv_router* host, HwAddr myhwaddr, in_addr_t myipaddr, int mynetmask, in_addr_t mygwaddr)
 {
-  memcpy(g_myhwaddr, myhwaddr, sizeof(HwAddr));
-  g_myipaddrs[0] = myipaddr;
-  g_myipaddrs_num = 1;
-  g_mynetmasks[0] = mynetmask;
-  g_mynetmasks_num = 1;
-  g_mygwaddr = mygwaddr;
+  host->kind = STATION_HOST;
+  memcpy(host->hwaddr, myhwaddr, sizeof(HwAddr));
+  host->ipaddrs[0] = myipaddr;
+  host->netmasks[0] = mynetmask;
+  host->ipaddrs_num = 1;
+  host->gwaddr = mygwaddr;
 }
 
-/* Router registers its address information with g_myhwaddr and g_myipaddrs for checking if the received packet is mine or not and for sending my packet to the specified destination */
-void set_router_addrinfo(HwAddr myhwaddr, in_addr_t* myipaddrs, int myipaddrs_num, int* mynetmasks)
+/* Router registers its address information with router->hwaddr and router->ipaddrs for checking if the received packet is mine or not and for sending my packet to the specified destination */
+void set_router_addrinfo(dv_router* router, HwAddr myhwaddr, in_addr_t* myipaddrs, int myipaddrs_num, int* mynetmasks)
 {
   int i;
-  memcpy(g_myhwaddr, myhwaddr, sizeof(HwAddr));
+  router->kind = STATION_ROUTER;
+  memcpy(router->hwaddr, myhwaddr, sizeof(HwAddr));
 
-  g_myipaddrs_num = 0;
+  router->ipaddrs_num = 0;
   for(i=0; i < myipaddrs_num; i++)
   {
-    g_myipaddrs[i] = myipaddrs[i];
-    g_mynetmasks[i] = mynetmasks[i];
-    g_myipaddrs_num++;
-    g_mynetmasks_num++;
+    router->ipaddrs[i] = myipaddrs[i];
+    router->netmasks[i] = mynetmasks[i];
+    router->ipaddrs_num++;
   } 
 
-  g_mygwaddr = 0;
+  router->gwaddr = 0;
 }
 
 /* make subnet bit mask from /x notation in network byte-order */
@@ -210,12 +183,58 @@ int make_subnet_mask(char* mask)
   return subnet_mask;
 }
 
-/* init mac address configuration table */
-int init_mac_table(char *macfile)
+/*----------------------------------------------------------------*/
+/* return the interned copy of name; every table entry with the same name shares it */
+char* intern_name(char* name)
+{
+  char** old_pool;
+  int old_size;
+  int i, h;
+
+  /* keep the pool at most half full */
+  if (2*(g_name_pool_num+1) > g_name_pool_size) {
+    old_pool = g_name_pool;
+    old_size = g_name_pool_size;
+
+    g_name_pool_size = (old_size == 0) ? 64 : 2*old_size;
+    g_name_pool = (char**) calloc(g_name_pool_size, sizeof(char*));
+    if (!g_name_pool) {
+      fprintf(stderr, "error : unable to calloc\n");
+      exit(1);
+    }
+
+    for (i=0; i<old_size; i++) {
+      if (old_pool[i] == NULL) continue;
+
+      h = topo_hash_name(old_pool[i]) & (g_name_pool_size-1);
+      while (g_name_pool[h] != NULL)
+	h = (h+1) & (g_name_pool_size-1);
+      g_name_pool[h] = old_pool[i];
+    }
+    free(old_pool);
+  }
+
+  h = topo_hash_name(name) & (g_name_pool_size-1);
+  while (g_name_pool[h] != NULL) {
+    if (strcmp(g_name_pool[h], name) == 0)
+      return g_name_pool[h];
+    h = (h+1) & (g_name_pool_size-1);
+  }
+
+  g_name_pool[h] = strdup(name);
+  g_name_pool_num++;
+  return g_name_pool[h];
+}
+
+/*----------------------------------------------------------------*/
+
+/* read mac address configuration file into the staged topology */
+static int read_mac_file(char *macfile)
 {
   FILE *fp;
   char name[MAXSTRING];
   char addr[MAXSTRING];
+  HwAddr hwaddr;
 
   /* open the file */
   fp = fopen(macfile, "r");
@@ -226,18 +245,31 @@ int init_mac_table(char *macfile)
   }
 
   /* fill in node MAC addresses */
-  g_mac_table_size = 0;
+  topo_reset_mac();
   while (fscanf(fp, "%s %s", name, addr) == 2) {
-    g_mac_table[g_mac_table_size].name = strdup(name);
-    /* strdup(name): return the pointer to the space allocated for the duplication of the string pointed by name. The  space is allocated by malloc(). */
-    strtohwaddr(addr, g_mac_table[g_mac_table_size].addr);
-    g_mac_table_size++;
+    strtohwaddr(addr, hwaddr);
+    topo_add_mac(name, hwaddr);
   }
+  fclose(fp);
   return(1);
 }
 
-/* init default gateway configuration table */
-int init_gw_table(char *gwfile)
+/* init mac address configuration table */
+int init_mac_table(char *macfile)
+{
+  /* the compiled topology image, if it is up to date, replaces the conf files */
+  if (topo_load_image())
+    return(1);
+
+  if (!read_mac_file(macfile))
+    return(0);
+
+  topo_build();
+  return(1);
+}
+
+/* read default gateway configuration file into the staged topology */
+static int read_gw_file(char *gwfile)
 {
   FILE *fp;
   char host_name[MAXSTRING];
@@ -252,17 +284,29 @@ int init_gw_table(char *gwfile)
   }
 
   /* fill in host's gateway DNS name */
-  g_gw_table_size = 0;
-  while (fscanf(fp, "%s %s", host_name, gw_name) == 2) {
-    g_gw_table[g_gw_table_size].host = strdup(host_name);
-    g_gw_table[g_gw_table_size].gw = strdup(gw_name);    
-    g_gw_table_size++;
-  }
+  topo_reset_gw();
+  while (fscanf(fp, "%s %s", host_name, gw_name) == 2)
+    topo_add_gw(host_name, gw_name);
+  fclose(fp);
   return(1);
 }
 
-/* init IP address configuration table */
-int init_ip_table(char *ipfile)
+/* init default gateway configuration table */
+int init_gw_table(char *gwfile)
+{
+  /* the compiled topology image, if it is up to date, replaces the conf files */
+  if (topo_load_image())
+    return(1);
+
+  if (!read_gw_file(gwfile))
+    return(0);
+
+  topo_build();
+  return(1);
+}
+
+/* read IP address configuration file into the staged topology */
+static int read_ip_file(char *ipfile)
 {
   FILE *fp;
   char* token = NULL;
@@ -273,6 +317,7 @@ int init_ip_table(char *ipfile)
   char ip_addr_buf[ADDR_SIZE];
   char mask_buf[MASK_SIZE];
   char* ptr = NULL; //indicate the start of subnet mask
+  int num = 0; //number of IP entries
 
   /* open the file */
   fp = fopen(ipfile, "r");
@@ -283,58 +328,85 @@ int init_ip_table(char *ipfile)
   }
 
   /* fill in IP address information */
-  g_ip_table_size = 0;
+  topo_reset_ip();
   while (fgets(buf, sizeof(buf), fp) != NULL)
   {
     token = strtok(buf, " \t\n");
-    if(token == NULL && g_ip_table_size == 0)
+    if(token == NULL && num == 0)
     {
-      perror("init_ip_table(): token is NULL");
-      exit(1);
+      fprintf(stderr, "error : '%s' starts with a blank line\n", ipfile);
+      fclose(fp);
+      return(0);
     }
-    else if(token == NULL && g_ip_table_size > 0) //when there is a blank line in file, token becomes NULL
+    else if(token == NULL && num > 0) //when there is a blank line in file, token becomes NULL
       break;
     
-    g_ip_table[g_ip_table_size].name = strdup(token);
+    strcpy(name, token);
    
     token = strtok(NULL, " \t\n");
     if(token == NULL)
     {
-      perror("init_ip_table(): token is NULL");
-      exit(1);
+      fprintf(stderr, "error : '%s' has no IP address for %s\n", ipfile, name);
+      fclose(fp);
+      return(0);
     }
     
     do
     {
       strcpy(ip_addr_buf, token);
       ptr = strstr(ip_addr_buf, "/");
-      *ptr = 0;
-      if(ptr+1 == NULL)
+      if(ptr == NULL)
       {
-	perror("init_ip_table(): there is no subnet mask information");
-        exit(1);
+        fprintf(stderr, "error : '%s' has no subnet mask for %s\n", ipfile, name);
+        fclose(fp);
+        return(0);
       }
+      *ptr = 0;
 
       strcpy(mask_buf, ptr+1);
 
-      g_ip_table[g_ip_table_size].addr = inet_addr(ip_addr_buf); //IP address in network byte-order
-      g_ip_table[g_ip_table_size].mask = make_subnet_mask(mask_buf); //subnet mask in network byte-order
+      /* IP address and subnet mask in network byte-order */
+      topo_add_ip(name, inet_addr(ip_addr_buf), make_subnet_mask(mask_buf));
+      num++;
 
 #ifdef _DEBUG_
-      printf("%s %s %s\n", g_ip_table[g_ip_table_size].name, ip_addr_buf, mask_buf); 
+      printf("%s %s %s\n", name, ip_addr_buf, mask_buf); 
 #endif
             
       token = strtok(NULL, " \t\n");
-      if(token == NULL)
-        break;
+    } while(token != NULL); //end of do-while
+  } //end of while
+  fclose(fp);
+  return(1);
+}
 
-      g_ip_table_size++;
-      g_ip_table[g_ip_table_size].name = strdup(g_ip_table[g_ip_table_size-1].name);
+/* init IP address configuration table */
+int init_ip_table(char *ipfile)
+{
+  /* the compiled topology image, if it is up to date, replaces the conf files */
+  if (topo_load_image())
+    return(1);
 
-    } while(1); //end of do-while
+  if (!read_ip_file(ipfile))
+    return(0);
 
-    g_ip_table_size++;
-  } //end of while
+  topo_build();
+  return(1);
+}
+
+/* reload all the configuration tables after the image or a conf file has changed;
+   the tables in use are kept unless the new ones are read completely. a router
+   should then invalidate its flow cache, which holds the old MAC addresses */
+int reload_tables()
+{
+  g_topo_image_tried = 0; //try the image again
+
+  if (!topo_load_image()) {
+    if (!read_mac_file(MAC_FILE) || !read_ip_file(IP_FILE) || !read_gw_file(GW_FILE))
+      return(0);
+
+    topo_build();
+  }
 
   return(1);
 }
@@ -345,9 +417,9 @@ void dump_mac_table()
   int  i;
   char addr[32];
   
-  for (i=0; i<g_mac_table_size; i++) {
-    hwaddrtostr(g_mac_table[i].addr, addr);
-    printf("%s %s\n", g_mac_table[i].name, addr);
+  for (i=0; g_topo != NULL && i<g_topo->mac_num; i++) {
+    hwaddrtostr(TOPO_MAC(i)->addr, addr);
+    printf("%s %s\n", TOPO_NAME(TOPO_MAC(i)->name), addr);
   }
 }
 
@@ -356,13 +428,12 @@ int nametohwaddr(char *name, HwAddr addr)
 {
   int  i;
   
-  for (i=0; i<g_mac_table_size; i++) {
-    if (strcmp(g_mac_table[i].name, name) == 0) {
-      hwaddrcpy(addr, g_mac_table[i].addr);
-      return(1);
-    }
-  }
-  return(0);
+  i = topo_find_mac_by_name(name);
+  if (i == -1)
+    return(0);
+
+  hwaddrcpy(addr, TOPO_MAC(i)->addr);
+  return(1);
 }
 
 /* return IP address given name */
@@ -370,13 +441,12 @@ int nametoipaddr(char *name, in_addr_t* addr)
 {
   int  i;
   
-  for (i=0; i<g_ip_table_size; i++) {
-    if (strcmp(g_ip_table[i].name, name) == 0) {
-      *addr = g_ip_table[i].addr;
-      return(1);
-    }
-  }
-  return(0);
+  i = topo_find_ip_by_name(name);
+  if (i == -1)
+    return(0);
+
+  *addr = TOPO_IP(i)->addr;
+  return(1);
 }
 
 /* return subnet mask given name */
@@ -384,13 +454,12 @@ int nametonetmask(char *name, int* mask)
 {
   int  i;
   
-  for (i=0; i<g_ip_table_size; i++) {
-    if (strcmp(g_ip_table[i].name, name) == 0) {
-      *mask = g_ip_table[i].mask;
-      return(1);
-    }
-  }
-  return(0);
+  i = topo_find_ip_by_name(name);
+  if (i == -1)
+    return(0);
+
+  *mask = TOPO_IP(i)->mask;
+  return(1);
 }
 
 /* DNS Lookup function to convert DNS name into IP addr */
@@ -399,11 +468,9 @@ int dns_name_to_ipaddr(char* dnsname, in_addr_t* ipaddr, int* ipaddr_num)
   int  i;
 
   *ipaddr_num = 0;
-  for (i=0; i<g_ip_table_size; i++) {
-    if (strcmp(g_ip_table[i].name, dnsname) == 0) {
-      ipaddr[*ipaddr_num] = g_ip_table[i].addr;
-      (*ipaddr_num)++;
-    }
+  for (i=topo_find_ip_by_name(dnsname); i != -1 && *ipaddr_num < ADDR_NUM; i=TOPO_IP(i)->next) {
+    ipaddr[*ipaddr_num] = TOPO_IP(i)->addr;
+    (*ipaddr_num)++;
   }
 
   if(*ipaddr_num >= 1)
@@ -418,18 +485,15 @@ int get_netmasks_for_addrs(in_addr_t* ipaddrs, int ipaddrs_num, int* netmasks)
   int i, j;
   int cnt = 0;
  
-  for(i=0; i<ipaddrs_num; i++) //for-1
+  for(i=0; i<ipaddrs_num; i++)
   {
-    for(j=0; j<g_ip_table_size; j++) //for-2
+    j = topo_find_ip_by_addr(ipaddrs[i]);
+    if(j != -1)
     {
-      if(g_ip_table[j].addr == ipaddrs[i])
-      {
-        netmasks[i] = g_ip_table[j].mask;
-        cnt++;
-        break;
-      } //end of if
-    } //end of for-2
-  } //end of for-1
+      netmasks[i] = TOPO_IP(j)->mask;
+      cnt++;
+    }
+  }
 
   return cnt;
 }
@@ -467,13 +531,12 @@ int hwaddrtoname(HwAddr addr, char *name)
 {
   int  i;
 
-  for (i=0; i<g_mac_table_size; i++) {
-    if (hwaddrcmp(g_mac_table[i].addr,addr) == 0) {
-      strcpy(name, g_mac_table[i].name);
-      return(1);
-    }
-  }
-  return(0);
+  i = topo_find_mac_by_addr(addr);
+  if (i == -1)
+    return(0);
+
+  strcpy(name, TOPO_NAME(TOPO_MAC(i)->name));
+  return(1);
 }
 
 /* return name given IP addr */
@@ -481,21 +544,19 @@ int ipaddrtoname(in_addr_t addr, char *name)
 {
   int  i;
 
-  for (i=0; i<g_ip_table_size; i++) {
-    if (g_ip_table[i].addr == addr) {
-      strcpy(name, g_ip_table[i].name);
-      return(1);
-    }
-  }
-  return(0);
+  i = topo_find_ip_by_addr(addr);
+  if (i == -1)
+    return(0);
+
+  strcpy(name, TOPO_NAME(TOPO_IP(i)->name));
+  return(1);
 }
 
 /*----------------------------------------------------------------*/
 /* ARP function to convert IP addr with netmask into MAC addr */
 int arp_ipaddr_to_hwaddr(in_addr_t ipaddr, HwAddr hwaddr)
 {
-  char name[NAME_SIZE];
-  int result;
+  int i, j;
   struct in_addr addr;
 
   /* the MAC address of an IP packet broadcast in a LAN is the MAC broadcast address */
@@ -505,26 +566,113 @@ int arp_ipaddr_to_hwaddr(in_addr_t ipaddr, HwAddr hwaddr)
     return 1;
   } 
 
+  /* the MAC address of an IP multicast group is derived from the group */
+  if(IN_MULTICAST(ntohl(ipaddr)))
+  {
+    ip_mcast_to_hwaddr(ipaddr, hwaddr);
+    return 1;
+  }
+
   addr.s_addr = ipaddr;
 
-  result = ipaddrtoname(ipaddr, name);
-  if(result == 0)
+  i = topo_find_ip_by_addr(ipaddr);
+  if(i == -1)
   {
     printf("arp_ipaddr_to_hwaddr(): there is no DNS name for %s\n", inet_ntoa(addr));
     return 0;
   }
 
-  result = nametohwaddr(name, hwaddr);
-  if(result == 0)
+  j = TOPO_IP(i)->mac; //the MAC entry of the same name is resolved when the topology is built
+  if(j == -1)
   {
-    printf("arp_ipaddr_to_hwaddr(): there is no MAC address for %s\n", name);
+    printf("arp_ipaddr_to_hwaddr(): there is no MAC address for %s\n", TOPO_NAME(TOPO_IP(i)->name));
     return 0;
   }
 
+  hwaddrcpy(hwaddr, TOPO_MAC(j)->addr);
   return 1;
 }
 
 /*----------------------------------------------------------------*/
+/* multicast: a station joins a group to take the frames sent to its MAC
+   address, and reports the membership to its hubs, which then pass those
+   frames only to the members (see mac-learn.h) */
+
+/* convert the IP multicast group into its MAC address */
+void ip_mcast_to_hwaddr(in_addr_t group, HwAddr hwaddr)
+{
+  unsigned int low = ntohl(group) & 0x7FFFFF;
+
+  hwaddrcpy(hwaddr, MCASTADDR);
+  hwaddr[3] = (low >> 16) & 0x7F;
+  hwaddr[4] = (low >> 8) & 0xFF;
+  hwaddr[5] = low & 0xFF;
+}
+
+/* join the IP multicast group; return 0 if the station has joined too many */
+int ip_join_group(dv_router* router, in_addr_t group)
+{
+  if(ip_is_member(router, group))
+    return 1;
+
+  if(router->groups_num == MCAST_MAX_GROUPS)
+  {
+    printf("ip_join_group(): no more than %d groups can be joined\n", MCAST_MAX_GROUPS);
+    return 0;
+  }
+
+  router->groups[router->groups_num++] = group;
+  return 1;
+}
+
+/* return 1 if the station has joined the IP multicast group */
+int ip_is_member(dv_router* router, in_addr_t group)
+{
+  int i;
+
+  for(i = 0; i < router->groups_num; i++)
+  {
+    if(router->groups[i] == group)
+      return 1;
+  }
+
+  return 0;
+}
+
+/* return 1 if the station takes the frames to hwaddr: its own, broadcast or a group it has joined */
+int hwaddr_is_mine(dv_router* router, HwAddr hwaddr)
+{
+  HwAddr group;
+  int i;
+
+  if(hwaddrcmp(hwaddr, router->hwaddr) == 0 || hwaddrcmp(hwaddr, BCASTADDR) == 0)
+    return 1;
+
+  for(i = 0; i < router->groups_num; i++)
+  {
+    ip_mcast_to_hwaddr(router->groups[i], group);
+    if(hwaddrcmp(hwaddr, group) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+/* send a membership report of every group joined on sd, so that its hub passes the frames to the groups */
+int send_group_reports(dv_router* router, int sd)
+{
+  int i;
+
+  /* a report is sent to the group and carries the group's address */
+  for(i = 0; i < router->groups_num; i++)
+  {
+    if(sendmessage(router, sd, router->ipaddrs[0], router->groups[i], sizeof(in_addr_t), DATA_JOIN, (char*) &router->groups[i]) != 1)
+      return 0;
+  }
+
+  return 1;
+}
+/*----------------------------------------------------------------*/
 
 
 /*----------------------------------------------------------------*/
@@ -539,7 +687,7 @@ int readn(int sd, char *buf, int n)
   while (toberead > 0) {
     int byteread;
 
-    byteread = read(sd, ptr, toberead);
+    byteread = g_net_read(sd, ptr, toberead);
     if (byteread <= 0) {
       if (byteread == -1)
 	perror("read");
@@ -584,9 +732,18 @@ EthPkt *recvethpkt(int sd)
   }
   ethpkt->len = ntohs(ethpkt->len); //convert network byte-order into host byte-order
 
+  /* a length no station sends means the stream is corrupt; the frames after it cannot be found, so the link is given up */
+  if (ethpkt->len > ETH_MAX_PAYLOAD) {
+    printf("recvethpkt(): invalid frame length %d on socket %d\n", ethpkt->len, sd);
+    g_stats->drops[DROP_MALFORMED]++;
+    free(ethpkt);
+    set_hub_down();
+    return(NULL);
+  }
+
   /* allocate space for payload */
   ethpkt->dat = (char *) malloc(ethpkt->len);
-  if (!ethpkt) {
+  if (!ethpkt->dat) {
     fprintf(stderr, "error : unable to malloc\n");
     exit(1);
   }
@@ -597,6 +754,11 @@ EthPkt *recvethpkt(int sd)
     return(NULL);
   }
 
+  trace_ethpkt(TRACE_RX, 0, sd, ethpkt);
+  g_stats->allocs += 2;
+  STATS_PORT(sd)->rx_frames++;
+  STATS_PORT(sd)->rx_bytes += 2*sizeof(HwAddr) + sizeof(ushort) + ethpkt->len;
+
   /* done reading */
   return(ethpkt);
 }
@@ -621,6 +783,8 @@ int sendethpkt(int sd, EthPkt *ethpkt)
   ushort  len;
   int ret_val;
 
+  trace_ethpkt(TRACE_TX, 0, sd, ethpkt);
+
   /* allocate space for the buffer */
   len = 2*sizeof(HwAddr) + sizeof(ushort) + ethpkt->len;
   buf = (char *) calloc(len, sizeof(char));
@@ -644,15 +808,25 @@ int sendethpkt(int sd, EthPkt *ethpkt)
 
   memcpy(ptr, (char *) ethpkt->dat, ethpkt_length);
 
+  /* a router queues the frame on the egress queues of the port, which take buf */
+  if (egress_attached(sd)) {
+    egress_enqueue(sd, buf, len);
+    return(1);
+  }
+
   /* send the packet */
   // printf("in sendethpkt sock is %d\n",sd);
-  ret_val = write(sd, buf, len);
+  ret_val = g_net_write(sd, buf, len);
   if (ret_val == -1) {
     perror("write() error!\n");
     free(buf);
     exit(1);
   }
 
+  g_stats->allocs++;
+  STATS_PORT(sd)->tx_frames++;
+  STATS_PORT(sd)->tx_bytes += len;
+
   free(buf);
   return(1);
 }
@@ -681,7 +855,7 @@ void freeethpkt(EthPkt *ethpkt)
 /*----------------------------------------------------------------*/
 
 /* send a message to IP stack */
-int sendmessage(int sd, in_addr_t myaddr, in_addr_t dst, ushort len, u_char type, char* dat)
+int sendmessage(dv_router* router, int sd, in_addr_t myaddr, in_addr_t dst, ushort len, u_char type, char* dat)
 {
   IPPkt* ippkt; //IP packet
   struct in_addr addr;
@@ -699,6 +873,8 @@ int sendmessage(int sd, in_addr_t myaddr, in_addr_t dst, ushort len, u_char type
   memcpy(&(ippkt->src), &myaddr, sizeof(ippkt->src));
   memcpy(&(ippkt->len), &len, sizeof(ippkt->len)); //host byte-order
   memcpy(&(ippkt->type), &type, sizeof(ippkt->type));
+  ippkt->ttl = IP_DEFAULT_TTL;
+  ippkt->cksum = ip_header_cksum(ippkt);
 
   /* allocate space for payload */
   ippkt->dat = (char *) malloc(len);
@@ -711,8 +887,9 @@ int sendmessage(int sd, in_addr_t myaddr, in_addr_t dst, ushort len, u_char type
 
   /* write the data */
   memcpy(ippkt->dat, dat, ippkt->len);  
+  g_stats->allocs += 2;
   // printf("in sendmessage socket is %d\n",sd);
-  ret_val = sendippkt(sd, ippkt);
+  ret_val = sendippkt(router, sd, ippkt);
   if(ret_val != 1)
   {
     perror("sendippkt() sendippkt() error");
@@ -726,7 +903,7 @@ int sendmessage(int sd, in_addr_t myaddr, in_addr_t dst, ushort len, u_char type
 }
 
 /* send an application message, such as DV exchange message and chatting message */
-int send_app_message(int sd, char* dst_name, ushort len, u_char type, char* dat)
+int send_app_message(dv_router* router, int sd, char* dst_name, ushort len, u_char type, char* dat)
 {
   int ret_val;
   in_addr_t ipaddr[ADDR_NUM];
@@ -734,7 +911,7 @@ int send_app_message(int sd, char* dst_name, ushort len, u_char type, char* dat)
   in_addr_t dst; //destination IP address
 
   /* DNS Lookup function to convert DNS name into IP addr */
-  if(type == DATA_CHAT)
+  if(type == DATA_CHAT || type == DATA_BULK)
   {
     if(dst_name == NULL)
     {
@@ -753,7 +930,7 @@ int send_app_message(int sd, char* dst_name, ushort len, u_char type, char* dat)
   }
   else if(type == DATA_DV)
   {
-    dst = IP_BCASTADDR; //the DV exchange message is broadcast to neighbor routers
+    dst = IP_ALLROUTERS; //the DV exchange message is sent to the neighbor routers, which have joined the all-routers group
   }
   else
   {
@@ -761,13 +938,32 @@ int send_app_message(int sd, char* dst_name, ushort len, u_char type, char* dat)
     return 0;
   }
 
+  return send_app_message_to(router, sd, dst, len, type, dat);
+}
+
+/* send an application message to the IP address dst, which is already resolved */
+int send_app_message_to(dv_router* router, int sd, in_addr_t dst, ushort len, u_char type, char* dat)
+{
+  int ret_val;
+  struct in_addr addr;
+
   /** select an appropriate port with destination address (dst) */
   /** FILL IN YOUR CODE for dv_get_socket_for_destination() */
-  if(g_station_kind == STATION_ROUTER)
-    sd = dv_get_sock_for_destination(sd, g_myipaddrs[0], dst);
+  if(router->kind == STATION_ROUTER)
+  {
+    sd = dv_get_sock_for_destination(router, sd, router->ipaddrs[0], dst);
     //the selected source address of the router is the first IP address of the router, but we can enhance the source address selection.
 
-  ret_val = sendmessage(sd, g_myipaddrs[0], dst, len, type, dat);
+    if(sd == -1)
+    {
+      addr.s_addr = dst;
+      printf("send_app_message(): there is no route to %s\n", inet_ntoa(addr));
+      g_stats->drops[DROP_NO_ROUTE]++;
+      return 0;
+    }
+  }
+
+  ret_val = sendmessage(router, sd, router->ipaddrs[0], dst, len, type, dat);
   if(ret_val != 1)
   {
     printf("send_app_message(): sendmessage() error!\n");
@@ -779,7 +975,7 @@ int send_app_message(int sd, char* dst_name, ushort len, u_char type, char* dat)
 
 
 /* recv a message from IP stack */
-char* recvmessage(int sd, in_addr_t* src, ushort* len, u_char* type)
+char* recvmessage(dv_router* router, int sd, in_addr_t* src, ushort* len, u_char* type)
 {
   IPPkt* ippkt; //IP packet
   struct in_addr addr;
@@ -787,7 +983,7 @@ char* recvmessage(int sd, in_addr_t* src, ushort* len, u_char* type)
   int flag = 0; //it is used to know if there is an IP address matched with the destination IP address
   int i;
  
-  ippkt = recvippkt(sd);
+  ippkt = recvippkt(router, sd);
   if(ippkt == NULL) //indicate that the hub is down or that the received packet is not mine
     return NULL;
 
@@ -795,24 +991,47 @@ char* recvmessage(int sd, in_addr_t* src, ushort* len, u_char* type)
   dumpippkt(ippkt);
 #endif
 
-  for(i=0; i < g_myipaddrs_num; i++)
+  for(i=0; i < router->ipaddrs_num; i++)
   {
-    if(ippkt->dst == g_myipaddrs[i])
+    if(ippkt->dst == router->ipaddrs[i])
     {
       flag = 1;
       break;
     }
   }
 
-  if((flag == 0) && (ippkt->dst != IP_BCASTADDR) && (g_station_kind == STATION_ROUTER))
+  /* a packet to a group is for the members and is never forwarded; a membership report is for the hubs */
+  if(IN_MULTICAST(ntohl(ippkt->dst)))
+  {
+    if(!ip_is_member(router, ippkt->dst))
+    {
+      g_stats->drops[DROP_WRONG_IP]++;
+      trace_ippkt(TRACE_DROP, DROP_WRONG_IP, sd, ippkt);
+      freeippkt(ippkt);
+      return NULL;
+    }
+
+    if(ippkt->type == DATA_JOIN)
+    {
+      freeippkt(ippkt);
+      return NULL;
+    }
+    flag = 1;
+  }
+
+  if((flag == 0) && (ippkt->dst != IP_BCASTADDR) && (router->kind == STATION_ROUTER))
   { /** FILL YOUR CODE: forward the data packet to next router or host according to the router's forwarding table */
-    dv_forward(ippkt);
+    dv_forward(router, ippkt);
+    freeippkt(ippkt);
     return NULL;
   }
   else if((flag == 0) && (ippkt->dst != IP_BCASTADDR))
   {
     addr.s_addr = ippkt->dst;
     printf("recvmessage(): a wrongly destined IP packet with dst %s is received\n", inet_ntoa(addr));
+    g_stats->drops[DROP_WRONG_IP]++;
+    trace_ippkt(TRACE_DROP, DROP_WRONG_IP, sd, ippkt);
+    freeippkt(ippkt);
     return NULL;  
   }
 
@@ -829,14 +1048,555 @@ char* recvmessage(int sd, in_addr_t* src, ushort* len, u_char* type)
   }
 
   memcpy(dat, ippkt->dat, ippkt->len);
+  g_stats->allocs++;
 
   freeippkt(ippkt);
 
   return dat;
 }
 
+/*----------------------------------------------------------------*/
+/* bulk transfer: a payload of any length is cut into segments of
+   BULK_SEG_SIZE bytes, each sent as a DATA_BULK IP packet with a BulkHdr.
+   The receiver copies every segment into the reassembly buffer of the
+   transfer, accepting the segments inside a window of BULK_WINDOW segments
+   from the first missing one, and answers each with a DATA_ACK carrying the
+   cumulative and selective acknowledgements of the window.
+
+   The sender keeps at most min(cwnd, BULK_WINDOW) segments past the first
+   unacknowledged one in flight. It grows cwnd by a segment per ACK in slow
+   start and by a segment per window above ssthresh, retransmits a segment
+   once BULK_DUP_THRESH segments after it are acknowledged (halving cwnd,
+   once per window), and on a retransmission timeout resends the first
+   missing segment with cwnd of 1 and a doubled timeout. The timeout follows
+   the smoothed RTT and its variation, sampled from segments sent once. */
+
+BulkRx g_bulk_rx[BULK_RX_SLOTS]; //transfers being reassembled
+BulkTx g_bulk_tx[BULK_TX_SLOTS]; //transfers being sent
+unsigned int g_bulk_next_id; //id of the next bulk transfer to send
+
+static int bulk_send_segment(dv_router* router, BulkTx* tx, unsigned int seq)
+{ //send segment seq of tx and start the retransmission timer if nothing else was in flight
+  char seg[sizeof(BulkHdr) + BULK_SEG_SIZE]; //segment being sent
+  BulkHdr hdr;
+  unsigned int n; //data length of the segment
+  long long now = getmonotime();
+
+  n = (seq == tx->segs - 1) ? tx->total - seq * BULK_SEG_SIZE : BULK_SEG_SIZE;
+  hdr.id = htonl(tx->id);
+  hdr.seq = htonl(seq);
+  hdr.total = htonl(tx->total);
+  memcpy(seg, &hdr, sizeof(BulkHdr));
+  memcpy(seg + sizeof(BulkHdr), tx->buf + seq * BULK_SEG_SIZE, n);
+
+  if(tx->deadline == 0)
+    tx->deadline = now + tx->rto;
+  tx->sent[seq % BULK_WINDOW] = now;
+  g_stats->bulk_segs_sent++;
+
+  /* a segment that cannot be sent is lost, and the timer recovers it */
+  return send_app_message_to(router, tx->sd, tx->dst, sizeof(BulkHdr) + n, DATA_BULK, seg);
+}
+
+static void bulk_send_window(dv_router* router, BulkTx* tx)
+{ //send the new segments the window allows
+  unsigned int wnd = (tx->cwnd < BULK_WINDOW) ? (unsigned int) tx->cwnd : BULK_WINDOW;
+
+  while(tx->next < tx->segs && tx->next < tx->base + wnd)
+  {
+    tx->sacked[tx->next % BULK_WINDOW] = 0;
+    tx->retx[tx->next % BULK_WINDOW] = 0;
+    bulk_send_segment(router, tx, tx->next);
+    tx->next++;
+  }
+}
+
+static void bulk_retransmit(dv_router* router, BulkTx* tx, unsigned int seq)
+{ //send segment seq of tx again
+  tx->retx[seq % BULK_WINDOW] = 1;
+  tx->retransmits++;
+  g_stats->bulk_segs_retx++;
+  bulk_send_segment(router, tx, seq);
+}
+
+static void bulk_sample_rtt(BulkTx* tx, long long rtt)
+{ //update the smoothed RTT and the retransmission timeout with a sample
+  long long err;
+
+  if(tx->srtt == 0)
+  {
+    tx->srtt = rtt;
+    tx->rttvar = rtt / 2;
+  }
+  else
+  {
+    err = rtt - tx->srtt;
+    tx->srtt += err / 8;
+    tx->rttvar += ((err < 0 ? -err : err) - tx->rttvar) / 4;
+  }
+
+  tx->rto = tx->srtt + 4 * tx->rttvar;
+  if(tx->rto < BULK_RTO_MIN)
+    tx->rto = BULK_RTO_MIN;
+  if(tx->rto > BULK_RTO_MAX)
+    tx->rto = BULK_RTO_MAX;
+}
+
+static void bulk_send_ack(dv_router* router, int sd, BulkRx* rx, unsigned int seq)
+{ //acknowledge the segments of rx received so far
+  BulkAck ack;
+  unsigned int i;
+
+  memset(&ack, 0, sizeof(BulkAck));
+  if(rx->state == BULK_BUSY)
+  {
+    for(i = 0; i < BULK_WINDOW; i++)
+      if(rx->next + i < rx->segs && rx->ack[(rx->next + i) % BULK_WINDOW])
+        ack.sack[i / 32] |= 1U << (i % 32);
+  }
+  for(i = 0; i < BULK_WINDOW/32; i++)
+    ack.sack[i] = htonl(ack.sack[i]);
+  ack.id = htonl(rx->id);
+  ack.next = htonl(rx->next);
+  ack.seq = htonl(seq);
+
+  send_app_message_to(router, sd, rx->src, sizeof(BulkAck), DATA_ACK, (char*) &ack);
+}
+
+/* send len bytes of dat to the station dst_name as a bulk transfer; return its id, or 0 on failure.
+   Only the first window is sent here; the ACKs and check_bulk_timers() send the rest. */
+unsigned int send_bulk_message(dv_router* router, int sd, char* dst_name, unsigned int len, char* dat)
+{
+  BulkTx* tx = NULL;
+  in_addr_t ipaddr[ADDR_NUM];
+  int ipaddr_num = 0;
+  int i;
+
+  if(len == 0 || len > BULK_MAX_SIZE)
+  {
+    printf("send_bulk_message(): the length of a bulk transfer should be 1 to %d bytes\n", BULK_MAX_SIZE);
+    return 0;
+  }
+
+  if(dns_name_to_ipaddr(dst_name, ipaddr, &ipaddr_num) == 0)
+  {
+    printf("send_bulk_message(): the DNS name \"%s\" is not registered in our DNS system\n", dst_name);
+    return 0;
+  }
+
+  /* take an idle slot, or the one of the oldest finished transfer */
+  for(i = 0; i < BULK_TX_SLOTS; i++)
+  {
+    if(g_bulk_tx[i].state == BULK_BUSY)
+      continue;
+    if(tx == NULL || g_bulk_tx[i].state == BULK_IDLE || (tx->state != BULK_IDLE && g_bulk_tx[i].end < tx->end))
+      tx = &g_bulk_tx[i];
+  }
+  if(tx == NULL)
+  {
+    printf("send_bulk_message(): %d bulk transfers are already in progress\n", BULK_TX_SLOTS);
+    return 0;
+  }
+
+  /* the sender keeps a copy for retransmissions; the buffer of the slot only grows */
+  if(tx->buf_size < len)
+  {
+    free(tx->buf);
+    tx->buf = (char *) malloc(len);
+    if (!tx->buf) {
+      fprintf(stderr, "error : unable to malloc\n");
+      exit(1);
+    }
+    tx->buf_size = len;
+    g_stats->allocs++;
+  }
+  memcpy(tx->buf, dat, len);
+
+  /* start from a time-based id so that a restarted sender does not reuse the ids of its last run */
+  if(g_bulk_next_id == 0)
+    g_bulk_next_id = (unsigned int) getmonotime() | 1;
+
+  tx->state = BULK_BUSY;
+  tx->sd = sd;
+  tx->dst = ipaddr[0];
+  tx->id = g_bulk_next_id++;
+  tx->total = len;
+  tx->segs = (len + BULK_SEG_SIZE - 1) / BULK_SEG_SIZE;
+  tx->base = 0;
+  tx->next = 0;
+  tx->cwnd = 2;
+  tx->ssthresh = BULK_WINDOW;
+  tx->recover = 0;
+  tx->srtt = 0;
+  tx->rttvar = 0;
+  tx->rto = BULK_RTO_INIT;
+  tx->deadline = 0;
+  tx->retries = 0;
+  tx->retransmits = 0;
+  tx->start = getmonotime();
+  tx->end = 0;
+
+  bulk_send_window(router, tx);
+  return tx->id;
+}
+
+/* take a received bulk segment from src and acknowledge it; return the reassembly of its transfer when the
+   transfer is complete, or NULL. The buffer of the returned transfer is valid until the next segment is received. */
+BulkRx* recv_bulk_segment(dv_router* router, int sd, in_addr_t src, ushort len, char* dat)
+{
+  BulkHdr hdr;
+  BulkRx* rx = NULL;
+  unsigned int segs;
+  unsigned int n; //data length of the segment
+  int i;
+
+  /* check the segment against its header */
+  if(len < sizeof(BulkHdr))
+  {
+    g_stats->bulk_segs_dropped++;
+    return NULL;
+  }
+  memcpy(&hdr, dat, sizeof(BulkHdr));
+  hdr.id = ntohl(hdr.id);
+  hdr.seq = ntohl(hdr.seq);
+  hdr.total = ntohl(hdr.total);
+
+  segs = (hdr.total + BULK_SEG_SIZE - 1) / BULK_SEG_SIZE;
+  n = (hdr.seq == segs - 1) ? hdr.total - hdr.seq * BULK_SEG_SIZE : BULK_SEG_SIZE;
+  if(hdr.total == 0 || hdr.total > BULK_MAX_SIZE || hdr.seq >= segs || len - sizeof(BulkHdr) != n)
+  {
+    g_stats->bulk_segs_dropped++;
+    return NULL;
+  }
+
+  /* find the transfer, or give it an idle slot (or the one waiting longest) */
+  for(i = 0; i < BULK_RX_SLOTS; i++)
+  {
+    if(g_bulk_rx[i].state != BULK_IDLE && g_bulk_rx[i].src == src && g_bulk_rx[i].id == hdr.id && g_bulk_rx[i].total == hdr.total)
+    {
+      rx = &g_bulk_rx[i];
+      break;
+    }
+  }
+
+  if(rx == NULL)
+  {
+    if(hdr.seq >= BULK_WINDOW) //the first window of the transfer is already gone
+    {
+      g_stats->bulk_segs_dropped++;
+      return NULL;
+    }
+
+    for(i = 0; i < BULK_RX_SLOTS; i++)
+    {
+      if(g_bulk_rx[i].state == BULK_IDLE)
+      {
+        rx = &g_bulk_rx[i];
+        break;
+      }
+      if(rx == NULL || g_bulk_rx[i].last < rx->last)
+        rx = &g_bulk_rx[i];
+    }
+
+    /* the buffer of the slot only grows, so a run of transfers allocates it once */
+    if(rx->buf_size < hdr.total)
+    {
+      free(rx->buf);
+      rx->buf = (char *) malloc(hdr.total);
+      if (!rx->buf) {
+        fprintf(stderr, "error : unable to malloc\n");
+        exit(1);
+      }
+      rx->buf_size = hdr.total;
+      g_stats->allocs++;
+    }
+
+    rx->src = src;
+    rx->id = hdr.id;
+    rx->total = hdr.total;
+    rx->segs = segs;
+    rx->next = 0;
+    memset(rx->ack, 0, sizeof(rx->ack));
+    rx->state = BULK_BUSY;
+    rx->start = getmonotime();
+  }
+
+  /* accept the segment only inside the window and only once, but acknowledge it anyway in case the last ACK was lost */
+  if(rx->state == BULK_DONE || hdr.seq < rx->next || hdr.seq >= rx->next + BULK_WINDOW || rx->ack[hdr.seq % BULK_WINDOW])
+  {
+    g_stats->bulk_segs_dropped++;
+    bulk_send_ack(router, sd, rx, hdr.seq);
+    return NULL;
+  }
+
+  memcpy(rx->buf + hdr.seq * BULK_SEG_SIZE, dat + sizeof(BulkHdr), n);
+  rx->ack[hdr.seq % BULK_WINDOW] = 1;
+  rx->last = getmonotime();
+  g_stats->bulk_segs_rcvd++;
+
+  /* slide the window over the segments received in order */
+  while(rx->next < rx->segs && rx->ack[rx->next % BULK_WINDOW])
+  {
+    rx->ack[rx->next % BULK_WINDOW] = 0;
+    rx->next++;
+  }
+
+  if(rx->next == rx->segs)
+    rx->state = BULK_DONE;
+  bulk_send_ack(router, sd, rx, hdr.seq);
+
+  if(rx->state != BULK_DONE)
+    return NULL;
+
+  g_stats->bulk_bytes_rcvd += rx->total;
+  return rx;
+}
+
+/* take a received bulk ACK from src and send what the window allows; return the transfer when it is complete, or NULL */
+BulkTx* recv_bulk_ack(dv_router* router, in_addr_t src, ushort len, char* dat)
+{
+  BulkAck ack;
+  BulkTx* tx = NULL;
+  unsigned int seq;
+  unsigned int highest; //highest segment acknowledged
+  int progress = 0; //whether the ACK acknowledges segments for the first time
+  int i;
+
+  if(len != sizeof(BulkAck))
+    return NULL;
+  memcpy(&ack, dat, sizeof(BulkAck));
+  ack.id = ntohl(ack.id);
+  ack.next = ntohl(ack.next);
+  ack.seq = ntohl(ack.seq);
+  for(i = 0; i < BULK_WINDOW/32; i++)
+    ack.sack[i] = ntohl(ack.sack[i]);
+
+  for(i = 0; i < BULK_TX_SLOTS; i++)
+  {
+    if(g_bulk_tx[i].state == BULK_BUSY && g_bulk_tx[i].dst == src && g_bulk_tx[i].id == ack.id)
+    {
+      tx = &g_bulk_tx[i];
+      break;
+    }
+  }
+  if(tx == NULL || ack.next > tx->next || ack.next < tx->base)
+    return NULL; //stale or bogus
+  g_stats->bulk_acks_rcvd++;
+
+  /* RTT sample from a segment sent only once (Karn's algorithm) */
+  if(ack.seq >= tx->base && ack.seq < tx->next && !tx->retx[ack.seq % BULK_WINDOW] && !tx->sacked[ack.seq % BULK_WINDOW])
+    bulk_sample_rtt(tx, getmonotime() - tx->sent[ack.seq % BULK_WINDOW]);
+
+  /* cumulative acknowledgement: slide the window and restart the timer */
+  if(ack.next > tx->base)
+  {
+    progress = 1;
+    tx->base = ack.next;
+    tx->deadline = (tx->base < tx->next) ? getmonotime() + tx->rto : 0;
+  }
+
+  /* selective acknowledgement of the segments past the first missing one */
+  highest = tx->base;
+  for(i = 0; i < BULK_WINDOW; i++)
+  {
+    seq = tx->base + i;
+    if(seq >= tx->next)
+      break;
+    if(ack.sack[i / 32] & (1U << (i % 32)))
+    {
+      if(!tx->sacked[seq % BULK_WINDOW])
+        progress = 1;
+      tx->sacked[seq % BULK_WINDOW] = 1;
+      highest = seq;
+    }
+  }
+
+  if(tx->base == tx->segs)
+  {
+    tx->state = BULK_DONE;
+    tx->end = getmonotime();
+    return tx;
+  }
+
+  /* additive increase: a segment per new ACK in slow start, a segment per window after it */
+  if(progress)
+  {
+    tx->retries = 0;
+    if(tx->cwnd < tx->ssthresh)
+      tx->cwnd += 1;
+    else
+      tx->cwnd += 1 / tx->cwnd;
+  }
+
+  /* a missing segment with BULK_DUP_THRESH segments acknowledged after it is lost */
+  for(seq = tx->base; seq + BULK_DUP_THRESH <= highest; seq++)
+  {
+    if(tx->sacked[seq % BULK_WINDOW] || tx->retx[seq % BULK_WINDOW])
+      continue;
+
+    /* multiplicative decrease, once per window of losses */
+    if(seq >= tx->recover)
+    {
+      tx->ssthresh = (tx->cwnd / 2 < 2) ? 2 : tx->cwnd / 2;
+      tx->cwnd = tx->ssthresh;
+      tx->recover = tx->next;
+    }
+    bulk_retransmit(router, tx, seq);
+  }
+
+  bulk_send_window(router, tx);
+  return NULL;
+}
+
+/* resend the first missing segment of every transfer whose retransmission timer has expired;
+   return a transfer given up after BULK_MAX_RETRIES timeouts in a row, or NULL */
+BulkTx* check_bulk_timers(dv_router* router)
+{
+  BulkTx* tx;
+  BulkTx* failed = NULL;
+  long long now = getmonotime();
+  unsigned int seq;
+  int i;
+
+  for(i = 0; i < BULK_TX_SLOTS; i++)
+  {
+    tx = &g_bulk_tx[i];
+    if(tx->state != BULK_BUSY || tx->deadline == 0 || tx->deadline > now)
+      continue;
+
+    g_stats->bulk_timeouts++;
+    if(++tx->retries > BULK_MAX_RETRIES)
+    {
+      tx->state = BULK_FAILED;
+      tx->end = now;
+      if(failed == NULL)
+        failed = tx;
+      continue;
+    }
+
+    /* back off, restart slow start from a segment and forget the retransmissions before the timeout */
+    tx->ssthresh = (tx->cwnd / 2 < 2) ? 2 : tx->cwnd / 2;
+    tx->cwnd = 1;
+    tx->recover = tx->next;
+    tx->rto = (tx->rto * 2 > BULK_RTO_MAX) ? BULK_RTO_MAX : tx->rto * 2;
+    tx->deadline = 0;
+    for(seq = tx->base; seq < tx->next; seq++)
+      tx->retx[seq % BULK_WINDOW] = tx->sacked[seq % BULK_WINDOW];
+
+    bulk_retransmit(router, tx, tx->base);
+  }
+
+  return failed;
+}
+
+/* microseconds until the first retransmission timer expires, or -1 when no timer runs */
+long long bulk_timer_wait()
+{
+  long long wait = -1;
+  long long now = getmonotime();
+  int i;
+
+  for(i = 0; i < BULK_TX_SLOTS; i++)
+  {
+    if(g_bulk_tx[i].state != BULK_BUSY || g_bulk_tx[i].deadline == 0)
+      continue;
+    if(wait == -1 || g_bulk_tx[i].deadline - now < wait)
+      wait = (g_bulk_tx[i].deadline > now) ? g_bulk_tx[i].deadline - now : 0;
+  }
+
+  return wait;
+}
+
+/* Adler-32 checksum of a bulk payload, for comparing what was sent with what was received */
+unsigned int bulk_checksum(char* dat, unsigned int len)
+{
+  unsigned int a = 1, b = 0;
+  unsigned int i;
+
+  for(i = 0; i < len; i++)
+  {
+    a = (a + (u_char) dat[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+
+  return (b << 16) | a;
+}
+/*----------------------------------------------------------------*/
+
+/* write the header of ippkt with the checksum cksum into hdr of IP_HDR_SIZE bytes */
+static void ip_write_header(IPPkt *ippkt, ushort cksum, char *hdr)
+{
+  ushort len = htons(ippkt->len);
+
+  cksum = htons(cksum);
+  memcpy(hdr, &(ippkt->dst), sizeof(in_addr_t));
+  memcpy(hdr + 4, &(ippkt->src), sizeof(in_addr_t));
+  memcpy(hdr + 8, &len, sizeof(ushort));
+  hdr[10] = ippkt->type;
+  hdr[11] = ippkt->ttl;
+  hdr[12] = IP_VERSION;
+  hdr[13] = 0;
+  memcpy(hdr + 14, &cksum, sizeof(ushort));
+}
+
+/* return the ones' complement of the ones' complement sum of the 16-bit words of buf; 0 over a header with its checksum */
+static ushort ip_cksum(char *buf, int len)
+{
+  u_char *ptr = (u_char *) buf;
+  unsigned int sum = 0;
+  int i;
+
+  for (i = 0; i + 1 < len; i += 2)
+    sum += (ptr[i] << 8) | ptr[i+1];
+  if (i < len)
+    sum += ptr[i] << 8;
+
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+  return (ushort) ~sum;
+}
+
+/* compute the header checksum of ippkt to be sent */
+ushort ip_header_cksum(IPPkt *ippkt)
+{
+  char hdr[IP_HDR_SIZE];
+
+  ip_write_header(ippkt, 0, hdr);
+  return ip_cksum(hdr, IP_HDR_SIZE);
+}
+
+/* update the checksum cksum after a 16-bit word of the header changes from "from" to "to" (RFC 1624) */
+ushort ip_cksum_update(ushort cksum, ushort from, ushort to)
+{
+  unsigned int sum;
+
+  /* HC' = ~(~HC + ~m + m') */
+  sum = (ushort) ~cksum + (ushort) ~from + to;
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+  return (ushort) ~sum;
+}
+
+/* return 1 if ethpkt is a DV message or a membership report with a valid IP header sent to the
+   all-routers group or broadcast; policers let this traffic through so that routing keeps going under load */
+int ethpkt_is_control(EthPkt *ethpkt)
+{
+  HwAddr allrouters;
+
+  ip_mcast_to_hwaddr(IP_ALLROUTERS, allrouters);
+  if(hwaddrcmp(ethpkt->dst, allrouters) != 0 && hwaddrcmp(ethpkt->dst, BCASTADDR) != 0)
+    return 0;
+
+  if(ethpkt->len < IP_HDR_SIZE || (u_char) ethpkt->dat[12] != IP_VERSION || ip_cksum(ethpkt->dat, IP_HDR_SIZE) != 0)
+    return 0;
+
+  return (ethpkt->dat[10] == DATA_DV || ethpkt->dat[10] == DATA_JOIN);
+}
+
 /* recv an IP packet */
-IPPkt *recvippkt(int sd)
+IPPkt *recvippkt(dv_router* router, int sd)
 {
   EthPkt *ethpkt; //Ethernet frame
   IPPkt *ippkt; //IP packet
@@ -850,11 +1610,44 @@ IPPkt *recvippkt(int sd)
   dumpethpkt(ethpkt);
 #endif
 
-  if(hwaddrcmp(ethpkt->dst, BCASTADDR) != 0 && hwaddrcmp(ethpkt->dst, g_myhwaddr) != 0)
+  if(!hwaddr_is_mine(router, ethpkt->dst))
   {
-    /* just ignore */
-    printf("recvippkt(): a wrongly destined ethernet frame is received\n");
+    /* just ignore; a hub passes a group's frames to every station until it learns the members */
+    if(!(ethpkt->dst[0] & 0x01))
+      printf("recvippkt(): a wrongly destined ethernet frame is received\n");
     //dumpethpkt(ethpkt);
+    g_stats->drops[DROP_WRONG_MAC]++;
+    trace_ethpkt(TRACE_DROP, DROP_WRONG_MAC, sd, ethpkt);
+    freeethpkt(ethpkt);
+    return NULL;
+  }
+
+  /* check the header before trusting its length */
+  if(ethpkt->len < IP_HDR_SIZE || (u_char) ethpkt->dat[12] != IP_VERSION)
+  {
+    printf("recvippkt(): a malformed IP packet is received\n");
+    g_stats->drops[DROP_MALFORMED]++;
+    trace_ethpkt(TRACE_DROP, DROP_MALFORMED, sd, ethpkt);
+    freeethpkt(ethpkt);
+    return NULL;
+  }
+
+  if(ip_cksum(ethpkt->dat, IP_HDR_SIZE) != 0)
+  {
+    printf("recvippkt(): an IP packet with a wrong header checksum is received\n");
+    g_stats->drops[DROP_BAD_CKSUM]++;
+    trace_ethpkt(TRACE_DROP, DROP_BAD_CKSUM, sd, ethpkt);
+    freeethpkt(ethpkt);
+    return NULL;
+  }
+
+  /* the neighbor sends data faster than the policer of the link allows; only valid frames
+     taken by this router use up its tokens, and DV messages and membership reports are not policed */
+  if(!ethpkt_is_control(ethpkt) && !police_frame(sd, 2*sizeof(HwAddr) + sizeof(ushort) + ethpkt->len))
+  {
+    g_stats->drops[DROP_POLICED]++;
+    trace_ethpkt(TRACE_DROP, DROP_POLICED, sd, ethpkt);
+    freeethpkt(ethpkt);
     return NULL;
   }
 
@@ -882,6 +1675,26 @@ IPPkt *recvippkt(int sd)
   memcpy(&(ippkt->type), ptr, sizeof(ippkt->type));
   ptr += sizeof(ippkt->type);
 
+  memcpy(&(ippkt->ttl), ptr, sizeof(ippkt->ttl));
+  ptr += sizeof(ippkt->ttl);
+
+  ptr += 2*sizeof(u_char); //version and reserved
+
+  memcpy(&(ippkt->cksum), ptr, sizeof(ippkt->cksum));
+  ptr += sizeof(ippkt->cksum);
+  ippkt->cksum = ntohs(ippkt->cksum);
+
+  /* the payload is what follows the header in the frame */
+  if(ippkt->len != ethpkt->len - IP_HDR_SIZE)
+  {
+    printf("recvippkt(): an IP packet with a wrong length is received\n");
+    g_stats->drops[DROP_MALFORMED]++;
+    trace_ethpkt(TRACE_DROP, DROP_MALFORMED, sd, ethpkt);
+    free(ippkt);
+    freeethpkt(ethpkt);
+    return NULL;
+  }
+
   /* allocate space for payload */
   ippkt->dat = (char *) malloc(ippkt->len);
   if (!(ippkt->dat)) {
@@ -892,6 +1705,7 @@ IPPkt *recvippkt(int sd)
 
   /* read the data */
   memcpy(ippkt->dat, ptr, ippkt->len);  
+  g_stats->allocs += 2;
 
   freeethpkt(ethpkt);
 
@@ -900,68 +1714,25 @@ IPPkt *recvippkt(int sd)
 }
 
 /* send an IP packet */
-int sendippkt(int sd, IPPkt *ippkt)
+int sendippkt(dv_router* router, int sd, IPPkt *ippkt)
 {
-  char * buf;
-  char * ptr;
-  ushort  len;
-  ushort  ippkt_length;
-  EthPkt *ethpkt; //Ethernet frame
-  int ret_val;
+  HwAddr hwdst; //destination MAC address
   int i;
   int flag; //indicate the MAC address is already obtained
 
-  /* allocate space for the buffer */
-  len = 2*sizeof(in_addr_t) + sizeof(ushort) + sizeof(u_char) + ippkt->len;
-  buf = (char *) calloc(len, sizeof(char));
-  if (!buf) {
-    fprintf(stderr, "error : unable to calloc\n");
-    exit(1);
-  }
-
-  /* linearize the ethpkt. first head and then data */
-  ptr = buf;
-
-  memcpy(ptr, &(ippkt->dst), sizeof(in_addr_t));
-  ptr += sizeof(in_addr_t);
-
-  memcpy(ptr, &(ippkt->src), sizeof(in_addr_t));
-  ptr += sizeof(in_addr_t);
-
-  ippkt_length = ippkt->len; //use it later to copy the IP packet's payload into buf
-  ippkt->len = htons(ippkt->len); //convert host byte-order into network byte-order
-  memcpy(ptr, &(ippkt->len), sizeof(ushort));
-  ptr += sizeof(ushort);
-
-  memcpy(ptr, &(ippkt->type), sizeof(u_char));
-  ptr += sizeof(u_char);
-
-  memcpy(ptr, ippkt->dat, ippkt_length);
-
-  /** make Ethernet packet */
-  /* allocate space for the ethpkt */
-  ethpkt = (EthPkt *) calloc(1, sizeof(EthPkt));
-  if (!ethpkt) {
-    fprintf(stderr, "error : unable to calloc\n");
-    return 0;
-  }
-
-  /** find the src and dst MAC addresses through ARP function */
-  arp_ipaddr_to_hwaddr(ippkt->src, ethpkt->src);
-  
   /* the destination MAC address should be chosen according to the data type and the location of destination host */
 
-  if(ippkt->type == DATA_DV)
-    arp_ipaddr_to_hwaddr(IP_BCASTADDR, ethpkt->dst);
-  else if(ippkt->type == DATA_CHAT) //else if-1
+  if(ippkt->type == DATA_DV || ippkt->type == DATA_JOIN) //sent to a group or broadcast
+    arp_ipaddr_to_hwaddr(ippkt->dst, hwdst);
+  else if(ippkt->type == DATA_CHAT || ippkt->type == DATA_BULK || ippkt->type == DATA_ACK) //else if-1
   {
     flag = 0;
-    for(i = 0; i < g_mynetmasks_num; i++)
+    for(i = 0; i < router->ipaddrs_num; i++)
     {
-      if((ippkt->src & g_mynetmasks[i]) == (ippkt->dst & g_mynetmasks[i])) //Since the destination host is located in the same network, the MAC address of the destination host is used.
+      if((ippkt->src & router->netmasks[i]) == (ippkt->dst & router->netmasks[i])) //Since the destination host is located in the same network, the MAC address of the destination host is used.
       //if((g_myipaddr & g_mynetmask) == (ippkt->dst & g_mynetmask)) //Since the destination host is located in the same network, the MAC address of the destination host is used.
       {
-        arp_ipaddr_to_hwaddr(ippkt->dst, ethpkt->dst);
+        arp_ipaddr_to_hwaddr(ippkt->dst, hwdst);
         flag = 1; //indicate the MAC address is already obtained
         break;
       }
@@ -969,14 +1740,17 @@ int sendippkt(int sd, IPPkt *ippkt)
 
     if(flag != 1) //if-2
     {
-      if(g_station_kind == STATION_HOST) //the packet should be sent to the default router, the MAC address of the default router is used.
-        arp_ipaddr_to_hwaddr(g_mygwaddr, ethpkt->dst);
-      else if(g_station_kind == STATION_ROUTER) 
+      if(router->kind == STATION_HOST) //the packet should be sent to the default router, the MAC address of the default router is used.
+        arp_ipaddr_to_hwaddr(router->gwaddr, hwdst);
+      else if(router->kind == STATION_ROUTER) 
+      {
 	/** FILL IN YOUR CODE for dv_ipaddr_to_hwaddr() */ 
-        dv_ipaddr_to_hwaddr(ippkt->dst, ethpkt->dst); //convert the dst IP address into next hop's MAC address
+        if(!dv_ipaddr_to_hwaddr(router, ippkt->src, ippkt->dst, hwdst)) //convert the dst IP address into next hop's MAC address
+          return 0;
+      }
       else
       {
-        printf("sendippkt(): g_station_kind (%d) is not supported to send IP packet\n", g_station_kind);
+        printf("sendippkt(): station kind (%d) is not supported to send IP packet\n", router->kind);
         return 0;
       }
     } //end of if-2
@@ -986,6 +1760,42 @@ int sendippkt(int sd, IPPkt *ippkt)
     printf("sendippkt(): Unknown data type (%d)!\n", ippkt->type);
     return 0;
   }
+
+  return sendippkt_with_hwaddr(router, sd, ippkt, hwdst);
+}
+
+/* send an IP packet to the station with hwdst; the MAC address is already resolved (e.g., by the flow cache of router) */
+int sendippkt_with_hwaddr(dv_router* router, int sd, IPPkt *ippkt, HwAddr hwdst)
+{
+  char * buf;
+  ushort  len;
+  EthPkt *ethpkt; //Ethernet frame
+  int ret_val;
+
+  /* allocate space for the buffer */
+  len = IP_HDR_SIZE + ippkt->len;
+  buf = (char *) calloc(len, sizeof(char));
+  if (!buf) {
+    fprintf(stderr, "error : unable to calloc\n");
+    exit(1);
+  }
+
+  /* linearize the ippkt. first head and then data */
+  ip_write_header(ippkt, ippkt->cksum, buf);
+  memcpy(buf + IP_HDR_SIZE, ippkt->dat, ippkt->len);
+
+  /** make Ethernet packet */
+  /* allocate space for the ethpkt */
+  ethpkt = (EthPkt *) calloc(1, sizeof(EthPkt));
+  if (!ethpkt) {
+    fprintf(stderr, "error : unable to calloc\n");
+    free(buf);
+    return 0;
+  }
+
+  /** the src MAC address is always mine, even for a packet forwarded by router, so that a switch learns the port of each station correctly */
+  hwaddrcpy(ethpkt->src, router->hwaddr);
+  hwaddrcpy(ethpkt->dst, hwdst);
   
   memcpy(&(ethpkt->len), &len, sizeof(ethpkt->len)); //host byte-order
 
@@ -994,11 +1804,13 @@ int sendippkt(int sd, IPPkt *ippkt)
   if (!(ethpkt->dat)) {
     fprintf(stderr, "error : unable to malloc\n");
     free(ethpkt);
+    free(buf);
     return 0;
   }
 
   /* write the data */
   memcpy(ethpkt->dat, buf, len); 
+  g_stats->allocs += 3;
 
   /* send the packet to MAC layer */
   // printf("sendippkt sock is %d\n",sd);
@@ -1291,10 +2103,25 @@ long getcurtime()
 {
   struct timeval tv;
 
+  if (g_clock_hook)
+    return(g_clock_hook());
+
   gettimeofday(&tv, NULL);
   return(tv.tv_sec);
 }
 
+/* monotonic time in microseconds for measuring intervals */
+long long getmonotime()
+{
+  struct timespec ts;
+
+  if (g_monoclock_hook)
+    return(g_monoclock_hook());
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec*1000000LL + ts.tv_nsec/1000);
+}
+
 /* convert secs to hour:min:sec format */
 char *timetostring(long secs)
 {